@@ -0,0 +1,269 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <disk_cache.h>
+#include <mapped_file.h>
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_array.h>
+#include <core/md_log.h>
+#include <core/md_os.h>
+#include <md_trajectory.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DISK_CACHE_MAGIC   0x48434456 // 'VDCH'
+#define DISK_CACHE_VERSION 2
+// Number of locks which guard the slots, slots are assigned to locks by their index
+#define DISK_CACHE_LOCK_STRIPES 64
+
+struct DiskCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frame_header_size; // sizeof(md_trajectory_frame_header_t), the frame header is stored as is
+    uint32_t reserved;
+    uint64_t path_hash;
+    uint64_t subset_hash;
+    uint64_t traj_size;
+    int64_t  traj_mtime;
+    int64_t  num_frames;
+    int64_t  num_atoms;
+    int64_t  num_slots;
+    int64_t  slot_size;
+};
+
+struct DiskSlot {
+    uint64_t frame;     // Frame index + 1, 0 denotes an empty slot (which is what a freshly truncated file contains)
+    uint64_t tag;
+    md_trajectory_frame_header_t header;
+    // x, y, z follows (at a 64 byte aligned offset from the start of the slot)
+};
+
+struct disk_cache_t {
+    mapped_file_t file;
+    uint8_t* base;      // First slot
+    int64_t  num_slots;
+    int64_t  slot_size;
+    int64_t  coord_offset;
+    int64_t  num_atoms;
+    md_mutex_t locks[DISK_CACHE_LOCK_STRIPES];
+};
+
+struct CacheFileEntry {
+    char     path[1100];
+    uint64_t size;
+    int64_t  mtime;
+};
+
+struct CacheDirScan {
+    const char* skip;   // File name (without directory) which is not considered
+    md_array(CacheFileEntry) entries;
+};
+
+static void add_cache_file(const char* path, void* user_data) {
+    CacheDirScan* scan = (CacheDirScan*)user_data;
+    const size_t path_len = strlen(path);
+    const size_t skip_len = strlen(scan->skip);
+    if (path_len > skip_len && strcmp(path + path_len - skip_len, scan->skip) == 0 && (path[path_len - skip_len - 1] == '/' || path[path_len - skip_len - 1] == '\\')) return;
+    CacheFileEntry entry = {};
+    snprintf(entry.path, sizeof(entry.path), "%s", path);
+    if (!file_stat(path, NULL, &entry.mtime)) return;
+    entry.size = file_allocated_size(path);
+    md_array_push(scan->entries, entry, md_heap_allocator);
+}
+
+static int compare_mtime(const void* a, const void* b) {
+    const int64_t ma = ((const CacheFileEntry*)a)->mtime;
+    const int64_t mb = ((const CacheFileEntry*)b)->mtime;
+    return (ma > mb) - (ma < mb);
+}
+
+// Evicts the least recently used cache files of the directory until the files, together with the reserved bytes of the file to be opened, fit the limit.
+// Files which are in use by other instances are left alone.
+static void evict_cache_files(const char* dir, const char* keep_name, uint64_t reserve, uint64_t limit) {
+    CacheDirScan scan = {keep_name, NULL};
+    list_files(dir, ".vfc", add_cache_file, &scan);
+
+    uint64_t total = reserve;
+    for (int64_t i = 0; i < md_array_size(scan.entries); ++i) {
+        total += scan.entries[i].size;
+    }
+    if (total > limit && md_array_size(scan.entries) > 1) {
+        qsort(scan.entries, (size_t)md_array_size(scan.entries), sizeof(CacheFileEntry), compare_mtime);
+    }
+    for (int64_t i = 0; i < md_array_size(scan.entries) && total > limit; ++i) {
+        if (remove_unused_file(scan.entries[i].path)) {
+            MD_LOG_INFO("Disk cache: evicted '%s'", scan.entries[i].path);
+            total -= scan.entries[i].size;
+        }
+    }
+    md_array_free(scan.entries, md_heap_allocator);
+}
+
+disk_cache_t* disk_cache_open(str_t traj_path, uint64_t subset_hash, int64_t num_frames, int64_t num_atoms, int64_t budget_in_bytes, int64_t total_budget_in_bytes) {
+    if (num_frames <= 0 || num_atoms <= 0 || budget_in_bytes <= 0 || total_budget_in_bytes <= 0) return NULL;
+    budget_in_bytes = MIN(budget_in_bytes, total_budget_in_bytes);
+
+    char traj_file[2048];
+    snprintf(traj_file, sizeof(traj_file), "%.*s", (int)traj_path.len, traj_path.ptr);
+
+    DiskCacheHeader header = {};
+    header.magic = DISK_CACHE_MAGIC;
+    header.version = DISK_CACHE_VERSION;
+    header.frame_header_size = (uint32_t)sizeof(md_trajectory_frame_header_t);
+    header.path_hash = hash_bytes(traj_path.ptr, traj_path.len);
+    header.subset_hash = subset_hash;
+    if (!file_stat(traj_file, &header.traj_size, &header.traj_mtime)) {
+        MD_LOG_ERROR("Disk cache: could not stat trajectory file '%s'", traj_file);
+        return NULL;
+    }
+
+    const int64_t coord_offset = ALIGN_TO((int64_t)sizeof(DiskSlot), 64);
+    const int64_t slot_size = ALIGN_TO(coord_offset + num_atoms * 3 * (int64_t)sizeof(float), 4096);
+    const int64_t header_size = ALIGN_TO((int64_t)sizeof(DiskCacheHeader), 4096);
+    const int64_t num_slots = MIN(num_frames, (budget_in_bytes - header_size) / slot_size);
+    if (num_slots <= 0) return NULL;
+
+    header.num_frames = num_frames;
+    header.num_atoms  = num_atoms;
+    header.num_slots  = num_slots;
+    header.slot_size  = slot_size;
+
+    char dir[1024];
+    if (!get_cache_dir(dir, sizeof(dir))) {
+        MD_LOG_ERROR("Disk cache: could not determine cache directory");
+        return NULL;
+    }
+
+    // One file per trajectory path and atom layout, a modified trajectory overwrites its previous cache
+    char cache_name[64];
+    snprintf(cache_name, sizeof(cache_name), "%016llx_%lld_%016llx.vfc", (unsigned long long)header.path_hash, (long long)num_atoms, (unsigned long long)subset_hash);
+    char cache_file[1100];
+    snprintf(cache_file, sizeof(cache_file), "%s/%s", dir, cache_name);
+
+    const int64_t map_size = header_size + num_slots * slot_size;
+    evict_cache_files(dir, cache_name, (uint64_t)map_size, (uint64_t)total_budget_in_bytes);
+
+    disk_cache_t* cache = (disk_cache_t*)md_alloc(md_heap_allocator, sizeof(disk_cache_t));
+    MEMSET(cache, 0, sizeof(disk_cache_t));
+
+    if (!mapped_file_open(&cache->file, cache_file, map_size, MAPPED_FILE_WRITE | MAPPED_FILE_CREATE | MAPPED_FILE_EXCLUSIVE)) {
+        // Most likely the same trajectory is open in another instance, which owns the file
+        MD_LOG_INFO("Disk cache: '%s' is unavailable (in use by another instance?), continuing without disk cache", cache_file);
+        md_free(md_heap_allocator, cache, sizeof(disk_cache_t));
+        return NULL;
+    }
+
+    cache->num_slots    = num_slots;
+    cache->slot_size    = slot_size;
+    cache->coord_offset = coord_offset;
+    cache->num_atoms    = num_atoms;
+    for (int i = 0; i < DISK_CACHE_LOCK_STRIPES; ++i) {
+        md_mutex_init(&cache->locks[i]);
+    }
+
+    DiskCacheHeader* file_header = (DiskCacheHeader*)cache->file.ptr;
+    if (memcmp(file_header, &header, sizeof(header)) == 0) {
+        MD_LOG_INFO("Disk cache: reusing '%s'", cache_file);
+        // The modification time orders the files for eviction
+        file_touch(cache_file);
+    } else {
+        if (file_header->magic != 0) {
+            // Stale file, invalidate all slots before the new header is written (a new file is already zeroed)
+            file_header->magic = 0;
+            for (int64_t i = 0; i < num_slots; ++i) {
+                DiskSlot* slot = (DiskSlot*)(cache->file.ptr + header_size + i * slot_size);
+                slot->frame = 0;
+            }
+        }
+        MEMCPY(file_header, &header, sizeof(header));
+        MD_LOG_DEBUG("Disk cache: initialized '%s' with %i slots", cache_file, (int)num_slots);
+    }
+
+    cache->base = cache->file.ptr + header_size;
+    return cache;
+}
+
+void disk_cache_close(disk_cache_t* cache) {
+    if (!cache) return;
+    mapped_file_close(&cache->file);
+    for (int i = 0; i < DISK_CACHE_LOCK_STRIPES; ++i) {
+        md_mutex_destroy(&cache->locks[i]);
+    }
+    md_free(md_heap_allocator, cache, sizeof(disk_cache_t));
+}
+
+static inline DiskSlot* get_slot(disk_cache_t* cache, int64_t frame_idx, md_mutex_t** lock) {
+    const int64_t slot_idx = frame_idx % cache->num_slots;
+    *lock = &cache->locks[slot_idx % DISK_CACHE_LOCK_STRIPES];
+    return (DiskSlot*)(cache->base + slot_idx * cache->slot_size);
+}
+
+bool disk_cache_contains(disk_cache_t* cache, int64_t frame_idx, uint64_t tag) {
+    if (!cache) return false;
+    md_mutex_t* lock;
+    DiskSlot* slot = get_slot(cache, frame_idx, &lock);
+    md_mutex_lock(lock);
+    const bool result = slot->frame == (uint64_t)frame_idx + 1 && slot->tag == tag;
+    md_mutex_unlock(lock);
+    return result;
+}
+
+bool disk_cache_read(disk_cache_t* cache, int64_t frame_idx, uint64_t tag, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    if (!cache) return false;
+    md_mutex_t* lock;
+    DiskSlot* slot = get_slot(cache, frame_idx, &lock);
+    const int64_t n = cache->num_atoms;
+    const float* coords = (const float*)((const uint8_t*)slot + cache->coord_offset);
+
+    md_mutex_lock(lock);
+    const bool result = slot->frame == (uint64_t)frame_idx + 1 && slot->tag == tag;
+    if (result) {
+        if (header) *header = slot->header;
+        if (x) MEMCPY(x, coords + 0 * n, n * sizeof(float));
+        if (y) MEMCPY(y, coords + 1 * n, n * sizeof(float));
+        if (z) MEMCPY(z, coords + 2 * n, n * sizeof(float));
+    }
+    md_mutex_unlock(lock);
+    return result;
+}
+
+void disk_cache_write(disk_cache_t* cache, int64_t frame_idx, uint64_t tag, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z) {
+    if (!cache) return;
+    ASSERT(header && x && y && z);
+    md_mutex_t* lock;
+    DiskSlot* slot = get_slot(cache, frame_idx, &lock);
+    const int64_t n = cache->num_atoms;
+    float* coords = (float*)((uint8_t*)slot + cache->coord_offset);
+
+    md_mutex_lock(lock);
+    if (slot->frame != (uint64_t)frame_idx + 1 || slot->tag != tag) {
+        // Invalidate the slot first, so an interrupted write is never interpreted as a valid frame
+        slot->frame = 0;
+        MEMCPY(coords + 0 * n, x, n * sizeof(float));
+        MEMCPY(coords + 1 * n, y, n * sizeof(float));
+        MEMCPY(coords + 2 * n, z, n * sizeof(float));
+        slot->header = *header;
+        slot->tag = tag;
+        slot->frame = (uint64_t)frame_idx + 1;
+    }
+    md_mutex_unlock(lock);
+}
+
+void disk_cache_clear(disk_cache_t* cache) {
+    if (!cache) return;
+    for (int64_t i = 0; i < cache->num_slots; ++i) {
+        md_mutex_t* lock = &cache->locks[i % DISK_CACHE_LOCK_STRIPES];
+        DiskSlot* slot = (DiskSlot*)(cache->base + i * cache->slot_size);
+        md_mutex_lock(lock);
+        // Slots which were never written are left untouched, so they do not take up space in the sparse file
+        if (slot->frame != 0) {
+            slot->frame = 0;
+        }
+        md_mutex_unlock(lock);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <core/md_str.h>
+
+#include <stdint.h>
+
+struct md_trajectory_frame_header_t;
+
+// Persistent frame cache on local disk, which holds already processed (decoded, deperiodized and recentered) frames.
+// The cache is a memory mapped file with one fixed size slot per frame (or fewer slots if limited by the budget, in which case frames are direct mapped to slots).
+// Re-reads are thereby served by the page cache of the OS without any decoding, and the content survives application restarts.
+//
+// The file is identified by the path of the trajectory, the number of atoms and the hash of the atom subset, and is invalidated if the size, modification time or layout of the trajectory changes.
+// Each slot is additionally tagged, which allows the owner to invalidate frames processed with different parameters (e.g. recenter target).
+//
+// The directory is given by the environment variable VIAMD_CACHE_DIR, otherwise it defaults to the user cache directory of the platform.
+// The total size of the cache files within the directory is bounded, the least recently used files are evicted when a new file is opened.
+
+typedef struct disk_cache_t disk_cache_t;
+
+// subset_hash identifies which atoms of the trajectory the frames contain (0 for all atoms)
+// budget_in_bytes bounds the file of this trajectory, total_budget_in_bytes bounds all cache files of the directory
+// Returns NULL if the cache could not be opened (e.g. it is in use by another instance) or if the budget does not fit a single frame
+disk_cache_t* disk_cache_open(str_t traj_path, uint64_t subset_hash, int64_t num_frames, int64_t num_atoms, int64_t budget_in_bytes, int64_t total_budget_in_bytes);
+void disk_cache_close(disk_cache_t* cache);
+
+// These are thread-safe
+bool disk_cache_contains(disk_cache_t* cache, int64_t frame_idx, uint64_t tag);
+bool disk_cache_read (disk_cache_t* cache, int64_t frame_idx, uint64_t tag, md_trajectory_frame_header_t* header, float* x, float* y, float* z);
+void disk_cache_write(disk_cache_t* cache, int64_t frame_idx, uint64_t tag, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z);
+// Invalidates all slots, e.g. when the frames are processed differently in a way which the tag does not capture
+void disk_cache_clear(disk_cache_t* cache);
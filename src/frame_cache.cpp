@@ -0,0 +1,494 @@
+#include <frame_cache.h>
+
+#include <core/md_common.h>
+#include <core/md_allocator.h>
+#include <core/md_os.h>
+#include <md_trajectory.h>
+#include <md_frame_cache.h>
+
+#include <thread>
+#include <atomic>
+
+// Lock acquisitions which take longer than this are counted as contended
+#define CONTENTION_THRESHOLD_SECONDS 1.0e-6
+
+// Frames are organized in intrusive lists over the frame indices, which hold both the resident frames and the ghost entries of the policies
+enum {
+    LIST_NONE = 0,
+    LIST_LRU,
+    // 2Q: A1in holds frames which have been requested once (FIFO), Am frames which have been requested again, either while in A1in
+    // or shortly after being evicted from it (LRU). A1out holds the ghost entries of the frames evicted from A1in.
+    LIST_A1IN,
+    LIST_AM,
+    LIST_A1OUT,
+    // ARC: T1 holds frames which have been requested once, T2 frames which have been requested at least twice, B1 and B2 their ghost entries.
+    // The target size of T1 adapts to whether ghost hits occur in B1 or B2.
+    LIST_T1,
+    LIST_T2,
+    LIST_B1,
+    LIST_B2,
+    LIST_COUNT,
+};
+
+struct FrameList {
+    int32_t head;   // Most recently inserted
+    int32_t tail;
+    int64_t size;
+};
+
+struct frame_cache_slot_t {
+    md_frame_data_t data;
+    md_mutex_t mutex;   // Held by the user of the slot
+    int32_t frame;      // Resident frame, -1 if the slot is free (protected by the mutex of the cache)
+    int32_t refs;       // Number of users of the slot (protected by the mutex of the cache)
+    bool    valid;      // If the data holds the frame (protected by the mutex of the slot)
+};
+
+struct frame_cache_t {
+    md_allocator_i* alloc;
+    md_mutex_t mutex;
+    frame_cache_policy_t policy;
+
+    int64_t num_slots;
+    int64_t num_frames;
+    int64_t num_atoms;
+    int64_t stride;     // Number of floats per coordinate component of a slot
+    frame_cache_slot_t* slots;
+    float* coords;
+
+    int32_t* free_slots;
+    int64_t  num_free;
+
+    // Directory over the frames of the trajectory
+    int32_t* slot_of;   // -1 if not resident
+    int32_t* prev;
+    int32_t* next;
+    uint8_t* list;
+    FrameList lists[LIST_COUNT];
+
+    double arc_p;       // Target size of T1
+
+    int64_t pin_beg;
+    int64_t pin_end;
+
+    frame_cache_stats_t stats[FRAME_CACHE_POLICY_COUNT];
+
+    std::atomic_uint64_t lock_waits;
+    std::atomic_uint64_t lock_wait_ticks;
+};
+
+static inline void lock_timed(frame_cache_t* cache, md_mutex_t* mutex) {
+    const md_timestamp_t t0 = md_time_current();
+    md_mutex_lock(mutex);
+    const md_timestamp_t dt = md_time_current() - t0;
+    if (md_time_as_seconds(dt) > CONTENTION_THRESHOLD_SECONDS) {
+        cache->lock_waits++;
+        cache->lock_wait_ticks += (uint64_t)dt;
+    }
+}
+
+static inline void list_push_front(frame_cache_t* cache, int l, int32_t f) {
+    FrameList* list = &cache->lists[l];
+    cache->prev[f] = -1;
+    cache->next[f] = list->head;
+    if (list->head != -1) {
+        cache->prev[list->head] = f;
+    } else {
+        list->tail = f;
+    }
+    list->head = f;
+    list->size++;
+    cache->list[f] = (uint8_t)l;
+}
+
+static inline void list_remove(frame_cache_t* cache, int32_t f) {
+    ASSERT(cache->list[f] != LIST_NONE);
+    FrameList* list = &cache->lists[cache->list[f]];
+    if (cache->prev[f] != -1) {
+        cache->next[cache->prev[f]] = cache->next[f];
+    } else {
+        list->head = cache->next[f];
+    }
+    if (cache->next[f] != -1) {
+        cache->prev[cache->next[f]] = cache->prev[f];
+    } else {
+        list->tail = cache->prev[f];
+    }
+    list->size--;
+    cache->list[f] = LIST_NONE;
+}
+
+static inline void list_move_front(frame_cache_t* cache, int l, int32_t f) {
+    list_remove(cache, f);
+    list_push_front(cache, l, f);
+}
+
+static inline void list_drop_tail(frame_cache_t* cache, int l) {
+    if (cache->lists[l].size > 0) {
+        list_remove(cache, cache->lists[l].tail);
+    }
+}
+
+static void reset_directory(frame_cache_t* cache) {
+    for (int64_t i = 0; i < cache->num_frames; ++i) {
+        cache->list[i] = LIST_NONE;
+    }
+    for (int i = 0; i < LIST_COUNT; ++i) {
+        cache->lists[i] = {-1, -1, 0};
+    }
+    cache->arc_p = 0;
+}
+
+static inline bool evictable(const frame_cache_t* cache, int32_t f) {
+    const frame_cache_slot_t* slot = &cache->slots[cache->slot_of[f]];
+    return slot->refs == 0 && !(cache->pin_beg <= f && f < cache->pin_end);
+}
+
+// Least recently inserted frame of the list which can be evicted, -1 if there is none
+static inline int32_t find_victim(const frame_cache_t* cache, int l) {
+    for (int32_t f = cache->lists[l].tail; f != -1; f = cache->prev[f]) {
+        if (evictable(cache, f)) return f;
+    }
+    return -1;
+}
+
+// Evicts a frame from the first list, or from the second list if the first has no evictable frames.
+// The evicted frame is kept as a ghost entry in the corresponding ghost list (if any). Returns the freed slot, -1 if no frame could be evicted.
+static int32_t evict_from(frame_cache_t* cache, int l0, int ghost0, int l1, int ghost1) {
+    int ghost = ghost0;
+    int32_t f = find_victim(cache, l0);
+    if (f == -1) {
+        ghost = ghost1;
+        f = find_victim(cache, l1);
+    }
+    if (f == -1) return -1;
+
+    const int32_t s = cache->slot_of[f];
+    list_remove(cache, f);
+    if (ghost != LIST_NONE) {
+        list_push_front(cache, ghost, f);
+    }
+    cache->slot_of[f] = -1;
+    cache->slots[s].frame = -1;
+    cache->stats[cache->policy].evictions++;
+    return s;
+}
+
+static inline int32_t pop_free_slot(frame_cache_t* cache) {
+    return cache->num_free > 0 ? cache->free_slots[--cache->num_free] : -1;
+}
+
+static void policy_hit(frame_cache_t* cache, int32_t f) {
+    switch (cache->policy) {
+    case FRAME_CACHE_POLICY_LRU:
+        list_move_front(cache, LIST_LRU, f);
+        break;
+    case FRAME_CACHE_POLICY_2Q:
+        // A scan requests each frame once, so any repeated request promotes the frame to the working set
+        list_move_front(cache, LIST_AM, f);
+        break;
+    case FRAME_CACHE_POLICY_ARC:
+        list_move_front(cache, LIST_T2, f);
+        break;
+    default:
+        ASSERT(false);
+    }
+}
+
+// Finds a slot for a frame which is not resident and inserts the frame into the directory. Returns -1 if all slots are in use.
+static int32_t policy_miss(frame_cache_t* cache, int32_t f) {
+    const int64_t c = cache->num_slots;
+    const int where = cache->list[f];
+    FrameList* lists = cache->lists;
+
+    switch (cache->policy) {
+    case FRAME_CACHE_POLICY_LRU: {
+        int32_t s = pop_free_slot(cache);
+        if (s == -1) s = evict_from(cache, LIST_LRU, LIST_NONE, LIST_LRU, LIST_NONE);
+        if (s == -1) return -1;
+        list_push_front(cache, LIST_LRU, f);
+        return s;
+    }
+    case FRAME_CACHE_POLICY_2Q: {
+        const int64_t k_in  = MAX(1, c / 4);
+        const int64_t k_out = MAX(1, c / 2);
+        int32_t s = pop_free_slot(cache);
+        if (s == -1) {
+            if (lists[LIST_A1IN].size > k_in) {
+                s = evict_from(cache, LIST_A1IN, LIST_A1OUT, LIST_AM, LIST_NONE);
+            } else {
+                s = evict_from(cache, LIST_AM, LIST_NONE, LIST_A1IN, LIST_A1OUT);
+            }
+        }
+        if (s == -1) return -1;
+        if (where == LIST_A1OUT) {
+            // Requested again shortly after it was evicted, which makes it part of the working set
+            list_remove(cache, f);
+            list_push_front(cache, LIST_AM, f);
+        } else {
+            list_push_front(cache, LIST_A1IN, f);
+        }
+        while (lists[LIST_A1OUT].size > k_out) {
+            list_drop_tail(cache, LIST_A1OUT);
+        }
+        return s;
+    }
+    case FRAME_CACHE_POLICY_ARC: {
+        // The target is adapted before the replacement, but only committed if a slot is found
+        double p = cache->arc_p;
+        if (where == LIST_B1) {
+            p = MIN((double)c, p + MAX((double)lists[LIST_B2].size / (double)lists[LIST_B1].size, 1.0));
+        } else if (where == LIST_B2) {
+            p = MAX(0.0, p - MAX((double)lists[LIST_B1].size / (double)lists[LIST_B2].size, 1.0));
+        }
+
+        int32_t s = pop_free_slot(cache);
+        if (s == -1) {
+            const int64_t t1 = lists[LIST_T1].size;
+            if (t1 > 0 && ((double)t1 > p || (where == LIST_B2 && t1 == (int64_t)p))) {
+                s = evict_from(cache, LIST_T1, LIST_B1, LIST_T2, LIST_B2);
+            } else {
+                s = evict_from(cache, LIST_T2, LIST_B2, LIST_T1, LIST_B1);
+            }
+        }
+        if (s == -1) return -1;
+
+        cache->arc_p = p;
+        if (where == LIST_B1 || where == LIST_B2) {
+            list_remove(cache, f);
+            list_push_front(cache, LIST_T2, f);
+        } else {
+            list_push_front(cache, LIST_T1, f);
+        }
+
+        // Bound the ghost entries to |T1| + |B1| <= c and |T1| + |T2| + |B1| + |B2| <= 2c
+        while (lists[LIST_T1].size + lists[LIST_B1].size > c && lists[LIST_B1].size > 0) {
+            list_drop_tail(cache, LIST_B1);
+        }
+        while (lists[LIST_T1].size + lists[LIST_T2].size + lists[LIST_B1].size + lists[LIST_B2].size > 2 * c) {
+            list_drop_tail(cache, lists[LIST_B2].size > 0 ? LIST_B2 : LIST_B1);
+        }
+        return s;
+    }
+    default:
+        ASSERT(false);
+        return -1;
+    }
+}
+
+frame_cache_t* frame_cache_create(int64_t num_slots, int64_t num_frames, int64_t num_atoms, frame_cache_policy_t policy, md_allocator_i* alloc) {
+    ASSERT(alloc);
+    ASSERT(0 <= policy && policy < FRAME_CACHE_POLICY_COUNT);
+    if (num_slots <= 0 || num_frames <= 0 || num_atoms <= 0) return NULL;
+    num_slots = MIN(num_slots, num_frames);
+
+    frame_cache_t* cache = (frame_cache_t*)md_alloc(alloc, sizeof(frame_cache_t));
+    MEMSET(cache, 0, sizeof(frame_cache_t));
+    cache->alloc      = alloc;
+    cache->policy     = policy;
+    cache->num_slots  = num_slots;
+    cache->num_frames = num_frames;
+    cache->num_atoms  = num_atoms;
+    cache->stride     = ALIGN_TO(num_atoms, 16);
+    md_mutex_init(&cache->mutex);
+
+    cache->slots      = (frame_cache_slot_t*)md_alloc(alloc, sizeof(frame_cache_slot_t) * num_slots);
+    cache->coords     = (float*)md_alloc(alloc, sizeof(float) * 3 * cache->stride * num_slots);
+    cache->free_slots = (int32_t*)md_alloc(alloc, sizeof(int32_t) * num_slots);
+    for (int64_t i = 0; i < num_slots; ++i) {
+        frame_cache_slot_t* slot = &cache->slots[i];
+        MEMSET(slot, 0, sizeof(frame_cache_slot_t));
+        md_mutex_init(&slot->mutex);
+        slot->frame  = -1;
+        slot->data.x = cache->coords + (i * 3 + 0) * cache->stride;
+        slot->data.y = cache->coords + (i * 3 + 1) * cache->stride;
+        slot->data.z = cache->coords + (i * 3 + 2) * cache->stride;
+        // Slots are handed out from the back
+        cache->free_slots[i] = (int32_t)(num_slots - 1 - i);
+    }
+    cache->num_free = num_slots;
+
+    cache->slot_of = (int32_t*)md_alloc(alloc, sizeof(int32_t) * num_frames);
+    cache->prev    = (int32_t*)md_alloc(alloc, sizeof(int32_t) * num_frames);
+    cache->next    = (int32_t*)md_alloc(alloc, sizeof(int32_t) * num_frames);
+    cache->list    = (uint8_t*)md_alloc(alloc, sizeof(uint8_t) * num_frames);
+    for (int64_t i = 0; i < num_frames; ++i) {
+        cache->slot_of[i] = -1;
+    }
+    reset_directory(cache);
+
+    return cache;
+}
+
+void frame_cache_destroy(frame_cache_t* cache) {
+    if (!cache) return;
+    md_allocator_i* alloc = cache->alloc;
+    const int64_t num_slots  = cache->num_slots;
+    const int64_t num_frames = cache->num_frames;
+
+    for (int64_t i = 0; i < num_slots; ++i) {
+        ASSERT(cache->slots[i].refs == 0);
+        md_mutex_destroy(&cache->slots[i].mutex);
+    }
+    md_mutex_destroy(&cache->mutex);
+
+    md_free(alloc, cache->slots,      sizeof(frame_cache_slot_t) * num_slots);
+    md_free(alloc, cache->coords,     sizeof(float) * 3 * cache->stride * num_slots);
+    md_free(alloc, cache->free_slots, sizeof(int32_t) * num_slots);
+    md_free(alloc, cache->slot_of,    sizeof(int32_t) * num_frames);
+    md_free(alloc, cache->prev,       sizeof(int32_t) * num_frames);
+    md_free(alloc, cache->next,       sizeof(int32_t) * num_frames);
+    md_free(alloc, cache->list,       sizeof(uint8_t) * num_frames);
+    md_free(alloc, cache, sizeof(frame_cache_t));
+}
+
+bool frame_cache_find_or_reserve(frame_cache_t* cache, int64_t frame_idx, md_frame_data_t** frame_data, frame_cache_slot_t** out_slot) {
+    ASSERT(cache);
+    ASSERT(frame_data);
+    ASSERT(out_slot);
+    ASSERT(0 <= frame_idx && frame_idx < cache->num_frames);
+    const int32_t f = (int32_t)frame_idx;
+
+    lock_timed(cache, &cache->mutex);
+    for (;;) {
+        int32_t s = cache->slot_of[f];
+        if (s != -1) {
+            frame_cache_slot_t* slot = &cache->slots[s];
+            slot->refs++;
+            policy_hit(cache, f);
+            cache->stats[cache->policy].hits++;
+            md_mutex_unlock(&cache->mutex);
+
+            // Blocks while the frame is being filled by another thread
+            lock_timed(cache, &slot->mutex);
+            *frame_data = &slot->data;
+            *out_slot = slot;
+            // If the frame failed to load, the slot is left to this caller to fill
+            return slot->valid;
+        }
+
+        s = policy_miss(cache, f);
+        if (s != -1) {
+            frame_cache_slot_t* slot = &cache->slots[s];
+            ASSERT(slot->refs == 0);
+            slot->frame = f;
+            slot->refs  = 1;
+            cache->slot_of[f] = s;
+            cache->stats[cache->policy].misses++;
+            // The slot is not referenced, so its mutex is free
+            md_mutex_lock(&slot->mutex);
+            slot->valid = false;
+            md_mutex_unlock(&cache->mutex);
+
+            *frame_data = &slot->data;
+            *out_slot = slot;
+            return false;
+        }
+
+        // All slots are in use, wait for a release
+        md_mutex_unlock(&cache->mutex);
+        const md_timestamp_t t0 = md_time_current();
+        std::this_thread::yield();
+        md_mutex_lock(&cache->mutex);
+        cache->lock_waits++;
+        cache->lock_wait_ticks += (uint64_t)(md_time_current() - t0);
+    }
+}
+
+void frame_cache_release(frame_cache_t* cache, frame_cache_slot_t* slot, bool valid) {
+    ASSERT(cache);
+    ASSERT(slot);
+    slot->valid = valid;
+    md_mutex_unlock(&slot->mutex);
+
+    md_mutex_lock(&cache->mutex);
+    ASSERT(slot->refs > 0);
+    slot->refs--;
+    if (!valid && slot->refs == 0 && slot->frame != -1) {
+        // Do not keep a slot which does not hold its frame
+        list_remove(cache, slot->frame);
+        cache->slot_of[slot->frame] = -1;
+        slot->frame = -1;
+        cache->free_slots[cache->num_free++] = (int32_t)(slot - cache->slots);
+    }
+    md_mutex_unlock(&cache->mutex);
+}
+
+void frame_cache_clear(frame_cache_t* cache) {
+    if (!cache) return;
+    md_mutex_lock(&cache->mutex);
+    cache->num_free = 0;
+    for (int64_t i = 0; i < cache->num_slots; ++i) {
+        frame_cache_slot_t* slot = &cache->slots[i];
+        ASSERT(slot->refs == 0);
+        if (slot->frame != -1) {
+            cache->slot_of[slot->frame] = -1;
+            slot->frame = -1;
+        }
+        cache->free_slots[cache->num_free++] = (int32_t)(cache->num_slots - 1 - i);
+    }
+    reset_directory(cache);
+    md_mutex_unlock(&cache->mutex);
+}
+
+int64_t frame_cache_num_slots(const frame_cache_t* cache) {
+    return cache ? cache->num_slots : 0;
+}
+
+void frame_cache_set_policy(frame_cache_t* cache, frame_cache_policy_t policy) {
+    ASSERT(0 <= policy && policy < FRAME_CACHE_POLICY_COUNT);
+    if (!cache) return;
+    md_mutex_lock(&cache->mutex);
+    if (policy != cache->policy) {
+        cache->policy = policy;
+        reset_directory(cache);
+        // Resident frames start over as frames which have been requested once
+        const int list = policy == FRAME_CACHE_POLICY_LRU ? LIST_LRU : policy == FRAME_CACHE_POLICY_2Q ? LIST_A1IN : LIST_T1;
+        for (int64_t i = 0; i < cache->num_slots; ++i) {
+            if (cache->slots[i].frame != -1) {
+                list_push_front(cache, list, cache->slots[i].frame);
+            }
+        }
+    }
+    md_mutex_unlock(&cache->mutex);
+}
+
+frame_cache_policy_t frame_cache_get_policy(const frame_cache_t* cache) {
+    ASSERT(cache);
+    return cache->policy;
+}
+
+void frame_cache_pin(frame_cache_t* cache, int64_t beg, int64_t end) {
+    if (!cache) return;
+    // Always leave room for frames outside of the window
+    end = MIN(end, beg + cache->num_slots / 2);
+    md_mutex_lock(&cache->mutex);
+    cache->pin_beg = beg;
+    cache->pin_end = MAX(beg, end);
+    md_mutex_unlock(&cache->mutex);
+}
+
+void frame_cache_get_stats(frame_cache_t* cache, frame_cache_stats_t stats[FRAME_CACHE_POLICY_COUNT]) {
+    ASSERT(stats);
+    if (!cache) {
+        MEMSET(stats, 0, sizeof(frame_cache_stats_t) * FRAME_CACHE_POLICY_COUNT);
+        return;
+    }
+    md_mutex_lock(&cache->mutex);
+    MEMCPY(stats, cache->stats, sizeof(cache->stats));
+    md_mutex_unlock(&cache->mutex);
+}
+
+void frame_cache_get_contention(frame_cache_t* cache, uint64_t* waits, double* wait_seconds) {
+    if (waits)        *waits        = cache ? cache->lock_waits.load() : 0;
+    if (wait_seconds) *wait_seconds = cache ? md_time_as_seconds((md_timestamp_t)cache->lock_wait_ticks.load()) : 0.0;
+}
+
+const char* frame_cache_policy_name(frame_cache_policy_t policy) {
+    switch (policy) {
+    case FRAME_CACHE_POLICY_LRU: return "LRU";
+    case FRAME_CACHE_POLICY_2Q:  return "2Q";
+    case FRAME_CACHE_POLICY_ARC: return "ARC";
+    default: return "Unknown";
+    }
+}
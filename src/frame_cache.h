@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+struct md_allocator_i;
+struct md_frame_data_t;
+
+// Cache of decoded trajectory frames with a selectable replacement policy.
+//
+// LRU evicts the least recently used frame, which is what linear passes over the full trajectory (analysis, streams) flush completely.
+// 2Q and ARC are scan resistant: frames which have only been touched once are kept in a separate queue and are evicted first,
+// while frames which are requested repeatedly (scrubbing, playback loops) are promoted and survive the scans.
+// Both keep ghost entries (the indices of recently evicted frames) to detect frames which are re-requested shortly after being evicted.
+//
+// In addition a window of frames (e.g. around the playhead) can be pinned, which excludes these from eviction under every policy.
+
+typedef enum frame_cache_policy_t {
+    FRAME_CACHE_POLICY_LRU,
+    FRAME_CACHE_POLICY_2Q,
+    FRAME_CACHE_POLICY_ARC,
+    FRAME_CACHE_POLICY_COUNT,
+} frame_cache_policy_t;
+
+// Counters are accumulated for the policy which was active at the time of the request
+typedef struct frame_cache_stats_t {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} frame_cache_stats_t;
+
+typedef struct frame_cache_t frame_cache_t;
+typedef struct frame_cache_slot_t frame_cache_slot_t;
+
+// num_frames is the number of frames of the trajectory, which the directory of the cache is sized for.
+// Returns NULL if any of the sizes is zero, the functions below (except find_or_reserve and release) accept NULL as an empty cache.
+frame_cache_t* frame_cache_create(int64_t num_slots, int64_t num_frames, int64_t num_atoms, frame_cache_policy_t policy, md_allocator_i* alloc);
+void frame_cache_destroy(frame_cache_t* cache);
+
+// Returns true if the frame is resident, otherwise a slot is reserved for the frame which the caller is expected to fill.
+// In both cases the slot is locked and has to be released with frame_cache_release, valid denotes if the slot holds the frame (i.e. it was successfully filled).
+// If all slots are in use (locked or pinned), this blocks until a slot is released.
+bool frame_cache_find_or_reserve(frame_cache_t* cache, int64_t frame_idx, md_frame_data_t** frame_data, frame_cache_slot_t** slot);
+void frame_cache_release(frame_cache_t* cache, frame_cache_slot_t* slot, bool valid);
+
+// Evicts all frames, no slots may be in use
+void frame_cache_clear(frame_cache_t* cache);
+
+int64_t frame_cache_num_slots(const frame_cache_t* cache);
+
+// Changing the policy keeps the resident frames, but discards the history (ghost entries) of the previous policy
+void frame_cache_set_policy(frame_cache_t* cache, frame_cache_policy_t policy);
+frame_cache_policy_t frame_cache_get_policy(const frame_cache_t* cache);
+
+// Frames within [beg, end) are not evicted, the window is limited to half of the slots. Pass beg == end to unpin.
+void frame_cache_pin(frame_cache_t* cache, int64_t beg, int64_t end);
+
+void frame_cache_get_stats(frame_cache_t* cache, frame_cache_stats_t stats[FRAME_CACHE_POLICY_COUNT]);
+
+// Contention within frame_cache_find_or_reserve: the number of requests which were blocked (on the cache, on a frame being filled by another thread
+// or on all slots being in use) and the total time spent blocked
+void frame_cache_get_contention(frame_cache_t* cache, uint64_t* waits, double* wait_seconds);
+
+const char* frame_cache_policy_name(frame_cache_policy_t policy);
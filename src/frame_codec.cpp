@@ -0,0 +1,207 @@
+#include <frame_codec.h>
+
+#include <core/md_common.h>
+#include <core/md_log.h>
+
+#include <string.h>
+#include <math.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define FRAME_CODEC_MAGIC 0x31434656 // 'VFC1'
+#define FRAME_CODEC_BLOCK 8
+// The decoder reads whole words, so the end of the stream is padded to allow reads past the last block
+#define FRAME_CODEC_PADDING 8
+// Quantized values are limited to this magnitude, which guarantees that the deltas fit within 32 bits
+#define FRAME_CODEC_MAX_QUANT (1 << 30)
+
+struct FrameCodecHeader {
+    uint32_t magic;
+    uint32_t num_atoms;
+    float    precision;
+    uint32_t reserved;
+};
+
+static inline uint32_t zigzag_encode(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline uint32_t bit_width(uint32_t v) {
+    uint32_t w = 0;
+    while (w < 32 && (v >> w)) ++w;
+    return w;
+}
+
+// Each block is stored as one byte holding the bit width (w), followed by 8 values of w bits, which occupy exactly w bytes
+static int64_t encode_stream(uint8_t* dst, const uint8_t* dst_end, const float* src, int64_t count, float inv_precision) {
+    uint8_t* out = dst;
+    int32_t prev = 0;
+    for (int64_t i = 0; i < count; i += FRAME_CODEC_BLOCK) {
+        uint32_t values[FRAME_CODEC_BLOCK] = {0};
+        uint32_t bits = 0;
+        const int64_t n = MIN(FRAME_CODEC_BLOCK, count - i);
+        for (int64_t j = 0; j < n; ++j) {
+            const float q = roundf(src[i + j] * inv_precision);
+            if (!(fabsf(q) < (float)FRAME_CODEC_MAX_QUANT)) return 0; // Also catches NaN
+            const int32_t v = (int32_t)q;
+            values[j] = zigzag_encode(v - prev);
+            bits |= values[j];
+            prev = v;
+        }
+
+        const uint32_t w = bit_width(bits);
+        if (out + 1 + w > dst_end) return 0;
+        *out++ = (uint8_t)w;
+
+        uint64_t acc = 0;
+        uint32_t acc_bits = 0;
+        for (int j = 0; j < FRAME_CODEC_BLOCK; ++j) {
+            acc |= (uint64_t)values[j] << acc_bits;
+            acc_bits += w;
+            while (acc_bits >= 8) {
+                *out++ = (uint8_t)acc;
+                acc >>= 8;
+                acc_bits -= 8;
+            }
+        }
+        ASSERT(acc_bits == 0);
+    }
+    return out - dst;
+}
+
+static inline uint32_t read_bits(const uint8_t* ptr, uint32_t bit_offset, uint32_t w) {
+    uint64_t word;
+    memcpy(&word, ptr + (bit_offset >> 3), sizeof(word));
+    const uint64_t mask = (w == 32) ? 0xFFFFFFFFull : ((1ull << w) - 1);
+    return (uint32_t)((word >> (bit_offset & 7)) & mask);
+}
+
+static inline void decode_block_scalar(float* dst, int64_t n, const uint8_t* block, uint32_t w, int32_t* prev, float precision) {
+    for (int64_t j = 0; j < n; ++j) {
+        *prev += zigzag_decode(read_bits(block, (uint32_t)j * w, w));
+        dst[j] = (float)*prev * precision;
+    }
+}
+
+static const uint8_t* decode_stream(float* dst, int64_t count, const uint8_t* src, const uint8_t* src_end, float precision) {
+    int64_t i = 0;
+    int32_t prev = 0;
+
+#if defined(__AVX2__)
+    const __m256i lane  = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i one   = _mm256_set1_epi32(1);
+    const __m256i zero  = _mm256_setzero_si256();
+    const __m256i seven = _mm256_set1_epi32(7);
+    const __m256  scale = _mm256_set1_ps(precision);
+
+    for (; i + FRAME_CODEC_BLOCK <= count; i += FRAME_CODEC_BLOCK) {
+        if (src + 1 > src_end) return 0;
+        const uint32_t w = *src;
+        if (w > 32 || src + 1 + w > src_end) return 0;
+        const uint8_t* block = src + 1;
+        src += 1 + w;
+
+        // Every value has to be extractable from a single 32-bit gather (shift + w <= 32), wider blocks are rare
+        if (w > 25) {
+            decode_block_scalar(dst + i, FRAME_CODEC_BLOCK, block, w, &prev, precision);
+            continue;
+        }
+
+        const __m256i bit_offs = _mm256_mullo_epi32(lane, _mm256_set1_epi32((int)w));
+        const __m256i byte_offs = _mm256_srli_epi32(bit_offs, 3);
+        const __m256i shifts = _mm256_and_si256(bit_offs, seven);
+        const __m256i mask = _mm256_set1_epi32((int)((1u << w) - 1));
+
+        __m256i v = _mm256_i32gather_epi32((const int*)block, byte_offs, 1);
+        v = _mm256_and_si256(_mm256_srlv_epi32(v, shifts), mask);
+
+        // Zigzag decode
+        v = _mm256_xor_si256(_mm256_srli_epi32(v, 1), _mm256_sub_epi32(zero, _mm256_and_si256(v, one)));
+
+        // Inclusive prefix sum over the 8 lanes, then carry in the last value of the previous block
+        v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+        v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+        const __m256i lo_last = _mm256_permutevar8x32_epi32(v, _mm256_set1_epi32(3));
+        v = _mm256_add_epi32(v, _mm256_blend_epi32(zero, lo_last, 0xF0));
+        v = _mm256_add_epi32(v, _mm256_set1_epi32(prev));
+        prev = _mm256_extract_epi32(v, 7);
+
+        _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+#endif
+
+    for (; i < count; i += FRAME_CODEC_BLOCK) {
+        if (src + 1 > src_end) return 0;
+        const uint32_t w = *src;
+        if (w > 32 || src + 1 + w > src_end) return 0;
+        decode_block_scalar(dst + i, MIN(FRAME_CODEC_BLOCK, count - i), src + 1, w, &prev, precision);
+        src += 1 + w;
+    }
+
+    return src;
+}
+
+int64_t frame_codec_encode_bound(int64_t num_atoms) {
+    const int64_t num_blocks = (num_atoms + FRAME_CODEC_BLOCK - 1) / FRAME_CODEC_BLOCK;
+    return (int64_t)sizeof(FrameCodecHeader) + 3 * num_blocks * (1 + 4 * FRAME_CODEC_BLOCK) + FRAME_CODEC_PADDING;
+}
+
+int64_t frame_codec_encode(void* dst, int64_t dst_cap, const float* x, const float* y, const float* z, int64_t num_atoms, float precision) {
+    ASSERT(dst);
+    ASSERT(x && y && z);
+
+    if (precision <= 0.0f || num_atoms <= 0 || num_atoms > UINT32_MAX) return 0;
+    if (dst_cap < (int64_t)sizeof(FrameCodecHeader) + FRAME_CODEC_PADDING) return 0;
+
+    uint8_t* beg = (uint8_t*)dst;
+    uint8_t* end = beg + dst_cap - FRAME_CODEC_PADDING;
+
+    FrameCodecHeader header = {FRAME_CODEC_MAGIC, (uint32_t)num_atoms, precision, 0};
+    memcpy(beg, &header, sizeof(header));
+    uint8_t* out = beg + sizeof(header);
+
+    const float inv_precision = 1.0f / precision;
+    const float* src[3] = {x, y, z};
+    for (int k = 0; k < 3; ++k) {
+        const int64_t bytes = encode_stream(out, end, src[k], num_atoms, inv_precision);
+        if (!bytes) return 0;
+        out += bytes;
+    }
+
+    memset(out, 0, FRAME_CODEC_PADDING);
+    out += FRAME_CODEC_PADDING;
+
+    return out - beg;
+}
+
+bool frame_codec_decode(float* x, float* y, float* z, int64_t num_atoms, const void* src, int64_t src_size) {
+    ASSERT(x && y && z);
+    ASSERT(src);
+
+    if (src_size < (int64_t)sizeof(FrameCodecHeader) + FRAME_CODEC_PADDING) return false;
+
+    FrameCodecHeader header;
+    memcpy(&header, src, sizeof(header));
+    if (header.magic != FRAME_CODEC_MAGIC || header.num_atoms != (uint64_t)num_atoms) {
+        MD_LOG_ERROR("Frame codec: invalid or incompatible frame data");
+        return false;
+    }
+
+    const uint8_t* ptr = (const uint8_t*)src + sizeof(header);
+    const uint8_t* end = (const uint8_t*)src + src_size - FRAME_CODEC_PADDING;
+    float* dst[3] = {x, y, z};
+    for (int k = 0; k < 3; ++k) {
+        ptr = decode_stream(dst[k], num_atoms, ptr, end, header.precision);
+        if (!ptr) {
+            MD_LOG_ERROR("Frame codec: truncated frame data");
+            return false;
+        }
+    }
+    return true;
+}
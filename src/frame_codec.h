@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+// Lossy compression of frame coordinates, used for the compressed level of the frame cache.
+// Coordinates are quantized to fixed point with a given precision (similar to XTC), delta coded along the atom index
+// and packed in blocks of 8 atoms using the minimal bit width of each block.
+// The reconstruction error of each coordinate component is bounded by precision / 2.
+
+// Upper bound of the encoded size in bytes (including the padding required by the decoder)
+int64_t frame_codec_encode_bound(int64_t num_atoms);
+
+// Returns the number of bytes written to dst, 0 if the coordinates cannot be represented with the given precision or if dst is too small
+int64_t frame_codec_encode(void* dst, int64_t dst_cap, const float* x, const float* y, const float* z, int64_t num_atoms, float precision);
+
+// Decodes num_atoms coordinates into x, y, z. Returns false if the data is not a valid encoding of num_atoms coordinates
+bool frame_codec_decode(float* x, float* y, float* z, int64_t num_atoms, const void* src, int64_t src_size);
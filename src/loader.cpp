@@ -13,12 +13,152 @@
 #include <md_xyz.h>
 #include <md_mmcif.h>
 #include <md_trajectory.h>
-#include <md_frame_cache.h>
+#include <md_molecule.h>
 #include <md_util.h>
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <float.h>
+#include <atomic>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include "task_system.h"
+#include "frame_codec.h"
+#include "frame_cache.h"
+#include "disk_cache.h"
+#include "mapped_file.h"
+#include "traj_index.h"
+#include "multi_traj.h"
+
+// Seconds of playback which the prefetcher tries to keep decoded ahead of the playhead
+#define PREFETCH_LOOKAHEAD_SECONDS 2.0
+// Minimum number of frames kept around the playhead, also used as window when idle or scrubbing
+#define PREFETCH_MIN_FRAMES 8
+// Velocity (frames per second) under which the playhead is considered idle
+#define PREFETCH_IDLE_VELOCITY 0.5
+// Playhead changes larger than this (in frames) which are not explained by the previous step are considered scrub jumps
+#define PREFETCH_JUMP_FRAMES 4.0
+#define PREFETCH_VELOCITY_SMOOTHING 0.25
+
+// Number of pooled raw frame buffers per trajectory, if all are in use we fall back to temporary allocations
+#define RAW_BUFFER_POOL_SIZE 32
+
+// The budget of the frame cache can be set within these bounds
+#define CACHE_BUDGET_MIN MEGABYTES(4)
+#define CACHE_BUDGET_MAX (md_os_physical_ram() / 4 * 3)
+
+// The governor lowers the effective budget of the frame cache when the available memory drops below the low watermark (fraction of the physical memory)
+// and raises it back towards the requested budget once the available memory is above the high watermark
+#define GOVERNOR_INTERVAL_SECONDS 2.0
+#define GOVERNOR_LOW_WATERMARK    0.10
+#define GOVERNOR_HIGH_WATERMARK   0.20
+// Changes of the effective budget smaller than this fraction are ignored, as every change flushes the decoded frames
+#define GOVERNOR_MIN_CHANGE       0.10
+#define GOVERNOR_MIN_BUDGET       MEGABYTES(64)
+
+// On demand loads of frames with at least this many atoms split the post-decode work (recenter, PBC, copy-out) over the thread-pool
+#define PARALLEL_MIN_ATOMS   1000000
+// Approximate number of atoms per parallel chunk
+#define PARALLEL_GRAIN_ATOMS 65536
+
+struct PrefetchState {
+    // These are only accessed from the main thread
+    double  frame;
+    double  delta;
+    double  velocity;
+    int64_t window_beg;
+    int64_t window_end;
+    task_system::ID task;
+
+    // Parameters for the running job, written before the job is launched
+    int64_t job_beg;
+    int64_t job_end;
+    bool    job_reverse;
+
+    // Frame index of the playhead, used to classify on demand loads
+    std::atomic_int64_t playhead;
+
+    std::atomic_uint64_t hits;
+    std::atomic_uint64_t stalls;
+    std::atomic_uint64_t misses;
+    std::atomic_uint64_t prefetched;
+    std::atomic_uint64_t jumps;
+};
+
+// Counters of the frame pipeline, times are accumulated in ticks of md_time_current
+struct Telemetry {
+    std::atomic_uint64_t compressed_hits;
+    std::atomic_uint64_t disk_hits;
+    std::atomic_uint64_t fetched;
+    std::atomic_uint64_t bytes_read;
+    std::atomic_uint64_t fetch_ticks;
+    std::atomic_uint64_t decode_ticks;
+    std::atomic_uint64_t recenter_ticks;
+    std::atomic_uint64_t deperiodize_ticks;
+    std::atomic_uint64_t unpack_ticks;
+    std::atomic_uint64_t disk_read_ticks;
+
+    // Contention of previous instances of the frame cache (which is recreated when resized)
+    std::atomic_uint64_t retired_lock_waits;
+    double retired_lock_wait_time;
+};
+
+struct RawBuffer {
+    void*   ptr;
+    int64_t cap;
+    int64_t size;
+    int32_t slot;   // Slot within the pool, -1 if it is a temporary allocation
+};
+
+// Shared state for the fetch -> decode -> insert stages
+struct FramePipeline {
+    md_mutex_t io_mutex;    // Serializes fetches from streams, so the file is read sequentially
+    md_mutex_t pool_mutex;
+    int32_t    num_free;
+    int32_t    free_slots[RAW_BUFFER_POOL_SIZE];
+    RawBuffer  buffers[RAW_BUFFER_POOL_SIZE];
+
+    // Launched streams, these need to be stopped before the trajectory can be closed (only accessed from the main thread)
+    md_array(task_system::ID) streams;
+
+    // Gate which allows the frame cache to be rebuilt while workers are using it
+    std::atomic_int32_t cache_users;
+    std::atomic_bool    cache_rebuild;
+};
+
+// Second level of the frame cache which holds frames encoded with the frame codec.
+// Encoded frames are refcounted, so they can be decoded outside of the lock while eviction takes place.
+struct CompressedFrame {
+    md_trajectory_frame_header_t header;
+    int64_t  size;      // Size of the encoded data which directly follows this struct
+    uint32_t refs;
+    bool     evicted;   // Freed by the last reference
+};
+
+struct CompressedCache {
+    md_mutex_t mutex;
+    float   precision;
+    int64_t budget;     // Max number of bytes of encoded frames
+    int64_t bytes;
+    int64_t count;      // Number of resident frames
+    int64_t clock;      // Eviction hand
+    int64_t num_frames;
+    CompressedFrame** frames;
+};
+
+// Contiguous range of atoms which is processed as a unit by the fused PBC pass (apply_pbc_spans).
+// The atoms of a structure are made whole and placed with their center of mass inside the cell, other atoms are wrapped into the cell individually.
+struct PbcSpan {
+    int32_t beg;
+    int32_t end;
+    int32_t structure;  // Non-zero if the span is a structure (int rather than bool, so there is no padding when the spans are hashed)
+};
 
 struct LoadedMolecule {
     uint64_t key;
@@ -30,68 +170,427 @@ struct LoadedTrajectory {
     const md_molecule_t* mol;
     md_trajectory_loader_i* loader;
     md_trajectory_i* traj;
-    md_frame_cache_t cache;
+    frame_cache_t* cache;
     md_allocator_i* alloc;
     md_bitfield_t recenter_target;
+    md_array(int32_t) recenter_indices; // Extracted from recenter_target when it is set
+    md_array(PbcSpan) pbc_spans;        // Covers all atoms in order, NULL if the structures are not contiguous (which uses the generic deperiodization)
+    md_array(int32_t) pbc_chunks;       // Span boundaries of the parallel chunks of the fused PBC pass, [chunks[i], chunks[i+1]) is chunk i
+    md_array(int32_t) subset;           // Atoms of the file which are kept (mol only holds these), NULL if all atoms are kept
+    int64_t num_source_atoms;           // Number of atoms in the frames of the file
+    PrefetchState* prefetch;
+    Telemetry* telemetry;
+    load::traj::telemetry_t telemetry_base;  // Subtracted from the reported telemetry, set when it is reset
+    load::traj::frame_summary_t* summaries;  // Per frame of traj, valid if the corresponding summary tag matches the current frame tag
+    vec3_t* chain_coms;                      // Per frame of traj, num_chains entries per frame
+    std::atomic_uint64_t* summary_tags;      // Frame tag of the processing the summary was computed with, 0 if it has not been computed
+    int64_t num_summaries;
+    int64_t num_chains;
+    FramePipeline* pipeline;
+    CompressedCache* compressed; // NULL if compression is disabled
+    disk_cache_t* disk;          // NULL if the disk cache is disabled or unavailable
+    uint64_t frame_tag;          // Identifies the processing applied to frames (recenter target, deperiodize), used to validate frames in the disk cache
     bool deperiodize;
+    bool indexed;                // If traj was opened through its sidecar index
+    bool multi;                  // If traj is a virtual trajectory over multiple files
+
+    uint64_t cache_budget;       // Requested budget of the frame cache in bytes
+    uint64_t cache_limit;        // Effective budget, which is lower than the requested one if the governor is under memory pressure
+    bool     governor;
+    double   governor_timer;
+
+    frame_cache_policy_t cache_policy;
+    bool pin_playhead;           // Keep the frames around the playhead resident
+    frame_cache_stats_t cache_stats[FRAME_CACHE_POLICY_COUNT]; // Accumulated from previous instances of the cache (which is recreated when resized)
+
+    // The frames which are exposed through the interface: every view_stride'th frame of [view_beg, view_end) of traj.
+    // Frame indices of the interface (load_frame, prefetch_update, stream_frames) are indices within the view,
+    // while the caches are indexed by the frames of traj, so they remain valid when the view changes.
+    int64_t view_beg;
+    int64_t view_end;
+    int64_t view_stride;
+    int64_t view_count;
+    md_array(double) view_times;
 };
 
-static LoadedMolecule loaded_molecules[8] = {};
-static int64_t num_loaded_molecules = 0;
+// Registry of loaded objects: an open addressing hash table (linear probing) from key to a separately allocated entry.
+// Entries are never moved, so pointers to them (the inst of a trajectory, the user data of running tasks) remain valid until the entry is removed.
+// Only accessed from the main thread.
+template <typename T>
+struct Registry {
+    uint64_t* keys;     // 0 denotes an empty slot
+    T**       entries;
+    int64_t   cap;      // Power of two
+    int64_t   count;
+};
 
-static LoadedTrajectory loaded_trajectories[8] = {};
-static int64_t num_loaded_trajectories = 0;
+#define REGISTRY_MIN_CAP 16
 
-static inline LoadedMolecule* find_loaded_molecule(uint64_t key) {
-    for (int64_t i = 0; i < num_loaded_molecules; ++i) {
-        if (loaded_molecules[i].key == key) return &loaded_molecules[i];
+// Keys are pointers, the low bits of which are mostly zero due to alignment
+static inline uint64_t registry_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    return key;
+}
+
+template <typename T>
+static inline int64_t registry_slot(const Registry<T>& reg, uint64_t key) {
+    if (reg.count == 0) return -1;
+    const uint64_t mask = (uint64_t)reg.cap - 1;
+    for (uint64_t i = registry_hash(key) & mask;; i = (i + 1) & mask) {
+        if (reg.keys[i] == key) return (int64_t)i;
+        if (reg.keys[i] == 0)   return -1;
+    }
+}
+
+template <typename T>
+static inline T* registry_find(const Registry<T>& reg, uint64_t key) {
+    const int64_t i = registry_slot(reg, key);
+    return i != -1 ? reg.entries[i] : nullptr;
+}
+
+template <typename T>
+static void registry_insert(Registry<T>& reg, uint64_t key, T* entry) {
+    const uint64_t mask = (uint64_t)reg.cap - 1;
+    uint64_t i = registry_hash(key) & mask;
+    while (reg.keys[i] != 0) i = (i + 1) & mask;
+    reg.keys[i] = key;
+    reg.entries[i] = entry;
+    reg.count++;
+}
+
+// Returns a new zeroed entry for the key
+template <typename T>
+static T* registry_add(Registry<T>& reg, uint64_t key) {
+    ASSERT(key != 0);
+    ASSERT(registry_find(reg, key) == nullptr);
+
+    // Keep the load factor below 3/4
+    if ((reg.count + 1) * 4 > reg.cap * 3) {
+        Registry<T> old = reg;
+        reg.cap   = MAX(REGISTRY_MIN_CAP, old.cap * 2);
+        reg.count = 0;
+        reg.keys    = (uint64_t*)md_alloc(md_heap_allocator, sizeof(uint64_t) * reg.cap);
+        reg.entries = (T**)md_alloc(md_heap_allocator, sizeof(T*) * reg.cap);
+        MEMSET(reg.keys, 0, sizeof(uint64_t) * reg.cap);
+        for (int64_t i = 0; i < old.cap; ++i) {
+            if (old.keys[i]) registry_insert(reg, old.keys[i], old.entries[i]);
+        }
+        if (old.cap) {
+            md_free(md_heap_allocator, old.keys, sizeof(uint64_t) * old.cap);
+            md_free(md_heap_allocator, old.entries, sizeof(T*) * old.cap);
+        }
+    }
+
+    T* entry = (T*)md_alloc(md_heap_allocator, sizeof(T));
+    MEMSET(entry, 0, sizeof(T));
+    entry->key = key;
+    registry_insert(reg, key, entry);
+    return entry;
+}
+
+// Frees the entry of the key
+template <typename T>
+static void registry_remove(Registry<T>& reg, uint64_t key) {
+    int64_t i = registry_slot(reg, key);
+    ASSERT(i != -1);
+    md_free(md_heap_allocator, reg.entries[i], sizeof(T));
+
+    // Backward shift deletion, which keeps the probe sequences intact without tombstones
+    const int64_t mask = reg.cap - 1;
+    for (int64_t j = (i + 1) & mask; reg.keys[j] != 0; j = (j + 1) & mask) {
+        const int64_t home = (int64_t)(registry_hash(reg.keys[j]) & (uint64_t)mask);
+        // The entry at j can be moved to i if its home slot is not within (i, j] (cyclically)
+        const bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            reg.keys[i] = reg.keys[j];
+            reg.entries[i] = reg.entries[j];
+            i = j;
+        }
     }
-    return nullptr;
+    reg.keys[i] = 0;
+    reg.entries[i] = nullptr;
+    reg.count--;
+}
+
+static Registry<LoadedMolecule>   loaded_molecules = {};
+static Registry<LoadedTrajectory> loaded_trajectories = {};
+
+static inline LoadedMolecule* find_loaded_molecule(uint64_t key) {
+    return registry_find(loaded_molecules, key);
 }
 
 static inline void add_loaded_molecule(LoadedMolecule obj) {
-    ASSERT(!find_loaded_molecule(obj.key));
-    ASSERT(num_loaded_molecules < (int64_t)ARRAY_SIZE(loaded_molecules));
-    loaded_molecules[num_loaded_molecules++] = obj;
+    LoadedMolecule* entry = registry_add(loaded_molecules, obj.key);
+    *entry = obj;
 }
 
 static inline void remove_loaded_molecule(uint64_t key) {
-    for (int64_t i = 0; i < num_loaded_molecules; ++i) {
-        if (loaded_molecules[i].key == key) {
-            loaded_molecules[i] = loaded_molecules[--num_loaded_molecules];
-            return;
+    registry_remove(loaded_molecules, key);
+}
+
+static inline LoadedTrajectory* find_loaded_trajectory(uint64_t key) {
+    return registry_find(loaded_trajectories, key);
+}
+
+static inline LoadedTrajectory* alloc_loaded_trajectory(uint64_t key) {
+    return registry_add(loaded_trajectories, key);
+}
+
+static inline void init_pipeline(FramePipeline* pipe) {
+    MEMSET(pipe, 0, sizeof(FramePipeline));
+    md_mutex_init(&pipe->io_mutex);
+    md_mutex_init(&pipe->pool_mutex);
+    for (int32_t i = 0; i < RAW_BUFFER_POOL_SIZE; ++i) {
+        pipe->buffers[i].slot = i;
+        pipe->free_slots[i] = i;
+    }
+    pipe->num_free = RAW_BUFFER_POOL_SIZE;
+}
+
+static inline void interrupt_streams(FramePipeline* pipe) {
+    for (int64_t i = 0; i < md_array_size(pipe->streams); ++i) {
+        task_system::task_interrupt_and_wait_for(pipe->streams[i]);
+    }
+    md_array_shrink(pipe->streams, 0);
+}
+
+static inline void free_pipeline(FramePipeline* pipe, md_allocator_i* alloc) {
+    interrupt_streams(pipe);
+    md_array_free(pipe->streams, alloc);
+    ASSERT(pipe->num_free == RAW_BUFFER_POOL_SIZE);
+    for (int32_t i = 0; i < RAW_BUFFER_POOL_SIZE; ++i) {
+        if (pipe->buffers[i].ptr) {
+            md_free(md_heap_allocator, pipe->buffers[i].ptr, pipe->buffers[i].cap);
         }
     }
-    ASSERT(false);
+    md_mutex_destroy(&pipe->io_mutex);
+    md_mutex_destroy(&pipe->pool_mutex);
 }
 
-static inline LoadedTrajectory* find_loaded_trajectory(uint64_t key) {
-    for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
-        if (loaded_trajectories[i].key == key) return &loaded_trajectories[i];
+static void raw_buffer_acquire(FramePipeline* pipe, RawBuffer* buf, int64_t size) {
+    ASSERT(pipe);
+    ASSERT(buf);
+
+    int32_t slot = -1;
+    md_mutex_lock(&pipe->pool_mutex);
+    if (pipe->num_free > 0) {
+        slot = pipe->free_slots[--pipe->num_free];
+    }
+    md_mutex_unlock(&pipe->pool_mutex);
+
+    if (slot != -1) {
+        // The slot is exclusively owned by us until it is released
+        RawBuffer* pooled = &pipe->buffers[slot];
+        if (pooled->cap < size) {
+            if (pooled->ptr) md_free(md_heap_allocator, pooled->ptr, pooled->cap);
+            pooled->cap = ALIGN_TO(size, KILOBYTES(64));
+            pooled->ptr = md_alloc(md_heap_allocator, pooled->cap);
+        }
+        *buf = *pooled;
+    } else {
+        buf->ptr  = md_alloc(md_heap_allocator, size);
+        buf->cap  = size;
+        buf->slot = -1;
     }
-    return nullptr;
+    buf->size = size;
 }
 
-static inline LoadedTrajectory* alloc_loaded_trajectory(uint64_t key) {
-    ASSERT(find_loaded_trajectory(key) == NULL);
-    ASSERT(num_loaded_trajectories < (int64_t)ARRAY_SIZE(loaded_trajectories));
-    LoadedTrajectory* traj = &loaded_trajectories[num_loaded_trajectories++];
-    *traj = {0}; // Clear
-    traj->key = key;
-    return traj;
+static void raw_buffer_release(FramePipeline* pipe, RawBuffer* buf) {
+    ASSERT(pipe);
+    ASSERT(buf);
+
+    if (!buf->ptr) return;
+    if (buf->slot == -1) {
+        md_free(md_heap_allocator, buf->ptr, buf->cap);
+    } else {
+        md_mutex_lock(&pipe->pool_mutex);
+        pipe->free_slots[pipe->num_free++] = buf->slot;
+        md_mutex_unlock(&pipe->pool_mutex);
+    }
+    *buf = {};
 }
 
-static inline void remove_loaded_trajectory(uint64_t key) {
-    for (int64_t i = 0; i < num_loaded_trajectories; ++i) {
-        if (loaded_trajectories[i].key == key) {
-            md_frame_cache_free(&loaded_trajectories[i].cache);
-            loaded_trajectories[i].loader->destroy(loaded_trajectories[i].traj);
-            // Swap back and pop
-            loaded_trajectories[i] = loaded_trajectories[--num_loaded_trajectories];
-            return;
+static inline void compressed_frame_free(CompressedCache* cc, CompressedFrame* frame) {
+    cc->bytes -= frame->size;
+    md_free(md_heap_allocator, frame, sizeof(CompressedFrame) + frame->size);
+}
+
+static void compressed_cache_init(CompressedCache* cc, int64_t num_frames, int64_t budget, float precision, md_allocator_i* alloc) {
+    MEMSET(cc, 0, sizeof(CompressedCache));
+    md_mutex_init(&cc->mutex);
+    cc->precision  = precision;
+    cc->budget     = budget;
+    cc->num_frames = num_frames;
+    cc->frames = (CompressedFrame**)md_alloc(alloc, sizeof(CompressedFrame*) * num_frames);
+    MEMSET(cc->frames, 0, sizeof(CompressedFrame*) * num_frames);
+}
+
+static void compressed_cache_clear(CompressedCache* cc) {
+    md_mutex_lock(&cc->mutex);
+    for (int64_t i = 0; i < cc->num_frames; ++i) {
+        CompressedFrame* frame = cc->frames[i];
+        if (frame) {
+            if (frame->refs == 0) {
+                compressed_frame_free(cc, frame);
+            } else {
+                frame->evicted = true;
+            }
+            cc->frames[i] = 0;
         }
     }
-    ASSERT(false);
+    cc->count = 0;
+    md_mutex_unlock(&cc->mutex);
+}
+
+static void compressed_cache_free(CompressedCache* cc, md_allocator_i* alloc) {
+    compressed_cache_clear(cc);
+    md_free(alloc, cc->frames, sizeof(CompressedFrame*) * cc->num_frames);
+    md_mutex_destroy(&cc->mutex);
+}
+
+// Returns a referenced frame, which has to be released after use, or NULL if the frame is not resident
+static CompressedFrame* compressed_cache_acquire(CompressedCache* cc, int64_t idx) {
+    if (!cc) return NULL;
+    md_mutex_lock(&cc->mutex);
+    CompressedFrame* frame = cc->frames[idx];
+    if (frame) frame->refs++;
+    md_mutex_unlock(&cc->mutex);
+    return frame;
+}
+
+static void compressed_cache_release(CompressedCache* cc, CompressedFrame* frame) {
+    md_mutex_lock(&cc->mutex);
+    ASSERT(frame->refs > 0);
+    if (--frame->refs == 0 && frame->evicted) {
+        compressed_frame_free(cc, frame);
+    }
+    md_mutex_unlock(&cc->mutex);
+}
+
+// Evicts frames using a clock hand over the frames, until the resident frames fit within max_bytes. The mutex must be held
+static void compressed_cache_evict(CompressedCache* cc, int64_t max_bytes) {
+    while (cc->bytes > max_bytes && cc->count > 0) {
+        CompressedFrame* victim = cc->frames[cc->clock];
+        if (victim) {
+            cc->frames[cc->clock] = 0;
+            cc->count--;
+            if (victim->refs == 0) {
+                compressed_frame_free(cc, victim);
+            } else {
+                victim->evicted = true;
+            }
+        }
+        cc->clock = (cc->clock + 1) % cc->num_frames;
+    }
+}
+
+static void compressed_cache_set_budget(CompressedCache* cc, int64_t budget) {
+    md_mutex_lock(&cc->mutex);
+    cc->budget = budget;
+    compressed_cache_evict(cc, budget);
+    md_mutex_unlock(&cc->mutex);
+}
+
+static void compressed_cache_insert(CompressedCache* cc, int64_t idx, const md_frame_data_t* frame_data) {
+    const int64_t num_atoms = frame_data->header.num_atoms;
+    const int64_t cap = frame_codec_encode_bound(num_atoms);
+    if (cap > cc->budget) return;
+
+    // Encode into a worst case sized frame, which is then shrunk to the encoded size
+    md_allocator_i* scratch = task_system::current_task_scratch();
+    CompressedFrame* tmp = (CompressedFrame*)md_alloc(scratch, sizeof(CompressedFrame) + cap);
+    defer { md_free(scratch, tmp, sizeof(CompressedFrame) + cap); };
+
+    const int64_t size = frame_codec_encode(tmp + 1, cap, frame_data->x, frame_data->y, frame_data->z, num_atoms, cc->precision);
+    if (!size) {
+        MD_LOG_DEBUG("Frame %i could not be encoded with the requested precision, it will not be compressed", (int)idx);
+        return;
+    }
+
+    CompressedFrame* frame = (CompressedFrame*)md_alloc(md_heap_allocator, sizeof(CompressedFrame) + size);
+    frame->header  = frame_data->header;
+    frame->size    = size;
+    frame->refs    = 0;
+    frame->evicted = false;
+    MEMCPY(frame + 1, tmp + 1, size);
+
+    md_mutex_lock(&cc->mutex);
+    if (cc->frames[idx] || size > cc->budget) {
+        // Inserted by someone else in the meantime (or the budget was lowered)
+        md_free(md_heap_allocator, frame, sizeof(CompressedFrame) + size);
+    } else {
+        compressed_cache_evict(cc, cc->budget - size);
+        cc->frames[idx] = frame;
+        cc->bytes += size;
+        cc->count++;
+    }
+    md_mutex_unlock(&cc->mutex);
+}
+
+// Every access of the frame cache from within the pipeline is wrapped in enter/leave, which allows the cache to be rebuilt safely
+static inline void cache_enter(FramePipeline* pipe) {
+    for (;;) {
+        while (pipe->cache_rebuild) std::this_thread::yield();
+        pipe->cache_users++;
+        if (!pipe->cache_rebuild) return;
+        pipe->cache_users--;
+    }
+}
+
+static inline void cache_leave(FramePipeline* pipe) {
+    ASSERT(pipe->cache_users > 0);
+    pipe->cache_users--;
+}
+
+// Blocks until there are no current users, new users wait until the gate is opened again
+static inline void cache_close_gate(FramePipeline* pipe) {
+    pipe->cache_rebuild = true;
+    while (pipe->cache_users > 0) std::this_thread::yield();
+}
+
+static inline void cache_open_gate(FramePipeline* pipe) {
+    pipe->cache_rebuild = false;
+}
+
+static void close_internal_traj(md_trajectory_i* traj, md_trajectory_loader_i* loader, bool indexed, bool multi) {
+    if (multi) {
+        multi_traj_close(traj);
+    } else if (indexed) {
+        traj_index_close(traj);
+    } else {
+        loader->destroy(traj);
+    }
+}
+
+static inline void remove_loaded_trajectory(uint64_t key) {
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory(key);
+    ASSERT(loaded_traj);
+
+    task_system::task_interrupt_and_wait_for(loaded_traj->prefetch->task);
+    free_pipeline(loaded_traj->pipeline, loaded_traj->alloc);
+    md_free(loaded_traj->alloc, loaded_traj->pipeline, sizeof(FramePipeline));
+    md_free(loaded_traj->alloc, loaded_traj->prefetch, sizeof(PrefetchState));
+    md_free(loaded_traj->alloc, loaded_traj->telemetry, sizeof(Telemetry));
+    md_free(loaded_traj->alloc, loaded_traj->summaries,    loaded_traj->num_summaries * sizeof(load::traj::frame_summary_t));
+    md_free(loaded_traj->alloc, loaded_traj->summary_tags, loaded_traj->num_summaries * sizeof(std::atomic_uint64_t));
+    if (loaded_traj->chain_coms) {
+        md_free(loaded_traj->alloc, loaded_traj->chain_coms, loaded_traj->num_summaries * loaded_traj->num_chains * sizeof(vec3_t));
+    }
+    md_array_free(loaded_traj->recenter_indices, loaded_traj->alloc);
+    md_array_free(loaded_traj->view_times, loaded_traj->alloc);
+    md_array_free(loaded_traj->pbc_spans, loaded_traj->alloc);
+    md_array_free(loaded_traj->pbc_chunks, loaded_traj->alloc);
+    md_array_free(loaded_traj->subset, loaded_traj->alloc);
+    disk_cache_close(loaded_traj->disk);
+    if (loaded_traj->compressed) {
+        compressed_cache_free(loaded_traj->compressed, loaded_traj->alloc);
+        md_free(loaded_traj->alloc, loaded_traj->compressed, sizeof(CompressedCache));
+    }
+    frame_cache_destroy(loaded_traj->cache);
+    close_internal_traj(loaded_traj->traj, loaded_traj->loader, loaded_traj->indexed, loaded_traj->multi);
+    registry_remove(loaded_trajectories, key);
 }
 
 namespace load {
@@ -135,6 +634,106 @@ md_molecule_loader_i* get_loader_from_ext(str_t ext) {
     return NULL;
 }
 
+bool extract_subset(md_molecule_t* dst, const md_molecule_t* src, const int32_t* indices, int64_t count, md_allocator_i* alloc) {
+    ASSERT(dst);
+    ASSERT(src);
+    ASSERT(alloc);
+    ASSERT(dst != src);
+
+    if (count <= 0 || !indices) {
+        MD_LOG_ERROR("Atom subset is empty");
+        return false;
+    }
+    for (int64_t i = 0; i < count; ++i) {
+        if (indices[i] < 0 || indices[i] >= (int32_t)src->atom.count || (i > 0 && indices[i] <= indices[i - 1])) {
+            MD_LOG_ERROR("Atom subset indices must be unique, ascending and within the molecule");
+            return false;
+        }
+    }
+
+    MEMSET(dst, 0, sizeof(md_molecule_t));
+    dst->atom.count = count;
+
+#define GATHER_ATOM_FIELD(field) \
+    if (src->atom.field) { \
+        md_array_resize(dst->atom.field, count, alloc); \
+        for (int64_t i = 0; i < count; ++i) dst->atom.field[i] = src->atom.field[indices[i]]; \
+    }
+
+    GATHER_ATOM_FIELD(x)
+    GATHER_ATOM_FIELD(y)
+    GATHER_ATOM_FIELD(z)
+    GATHER_ATOM_FIELD(radius)
+    GATHER_ATOM_FIELD(mass)
+    GATHER_ATOM_FIELD(element)
+    GATHER_ATOM_FIELD(type)
+    GATHER_ATOM_FIELD(flags)
+#undef GATHER_ATOM_FIELD
+
+    // Residues and chains which retain at least one atom are kept, their atom ranges shrink to the kept atoms
+    md_array(int32_t) res_map = 0;
+    defer { md_array_free(res_map, md_heap_allocator); };
+    if (src->atom.res_idx && src->residue.count > 0) {
+        md_array_resize(res_map, src->residue.count, md_heap_allocator);
+        for (int64_t i = 0; i < src->residue.count; ++i) res_map[i] = -1;
+
+        md_array_resize(dst->atom.res_idx, count, alloc);
+        for (int64_t i = 0; i < count; ++i) {
+            const int32_t src_res = src->atom.res_idx[indices[i]];
+            int32_t dst_res = -1;
+            if (src_res >= 0) {
+                if (res_map[src_res] == -1) {
+                    res_map[src_res] = (int32_t)dst->residue.count++;
+                    md_range_t range = {(int32_t)i, (int32_t)i};
+                    md_array_push(dst->residue.atom_range, range, alloc);
+                    if (src->residue.name) md_array_push(dst->residue.name, src->residue.name[src_res], alloc);
+                    if (src->residue.id)   md_array_push(dst->residue.id,   src->residue.id[src_res], alloc);
+                }
+                dst_res = res_map[src_res];
+                dst->residue.atom_range[dst_res].end = (int32_t)i + 1;
+            }
+            dst->atom.res_idx[i] = dst_res;
+        }
+    }
+
+    if (src->atom.chain_idx && src->chain.count > 0) {
+        md_array(int32_t) chain_map = 0;
+        defer { md_array_free(chain_map, md_heap_allocator); };
+        md_array_resize(chain_map, src->chain.count, md_heap_allocator);
+        for (int64_t i = 0; i < src->chain.count; ++i) chain_map[i] = -1;
+
+        md_array_resize(dst->atom.chain_idx, count, alloc);
+        for (int64_t i = 0; i < count; ++i) {
+            const int32_t src_chain = src->atom.chain_idx[indices[i]];
+            int32_t dst_chain = -1;
+            if (src_chain >= 0) {
+                if (chain_map[src_chain] == -1) {
+                    chain_map[src_chain] = (int32_t)dst->chain.count++;
+                    md_range_t atom_range = {(int32_t)i, (int32_t)i};
+                    md_range_t res_range  = {0, 0};
+                    md_array_push(dst->chain.atom_range, atom_range, alloc);
+                    md_array_push(dst->chain.residue_range, res_range, alloc);
+                    if (src->chain.id) md_array_push(dst->chain.id, src->chain.id[src_chain], alloc);
+                }
+                dst_chain = chain_map[src_chain];
+                dst->chain.atom_range[dst_chain].end = (int32_t)i + 1;
+            }
+            dst->atom.chain_idx[i] = dst_chain;
+        }
+
+        // Residue ranges of the chains follow from the residues of their first and last atom
+        for (int64_t i = 0; i < dst->chain.count; ++i) {
+            const md_range_t range = dst->chain.atom_range[i];
+            if (dst->atom.res_idx && dst->atom.res_idx[range.beg] >= 0 && dst->atom.res_idx[range.end - 1] >= 0) {
+                dst->chain.residue_range[i].beg = dst->atom.res_idx[range.beg];
+                dst->chain.residue_range[i].end = dst->atom.res_idx[range.end - 1] + 1;
+            }
+        }
+    }
+
+    return true;
+}
+
 }  // namespace mol
 
 namespace traj {
@@ -150,7 +749,13 @@ md_trajectory_loader_i* get_loader_from_ext(str_t ext) {
 
 bool get_header(struct md_trajectory_o* inst, md_trajectory_header_t* header) {
     LoadedTrajectory* loaded_traj = (LoadedTrajectory*)inst;
-    return md_trajectory_get_header(loaded_traj->traj, header);
+    if (!md_trajectory_get_header(loaded_traj->traj, header)) {
+        return false;
+    }
+    header->num_frames  = loaded_traj->view_count;
+    header->frame_times = loaded_traj->view_times;
+    header->num_atoms   = loaded_traj->mol->atom.count;
+    return true;
 }
 
 int64_t fetch_frame_data(struct md_trajectory_o*, int64_t idx, void* data_ptr) {
@@ -160,197 +765,1684 @@ int64_t fetch_frame_data(struct md_trajectory_o*, int64_t idx, void* data_ptr) {
     return sizeof(int64_t);
 }
 
-bool decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, [[maybe_unused]] int64_t data_size, md_trajectory_frame_header_t* header, float* out_x, float* out_y, float* out_z) {
-    LoadedTrajectory* loaded_traj = (LoadedTrajectory*)inst;
-    ASSERT(loaded_traj);
-    ASSERT(data_size == sizeof(int64_t));
+#if defined(__AVX2__)
+// sin and cos of t in [-pi, pi), reduced to [-pi/2, pi/2] and evaluated using truncated Taylor series (abs error < 1e-7)
+static inline void sincos_avx2(__m256 t, __m256* out_sin, __m256* out_cos) {
+    const __m256 half_pi = _mm256_set1_ps(1.57079632679f);
+    const __m256 pi      = _mm256_set1_ps(3.14159265359f);
+    const __m256 sign    = _mm256_set1_ps(-0.0f);
 
-    int64_t idx = *((int64_t*)data_ptr);
-    ASSERT(0 <= idx && idx < md_trajectory_num_frames(loaded_traj->traj));
+    // Mirror into [-pi/2, pi/2], sin is preserved, cos changes sign
+    const __m256 abs_t  = _mm256_andnot_ps(sign, t);
+    const __m256 mirror = _mm256_cmp_ps(abs_t, half_pi, _CMP_GT_OQ);
+    const __m256 t_sign = _mm256_and_ps(sign, t);
+    t = _mm256_blendv_ps(t, _mm256_or_ps(t_sign, _mm256_sub_ps(pi, abs_t)), mirror);
 
-    md_frame_data_t* frame_data;
-    md_frame_cache_lock_t* lock = 0;
-    bool result = true;
-    bool in_cache = md_frame_cache_find_or_reserve(&loaded_traj->cache, idx, &frame_data, &lock);
-    if (!in_cache) {
-        md_allocator_i* alloc = md_heap_allocator;
-        const int64_t frame_data_size = md_trajectory_fetch_frame_data(loaded_traj->traj, idx, 0);
-        void* frame_data_ptr = md_alloc(alloc, frame_data_size);
-        md_trajectory_fetch_frame_data(loaded_traj->traj, idx, frame_data_ptr);
-        result = md_trajectory_decode_frame_data(loaded_traj->traj, frame_data_ptr, frame_data_size, &frame_data->header, frame_data->x, frame_data->y, frame_data->z);
-
-        if (result) {
-            const md_unit_cell_t* cell = &frame_data->header.unit_cell;
-            const bool have_cell = cell->flags != 0;
-
-            const md_molecule_t* mol = loaded_traj->mol;
-            float* x = frame_data->x;
-            float* y = frame_data->y;
-            float* z = frame_data->z;
-            const int64_t num_atoms = frame_data->header.num_atoms;
-
-            // If we have a recenter target, then compute the com and apply that transformation
-            if (!md_bitfield_empty(&loaded_traj->recenter_target)) {
-                const md_bitfield_t* bf = &loaded_traj->recenter_target;
-                const int64_t count = md_bitfield_popcount(bf);
-                
-                if (count > 0) {
-                    int32_t* indices = (int32_t*)md_alloc(alloc, sizeof(int32_t) * count);
-                    defer { md_free(alloc, indices, sizeof(int32_t) * count); };
-                        
-                    int64_t num_indices = md_bitfield_extract_indices(indices, count, bf);
-                    ASSERT(num_indices == count);
-
-                    const vec3_t box_ext = mat3_mul_vec3(cell->basis, vec3_set1(1.0f));
-
-                    const vec3_t com = have_cell ?
-                        vec3_deperiodize(md_util_compute_com_ortho(x, y, z, mol->atom.mass, indices, count, box_ext), box_ext * 0.5f, box_ext) :
-                        md_util_compute_com(x, y, z, mol->atom.mass, indices, count);
-
-                    // Translate all
-                    const vec3_t trans = have_cell ? box_ext * 0.5f - com : -com;
-                    vec3_batch_translate_inplace(x, y, z, num_atoms, trans);
-                }
-            }
+    const __m256 t2 = _mm256_mul_ps(t, t);
+
+    __m256 s = _mm256_set1_ps(-2.50521083854e-8f);
+    s = _mm256_fmadd_ps(s, t2, _mm256_set1_ps( 2.75573192240e-6f));
+    s = _mm256_fmadd_ps(s, t2, _mm256_set1_ps(-1.98412698413e-4f));
+    s = _mm256_fmadd_ps(s, t2, _mm256_set1_ps( 8.33333333333e-3f));
+    s = _mm256_fmadd_ps(s, t2, _mm256_set1_ps(-1.66666666667e-1f));
+    s = _mm256_fmadd_ps(s, t2, _mm256_set1_ps( 1.0f));
+    s = _mm256_mul_ps(s, t);
+
+    __m256 c = _mm256_set1_ps( 2.08767569879e-9f);
+    c = _mm256_fmadd_ps(c, t2, _mm256_set1_ps(-2.75573192240e-7f));
+    c = _mm256_fmadd_ps(c, t2, _mm256_set1_ps( 2.48015873016e-5f));
+    c = _mm256_fmadd_ps(c, t2, _mm256_set1_ps(-1.38888888889e-3f));
+    c = _mm256_fmadd_ps(c, t2, _mm256_set1_ps( 4.16666666667e-2f));
+    c = _mm256_fmadd_ps(c, t2, _mm256_set1_ps(-0.5f));
+    c = _mm256_fmadd_ps(c, t2, _mm256_set1_ps( 1.0f));
+    c = _mm256_xor_ps(c, _mm256_and_ps(mirror, sign));
+
+    *out_sin = s;
+    *out_cos = c;
+}
+
+static inline double reduce_avx2(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    __m128 sum = _mm_add_ps(lo, hi);
+    sum = _mm_hadd_ps(sum, sum);
+    sum = _mm_hadd_ps(sum, sum);
+    return (double)_mm_cvtss_f32(sum);
+}
+#endif
+
+// Mass weighted center of mass of the atoms given by indices.
+// If all components of box_ext are non-zero, the periodic center of mass is computed using the trigonometric (circular mean) formulation,
+// which places the com within [0, box_ext). Otherwise the regular com is computed. Mass is optional.
+static vec3_t compute_com_indexed(const float* x, const float* y, const float* z, const float* mass, const int32_t* indices, int64_t count, vec3_t box_ext) {
+    ASSERT(x && y && z);
+    ASSERT(indices);
+    if (count <= 0) return {};
+
+    const bool periodic = box_ext.x > 0 && box_ext.y > 0 && box_ext.z > 0;
+    const float TWO_PI = 6.28318530718f;
+    const float inv_ext[3] = {
+        periodic ? 1.0f / box_ext.x : 0.0f,
+        periodic ? 1.0f / box_ext.y : 0.0f,
+        periodic ? 1.0f / box_ext.z : 0.0f,
+    };
+
+    // Periodic: (cos, sin) per axis, regular: (sum, unused) per axis. Last element is the weight.
+    // Float accumulators are flushed into double after each block to retain precision for large selections
+    double acc[7] = {0};
+    int64_t i = 0;
 
-            if (loaded_traj->deperiodize && have_cell) {
-                md_util_deperiodize_system(x, y, z, mol->atom.mass, mol->atom.count, cell, &mol->structures);
+#if defined(__AVX2__)
+    const int64_t BLOCK_SIZE = 4096;
+    const __m256 one  = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 two_pi = _mm256_set1_ps(TWO_PI);
+    const float* coords[3] = {x, y, z};
+
+    while (i + 8 <= count) {
+        const int64_t block_end = i + MIN(BLOCK_SIZE, (count - i) & ~7LL);
+        __m256 a[7];
+        for (int k = 0; k < 7; ++k) a[k] = _mm256_setzero_ps();
+
+        for (; i < block_end; i += 8) {
+            const __m256i idx = _mm256_loadu_si256((const __m256i*)(indices + i));
+            const __m256 m = mass ? _mm256_i32gather_ps(mass, idx, 4) : one;
+            for (int k = 0; k < 3; ++k) {
+                const __m256 p = _mm256_i32gather_ps(coords[k], idx, 4);
+                if (periodic) {
+                    // Fractional coordinate wrapped into [0,1) and mapped to an angle in [-pi, pi)
+                    __m256 u = _mm256_mul_ps(p, _mm256_set1_ps(inv_ext[k]));
+                    u = _mm256_sub_ps(u, _mm256_floor_ps(u));
+                    const __m256 t = _mm256_mul_ps(_mm256_sub_ps(u, half), two_pi);
+                    __m256 s, c;
+                    sincos_avx2(t, &s, &c);
+                    a[k*2+0] = _mm256_fmadd_ps(m, c, a[k*2+0]);
+                    a[k*2+1] = _mm256_fmadd_ps(m, s, a[k*2+1]);
+                } else {
+                    a[k*2+0] = _mm256_fmadd_ps(m, p, a[k*2+0]);
+                }
             }
+            a[6] = _mm256_add_ps(a[6], m);
         }
 
-        md_free(alloc, frame_data_ptr, frame_data_size);
+        for (int k = 0; k < 7; ++k) acc[k] += reduce_avx2(a[k]);
     }
+#endif
 
-    if (result) {
-        const int64_t num_atoms = frame_data->header.num_atoms;
-        if (header) *header = frame_data->header;
-        if (out_x) MEMCPY(out_x, frame_data->x, sizeof(float) * num_atoms);
-        if (out_y) MEMCPY(out_y, frame_data->y, sizeof(float) * num_atoms);
-        if (out_z) MEMCPY(out_z, frame_data->z, sizeof(float) * num_atoms);
+    for (; i < count; ++i) {
+        const int32_t idx = indices[i];
+        const float m = mass ? mass[idx] : 1.0f;
+        const float p[3] = {x[idx], y[idx], z[idx]};
+        for (int k = 0; k < 3; ++k) {
+            if (periodic) {
+                float u = p[k] * inv_ext[k];
+                u = u - floorf(u);
+                const float t = (u - 0.5f) * TWO_PI;
+                acc[k*2+0] += m * cosf(t);
+                acc[k*2+1] += m * sinf(t);
+            } else {
+                acc[k*2+0] += m * p[k];
+            }
+        }
+        acc[6] += m;
     }
 
-    if (lock) {
-        md_frame_cache_frame_lock_release(lock);
-    }
+    if (acc[6] == 0.0) return {};
 
-    return result;
+    vec3_t com;
+    if (periodic) {
+        // The angles are shifted by -pi, so the circular mean is shifted back by +pi which maps it into [0, 2pi)
+        const double ext[3] = {box_ext.x, box_ext.y, box_ext.z};
+        for (int k = 0; k < 3; ++k) {
+            const double theta = atan2(acc[k*2+1], acc[k*2+0]) + 3.14159265358979323846;
+            com.elem[k] = (float)(theta / (2.0 * 3.14159265358979323846) * ext[k]);
+        }
+    } else {
+        const double inv_w = 1.0 / acc[6];
+        com.x = (float)(acc[0] * inv_w);
+        com.y = (float)(acc[2] * inv_w);
+        com.z = (float)(acc[4] * inv_w);
+    }
+    return com;
 }
 
-bool load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
-    void* frame_data = &idx;
-    return decode_frame_data(inst, frame_data, sizeof(int64_t), header, x, y, z);
+static int compare_pbc_span(const void* a, const void* b) {
+    return ((const PbcSpan*)a)->beg - ((const PbcSpan*)b)->beg;
 }
 
-md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, bool deperiodize_on_load) {
-    ASSERT(mol);
-    ASSERT(alloc);
-
-    if (!loader) {
-        loader = get_loader_from_ext(extract_ext(filename));
-    }
-    if (!loader) {
-        MD_LOG_ERROR("Unsupported file extension: '%.*s'", filename.len, filename.ptr);
-        return NULL;
+// Loose atoms are independent of each other, so long runs are split to give the parallel pass something to distribute
+static void push_loose_spans(md_array(PbcSpan)* spans, int32_t beg, int32_t end, md_allocator_i* alloc) {
+    while (beg < end) {
+        const int32_t span_end = MIN(end, beg + PARALLEL_GRAIN_ATOMS);
+        PbcSpan loose = {beg, span_end, 0};
+        md_array_push(*spans, loose, alloc);
+        beg = span_end;
     }
+}
 
-    md_trajectory_i* internal_traj = loader->create(filename, alloc);
-    if (!internal_traj) {
-        return NULL;
-    }
-    
-    if (md_trajectory_num_atoms(internal_traj) != mol->atom.count) {
-        MD_LOG_ERROR("Trajectory is not compatible with the loaded molecule.");
-        loader->destroy(internal_traj);
-        return NULL;
+// Groups consecutive spans into chunks of roughly PARALLEL_GRAIN_ATOMS atoms (a structure is never split)
+static void build_pbc_chunks(md_array(int32_t)* chunks, const PbcSpan* spans, int64_t num_spans, md_allocator_i* alloc) {
+    md_array_shrink(*chunks, 0);
+    md_array_push(*chunks, 0, alloc);
+    int32_t chunk_beg = 0;
+    for (int64_t i = 0; i < num_spans; ++i) {
+        if (spans[i].end - spans[chunk_beg].beg >= PARALLEL_GRAIN_ATOMS || i == num_spans - 1) {
+            chunk_beg = (int32_t)(i + 1);
+            md_array_push(*chunks, chunk_beg, alloc);
+        }
     }
+}
 
-    md_trajectory_i* traj = (md_trajectory_i*)md_alloc(alloc, sizeof(md_trajectory_i));
-    memset(traj, 0, sizeof(md_trajectory_i));
-
-    LoadedTrajectory* inst = alloc_loaded_trajectory((uint64_t)traj);
-    inst->mol = mol;
-    inst->loader = loader;
-    inst->traj = internal_traj;
-    inst->cache = {0};
-    inst->recenter_target = {0};
-    inst->alloc = alloc;
-    inst->deperiodize = deperiodize_on_load;
-    
-    const uint64_t num_traj_frames      = md_trajectory_num_frames(internal_traj);
-    const uint64_t frame_cache_size     = CLAMP(MEGABYTES(VIAMD_FRAME_CACHE_SIZE), MEGABYTES(4), md_os_physical_ram() / 4);
-    const uint64_t approx_frame_size    = (uint64_t)mol->atom.count * 3 * sizeof(float);
-    const uint64_t max_num_cache_frames = frame_cache_size / approx_frame_size;
+// Partitions the atoms into spans of structures and of the atoms between them. Returns false if any structure is not a contiguous range of atoms.
+static bool build_pbc_spans(md_array(PbcSpan)* spans, const md_molecule_t* mol, md_allocator_i* alloc) {
+    md_array(PbcSpan) structures = 0;
+    defer { md_array_free(structures, md_heap_allocator); };
 
-    const int64_t num_cache_frames   = MIN(num_traj_frames, max_num_cache_frames);
-    
-    MD_LOG_DEBUG("Initializing frame cache with %i frames.", (int)num_cache_frames);
-    md_frame_cache_init(&inst->cache, inst->traj, alloc, num_cache_frames);
-    md_bitfield_init(&inst->recenter_target, alloc);
+    const int64_t num_structures = md_index_data_count(mol->structures);
+    for (int64_t i = 0; i < num_structures; ++i) {
+        const int32_t* indices = md_index_range_beg(mol->structures, i);
+        const int64_t  size    = md_index_range_size(mol->structures, i);
+        if (size <= 0) continue;
+        for (int64_t j = 1; j < size; ++j) {
+            if (indices[j] != indices[0] + j) return false;
+        }
+        PbcSpan span = {indices[0], (int32_t)(indices[0] + size), 1};
+        md_array_push(structures, span, md_heap_allocator);
+    }
+    if (md_array_size(structures) > 1) {
+        qsort(structures, (size_t)md_array_size(structures), sizeof(PbcSpan), compare_pbc_span);
+    }
 
-    // We only overload load frame and decode frame data to apply PBC upon loading data
-    traj->inst = (md_trajectory_o*)inst;
-    traj->get_header = get_header;
-    traj->load_frame = load_frame;
-    traj->fetch_frame_data = fetch_frame_data;
-    traj->decode_frame_data = decode_frame_data;
-    
-    return traj;
+    md_array_shrink(*spans, 0);
+    int32_t cur = 0;
+    for (int64_t i = 0; i < md_array_size(structures); ++i) {
+        if (structures[i].beg < cur || structures[i].end > (int32_t)mol->atom.count) {
+            md_array_shrink(*spans, 0);
+            return false;
+        }
+        push_loose_spans(spans, cur, structures[i].beg, alloc);
+        md_array_push(*spans, structures[i], alloc);
+        cur = structures[i].end;
+    }
+    push_loose_spans(spans, cur, (int32_t)mol->atom.count, alloc);
+    return true;
 }
 
-bool close(md_trajectory_i* traj) {
-    ASSERT(traj);
-
-    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
-    if (loaded_traj) {
-        remove_loaded_trajectory(loaded_traj->key);
-        memset(traj, 0, sizeof(md_trajectory_i));
-        return true;
+static void update_pbc_spans(LoadedTrajectory* loaded_traj) {
+    if (build_pbc_spans(&loaded_traj->pbc_spans, loaded_traj->mol, loaded_traj->alloc)) {
+        build_pbc_chunks(&loaded_traj->pbc_chunks, loaded_traj->pbc_spans, md_array_size(loaded_traj->pbc_spans), loaded_traj->alloc);
+    } else {
+        md_array_free(loaded_traj->pbc_spans, loaded_traj->alloc);
+        md_array_free(loaded_traj->pbc_chunks, loaded_traj->alloc);
+        loaded_traj->pbc_spans = 0;
+        loaded_traj->pbc_chunks = 0;
     }
-    MD_LOG_ERROR("Attempting to free trajectory which was not loaded with loader");
-    ASSERT(false);
-    return false;
 }
 
-bool set_recenter_target(md_trajectory_i* traj, const md_bitfield_t* atom_mask) {
-    ASSERT(traj);
+static inline bool cell_is_orthorhombic(const md_unit_cell_t* cell) {
+    return cell->basis.elem[0][1] == 0 && cell->basis.elem[0][2] == 0 &&
+           cell->basis.elem[1][0] == 0 && cell->basis.elem[1][2] == 0 &&
+           cell->basis.elem[2][0] == 0 && cell->basis.elem[2][1] == 0;
+}
 
-    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
-    if (loaded_traj) {
-        if (atom_mask) {
-            md_bitfield_copy(&loaded_traj->recenter_target, atom_mask);
+// Center of mass along one axis of the atoms [beg, end) after translation by t. If ext is non-zero the periodic center of mass is computed
+// using the circular mean (as compute_com_indexed), which places it within [0, ext).
+static float compute_span_com_axis(const float* p, const float* mass, int64_t beg, int64_t end, float t, float ext) {
+    const float TWO_PI = 6.28318530718f;
+    const float inv = ext > 0 ? 1.0f / ext : 0.0f;
+    double acc_c = 0, acc_s = 0, acc_w = 0;
+    int64_t i = beg;
+#if defined(__AVX2__)
+    if (ext > 0) {
+        const __m256 t8 = _mm256_set1_ps(t), r8 = _mm256_set1_ps(inv), half = _mm256_set1_ps(0.5f), two_pi = _mm256_set1_ps(TWO_PI);
+        __m256 c8 = _mm256_setzero_ps(), s8 = _mm256_setzero_ps(), w8 = _mm256_setzero_ps();
+        for (; i + 8 <= end; i += 8) {
+            const __m256 m = mass ? _mm256_loadu_ps(mass + i) : _mm256_set1_ps(1.0f);
+            __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(p + i), t8), r8);
+            u = _mm256_sub_ps(u, _mm256_floor_ps(u));
+            __m256 sn, cs;
+            sincos_avx2(_mm256_mul_ps(_mm256_sub_ps(u, half), two_pi), &sn, &cs);
+            c8 = _mm256_fmadd_ps(m, cs, c8);
+            s8 = _mm256_fmadd_ps(m, sn, s8);
+            w8 = _mm256_add_ps(w8, m);
         }
-        else {
-            md_bitfield_clear(&loaded_traj->recenter_target);
+        acc_c += reduce_avx2(c8);
+        acc_s += reduce_avx2(s8);
+        acc_w += reduce_avx2(w8);
+    }
+#endif
+    for (; i < end; ++i) {
+        const float m = mass ? mass[i] : 1.0f;
+        const float v = p[i] + t;
+        if (ext > 0) {
+            float u = v * inv;
+            u = u - floorf(u);
+            const float a = (u - 0.5f) * TWO_PI;
+            acc_c += m * cosf(a);
+            acc_s += m * sinf(a);
+        } else {
+            acc_c += m * v;
         }
-        return true;
+        acc_w += m;
     }
-    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
-    return false;
+    if (acc_w <= 0) return 0.0f;
+    if (ext > 0) {
+        // The angles are shifted by -pi, so the circular mean is shifted back by +pi which maps it into [0, 2pi)
+        const double theta = atan2(acc_s, acc_c) + 3.14159265358979323846;
+        return MIN((float)(theta / (2.0 * 3.14159265358979323846) * ext), ext * (1.0f - FLT_EPSILON));
+    }
+    return (float)(acc_c / acc_w);
 }
 
-bool clear_cache(md_trajectory_i* traj) {
+// Translates all atoms by trans and deperiodizes them within an orthorhombic cell (given by box_ext) in a single sweep over the coordinates,
+// rather than a translation pass followed by a deperiodization pass over the full system.
+// As md_util_deperiodize_system, structures are unwrapped around their periodic center of mass (minimum image), which places the center of mass within the cell.
+// Loose atoms are wrapped into the cell. Axes with a zero extent are not periodic and only translated.
+static void apply_pbc_spans(float* x, float* y, float* z, const float* mass, const PbcSpan* spans, int64_t num_spans, vec3_t trans, vec3_t box_ext) {
+    float* coords[3] = {x, y, z};
+    const float ext[3] = {box_ext.x, box_ext.y, box_ext.z};
+    const float inv[3] = {
+        box_ext.x > 0 ? 1.0f / box_ext.x : 0.0f,
+        box_ext.y > 0 ? 1.0f / box_ext.y : 0.0f,
+        box_ext.z > 0 ? 1.0f / box_ext.z : 0.0f,
+    };
+    const float t[3] = {trans.x, trans.y, trans.z};
+
+    for (int64_t s = 0; s < num_spans; ++s) {
+        const int64_t beg = spans[s].beg;
+        const int64_t end = spans[s].end;
+
+        if (!spans[s].structure) {
+            for (int k = 0; k < 3; ++k) {
+                float* p = coords[k];
+                int64_t i = beg;
+#if defined(__AVX512F__)
+                const __m512 t16 = _mm512_set1_ps(t[k]), e16 = _mm512_set1_ps(ext[k]), r16 = _mm512_set1_ps(inv[k]);
+                for (; i + 16 <= end; i += 16) {
+                    __m512 v = _mm512_add_ps(_mm512_loadu_ps(p + i), t16);
+                    v = _mm512_fnmadd_ps(e16, _mm512_roundscale_ps(_mm512_mul_ps(v, r16), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC), v);
+                    _mm512_storeu_ps(p + i, v);
+                }
+#endif
+#if defined(__AVX2__)
+                const __m256 t8 = _mm256_set1_ps(t[k]), e8 = _mm256_set1_ps(ext[k]), r8 = _mm256_set1_ps(inv[k]);
+                for (; i + 8 <= end; i += 8) {
+                    __m256 v = _mm256_add_ps(_mm256_loadu_ps(p + i), t8);
+                    v = _mm256_fnmadd_ps(e8, _mm256_floor_ps(_mm256_mul_ps(v, r8)), v);
+                    _mm256_storeu_ps(p + i, v);
+                }
+#endif
+                for (; i < end; ++i) {
+                    const float v = p[i] + t[k];
+                    p[i] = v - ext[k] * floorf(v * inv[k]);
+                }
+            }
+            continue;
+        }
+
+        // Structure: unwrap relative to the center of mass, the second pass touches atoms which are still in L1 for typical structure sizes
+        for (int k = 0; k < 3; ++k) {
+            float* p = coords[k];
+            const float ref = compute_span_com_axis(p, mass, beg, end, t[k], ext[k]);
+            int64_t i = beg;
+#if defined(__AVX512F__)
+            {
+                const __m512 t16 = _mm512_set1_ps(t[k]), e16 = _mm512_set1_ps(ext[k]), r16 = _mm512_set1_ps(inv[k]), ref16 = _mm512_set1_ps(ref);
+                for (; i + 16 <= end; i += 16) {
+                    const __m512 d = _mm512_sub_ps(_mm512_add_ps(_mm512_loadu_ps(p + i), t16), ref16);
+                    _mm512_storeu_ps(p + i, _mm512_add_ps(ref16, _mm512_fnmadd_ps(e16, _mm512_roundscale_ps(_mm512_mul_ps(d, r16), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), d)));
+                }
+            }
+#endif
+#if defined(__AVX2__)
+            {
+                const __m256 t8 = _mm256_set1_ps(t[k]), e8 = _mm256_set1_ps(ext[k]), r8 = _mm256_set1_ps(inv[k]), ref8 = _mm256_set1_ps(ref);
+                for (; i + 8 <= end; i += 8) {
+                    const __m256 d = _mm256_sub_ps(_mm256_add_ps(_mm256_loadu_ps(p + i), t8), ref8);
+                    _mm256_storeu_ps(p + i, _mm256_add_ps(ref8, _mm256_fnmadd_ps(e8, _mm256_round_ps(_mm256_mul_ps(d, r8), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC), d)));
+                }
+            }
+#endif
+            for (; i < end; ++i) {
+                const float d = p[i] + t[k] - ref;
+                p[i] = ref + (d - ext[k] * nearbyintf(d * inv[k]));
+            }
+        }
+    }
+}
+
+static uint64_t compute_frame_tag(const LoadedTrajectory* loaded_traj) {
+    const uint8_t deperiodize = loaded_traj->deperiodize ? 1 : 0;
+    uint64_t hash = hash_bytes(&deperiodize, sizeof(deperiodize));
+    if (loaded_traj->deperiodize) {
+        // Deperiodized frames are made whole per structure, either through the spans or (if the structures are not contiguous) by md_util_deperiodize_system
+        const md_molecule_t* mol = loaded_traj->mol;
+        const int64_t num_structures = md_index_data_count(mol->structures);
+        for (int64_t i = 0; i < num_structures; ++i) {
+            const int64_t size = md_index_range_size(mol->structures, i);
+            hash = hash_bytes(&size, sizeof(size), hash);
+            hash = hash_bytes(md_index_range_beg(mol->structures, i), size * (int64_t)sizeof(int32_t), hash);
+        }
+    }
+    hash = hash_bytes(loaded_traj->pbc_spans, md_array_size(loaded_traj->pbc_spans) * (int64_t)sizeof(PbcSpan), hash);
+    hash = hash_bytes(loaded_traj->subset, md_array_size(loaded_traj->subset) * (int64_t)sizeof(int32_t), hash);
+    return hash_bytes(loaded_traj->recenter_indices, md_array_size(loaded_traj->recenter_indices) * (int64_t)sizeof(int32_t), hash);
+}
+
+// Shared state of the parallel post-decode passes, which operate on disjoint ranges of the coordinates
+struct PostDecodeJob {
+    float* x;
+    float* y;
+    float* z;
+    const float* src_x;
+    const float* src_y;
+    const float* src_z;
+    const float* mass;
+    const int32_t* indices;
+    const PbcSpan* spans;
+    const int32_t* chunks;
+    vec3_t trans;
+    vec3_t box_ext;
+};
+
+static void pbc_chunk_job(uint32_t range_beg, uint32_t range_end, void* user_data) {
+    const PostDecodeJob* job = (const PostDecodeJob*)user_data;
+    const int32_t beg = job->chunks[range_beg];
+    const int32_t end = job->chunks[range_end];
+    apply_pbc_spans(job->x, job->y, job->z, job->mass, job->spans + beg, end - beg, job->trans, job->box_ext);
+}
+
+static void translate_job(uint32_t range_beg, uint32_t range_end, void* user_data) {
+    const PostDecodeJob* job = (const PostDecodeJob*)user_data;
+    vec3_batch_translate_inplace(job->x + range_beg, job->y + range_beg, job->z + range_beg, range_end - range_beg, job->trans);
+}
+
+static void gather_job(uint32_t range_beg, uint32_t range_end, void* user_data) {
+    const PostDecodeJob* job = (const PostDecodeJob*)user_data;
+    for (uint32_t i = range_beg; i < range_end; ++i) {
+        const int32_t src = job->indices[i];
+        job->x[i] = job->src_x[src];
+        job->y[i] = job->src_y[src];
+        job->z[i] = job->src_z[src];
+    }
+}
+
+static void copy_job(uint32_t range_beg, uint32_t range_end, void* user_data) {
+    const PostDecodeJob* job = (const PostDecodeJob*)user_data;
+    const size_t size = sizeof(float) * (range_end - range_beg);
+    if (job->x) MEMCPY(job->x + range_beg, job->src_x + range_beg, size);
+    if (job->y) MEMCPY(job->y + range_beg, job->src_y + range_beg, size);
+    if (job->z) MEMCPY(job->z + range_beg, job->src_z + range_beg, size);
+}
+
+// Stage 1: Fetch the raw frame bytes (I/O bound) into a pooled buffer
+static bool fetch_stage(LoadedTrajectory* loaded_traj, int64_t idx, RawBuffer* buf) {
+    const md_timestamp_t t0 = md_time_current();
+    const int64_t size = md_trajectory_fetch_frame_data(loaded_traj->traj, idx, 0);
+    if (size <= 0) return false;
+
+    raw_buffer_acquire(loaded_traj->pipeline, buf, size);
+    buf->size = md_trajectory_fetch_frame_data(loaded_traj->traj, idx, buf->ptr);
+
+    Telemetry* tm = loaded_traj->telemetry;
+    tm->fetch_ticks += (uint64_t)(md_time_current() - t0);
+    if (buf->size > 0) {
+        tm->fetched++;
+        tm->bytes_read += (uint64_t)buf->size;
+    }
+    return buf->size > 0;
+}
+
+// Stage 2: Decode the raw bytes into the reserved frame and apply recenter and PBC (CPU bound)
+// If parallel is set, the translation and the fused PBC pass are split over the thread-pool (the decode itself and the generic deperiodization remain serial)
+static bool decode_stage(LoadedTrajectory* loaded_traj, const RawBuffer* buf, md_frame_data_t* frame_data, bool parallel = false) {
+    Telemetry* tm = loaded_traj->telemetry;
+    md_timestamp_t t0 = md_time_current();
+    bool decoded;
+    if (loaded_traj->subset) {
+        // The frame is decoded in full into a pooled scratch buffer, only the subset is gathered into the (smaller) cached frame
+        const int64_t num_source = loaded_traj->num_source_atoms;
+        RawBuffer scratch = {};
+        raw_buffer_acquire(loaded_traj->pipeline, &scratch, num_source * 3 * (int64_t)sizeof(float));
+        PostDecodeJob job = {};
+        job.src_x = (const float*)scratch.ptr;
+        job.src_y = job.src_x + num_source;
+        job.src_z = job.src_y + num_source;
+        decoded = md_trajectory_decode_frame_data(loaded_traj->traj, buf->ptr, buf->size, &frame_data->header, (float*)job.src_x, (float*)job.src_y, (float*)job.src_z);
+        if (decoded) {
+            const int64_t count = md_array_size(loaded_traj->subset);
+            job.x = frame_data->x;
+            job.y = frame_data->y;
+            job.z = frame_data->z;
+            job.indices = loaded_traj->subset;
+            if (parallel && num_source >= PARALLEL_MIN_ATOMS) {
+                task_system::pool_parallel_for(0, (uint32_t)count, PARALLEL_GRAIN_ATOMS, gather_job, &job);
+            } else {
+                gather_job(0, (uint32_t)count, &job);
+            }
+            frame_data->header.num_atoms = count;
+        }
+        raw_buffer_release(loaded_traj->pipeline, &scratch);
+    } else {
+        decoded = md_trajectory_decode_frame_data(loaded_traj->traj, buf->ptr, buf->size, &frame_data->header, frame_data->x, frame_data->y, frame_data->z);
+    }
+    md_timestamp_t t1 = md_time_current();
+    tm->decode_ticks += (uint64_t)(t1 - t0);
+    if (!decoded) {
+        return false;
+    }
+
+    const md_unit_cell_t* cell = &frame_data->header.unit_cell;
+    const bool have_cell = cell->flags != 0;
+
+    const md_molecule_t* mol = loaded_traj->mol;
+    float* x = frame_data->x;
+    float* y = frame_data->y;
+    float* z = frame_data->z;
+    const int64_t num_atoms = frame_data->header.num_atoms;
+
+    const bool deperiodize = loaded_traj->deperiodize && have_cell;
+    const vec3_t box_ext = have_cell ? mat3_mul_vec3(cell->basis, vec3_set1(1.0f)) : vec3_set1(0.0f);
+
+    // Orthorhombic cells with contiguous structures are translated and deperiodized in one fused sweep over the coordinates
+    const bool fused = deperiodize && loaded_traj->pbc_spans && cell_is_orthorhombic(cell);
+    parallel = parallel && num_atoms >= PARALLEL_MIN_ATOMS;
+
+    PostDecodeJob job = {};
+    job.x = x;
+    job.y = y;
+    job.z = z;
+    job.mass = mol->atom.mass;
+    job.spans = loaded_traj->pbc_spans;
+    job.chunks = loaded_traj->pbc_chunks;
+    job.box_ext = box_ext;
+
+    // If we have a recenter target, then compute the com and apply that transformation
+    const int64_t count = md_array_size(loaded_traj->recenter_indices);
+    vec3_t trans = vec3_set1(0.0f);
+    if (count > 0) {
+        vec3_t com = compute_com_indexed(x, y, z, mol->atom.mass, loaded_traj->recenter_indices, count, box_ext);
+        if (have_cell) {
+            com = vec3_deperiodize(com, box_ext * 0.5f, box_ext);
+        }
+        trans = have_cell ? box_ext * 0.5f - com : -com;
+        job.trans = trans;
+
+        if (!fused) {
+            if (parallel) {
+                task_system::pool_parallel_for(0, (uint32_t)num_atoms, PARALLEL_GRAIN_ATOMS, translate_job, &job);
+            } else {
+                vec3_batch_translate_inplace(x, y, z, num_atoms, trans);
+            }
+        }
+
+        t0 = t1;
+        t1 = md_time_current();
+        tm->recenter_ticks += (uint64_t)(t1 - t0);
+    }
+
+    if (fused && parallel) {
+        task_system::pool_parallel_for(0, (uint32_t)(md_array_size(loaded_traj->pbc_chunks) - 1), 1, pbc_chunk_job, &job);
+    } else if (fused) {
+        apply_pbc_spans(x, y, z, mol->atom.mass, loaded_traj->pbc_spans, md_array_size(loaded_traj->pbc_spans), trans, box_ext);
+    } else if (deperiodize) {
+        md_util_deperiodize_system(x, y, z, mol->atom.mass, mol->atom.count, cell, &mol->structures);
+    }
+    if (deperiodize) {
+        tm->deperiodize_ticks += (uint64_t)(md_time_current() - t1);
+    }
+
+    return true;
+}
+
+// Alternatives to stage 1 + 2 when the frame is resident in the compressed or disk level of the cache, which already hold the processed coordinates
+static bool unpack_stage(LoadedTrajectory* loaded_traj, CompressedFrame* packed, md_frame_data_t* frame_data) {
+    const md_timestamp_t t0 = md_time_current();
+    const bool result = frame_codec_decode(frame_data->x, frame_data->y, frame_data->z, packed->header.num_atoms, packed + 1, packed->size);
+    if (result) {
+        frame_data->header = packed->header;
+        loaded_traj->telemetry->compressed_hits++;
+    }
+    compressed_cache_release(loaded_traj->compressed, packed);
+    loaded_traj->telemetry->unpack_ticks += (uint64_t)(md_time_current() - t0);
+    return result;
+}
+
+static inline bool disk_read_stage(LoadedTrajectory* loaded_traj, int64_t idx, md_frame_data_t* frame_data) {
+    if (!loaded_traj->disk) return false;
+    const md_timestamp_t t0 = md_time_current();
+    const bool result = disk_cache_read(loaded_traj->disk, idx, loaded_traj->frame_tag, &frame_data->header, frame_data->x, frame_data->y, frame_data->z);
+    if (result) {
+        loaded_traj->telemetry->disk_hits++;
+    }
+    loaded_traj->telemetry->disk_read_ticks += (uint64_t)(md_time_current() - t0);
+    return result;
+}
+
+// Stage 3 (insertion) is completed when the reservation lock of the frame is released, which publishes the frame in the cache.
+// Freshly decoded frames are also inserted into the compressed and disk levels if these are enabled, and their cell is recorded in the index.
+static inline void store_stage(LoadedTrajectory* loaded_traj, int64_t idx, const md_frame_data_t* frame_data) {
+    if (loaded_traj->compressed) {
+        compressed_cache_insert(loaded_traj->compressed, idx, frame_data);
+    }
+    disk_cache_write(loaded_traj->disk, idx, loaded_traj->frame_tag, &frame_data->header, frame_data->x, frame_data->y, frame_data->z);
+    if (loaded_traj->indexed) {
+        traj_index_record_cell(loaded_traj->traj, idx, &frame_data->header.unit_cell);
+    }
+}
+
+// The summary of a frame is computed the first time it passes through the pipeline with the current processing (frames which are served from the caches
+// already have one). It is a single pass over the coordinates, which are still in cache after the decode.
+// The summary tag is cleared while the summary is written and set after, readers validate their copy against it (see get_frame_summary).
+static void summarize_stage(LoadedTrajectory* loaded_traj, int64_t idx, const md_frame_data_t* frame_data) {
+    const uint64_t tag = loaded_traj->frame_tag | 1;    // 0 denotes a missing summary
+    std::atomic_uint64_t& summary_tag = loaded_traj->summary_tags[idx];
+    if (summary_tag.load(std::memory_order_acquire) == tag) return;
+
+    const md_molecule_t* mol = loaded_traj->mol;
+    const int64_t num_atoms = frame_data->header.num_atoms;
+    const float* x = frame_data->x;
+    const float* y = frame_data->y;
+    const float* z = frame_data->z;
+    const float* r = mol->atom.radius;
+    const float* m = mol->atom.mass;
+
+    vec3_t aabb_min = { FLT_MAX,  FLT_MAX,  FLT_MAX};
+    vec3_t aabb_max = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    double sum_m = 0, sum_x = 0, sum_y = 0, sum_z = 0, sum_r2 = 0;
+    for (int64_t i = 0; i < num_atoms; ++i) {
+        const float rad = r ? r[i] : 0.0f;
+        aabb_min.x = MIN(aabb_min.x, x[i] - rad);
+        aabb_min.y = MIN(aabb_min.y, y[i] - rad);
+        aabb_min.z = MIN(aabb_min.z, z[i] - rad);
+        aabb_max.x = MAX(aabb_max.x, x[i] + rad);
+        aabb_max.y = MAX(aabb_max.y, y[i] + rad);
+        aabb_max.z = MAX(aabb_max.z, z[i] + rad);
+        const double w = m ? m[i] : 1.0;
+        sum_m  += w;
+        sum_x  += w * x[i];
+        sum_y  += w * y[i];
+        sum_z  += w * z[i];
+        sum_r2 += w * ((double)x[i] * x[i] + (double)y[i] * y[i] + (double)z[i] * z[i]);
+    }
+
+    summary_tag.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    load::traj::frame_summary_t* summary = &loaded_traj->summaries[idx];
+    if (num_atoms > 0 && sum_m > 0) {
+        const double cx = sum_x / sum_m, cy = sum_y / sum_m, cz = sum_z / sum_m;
+        summary->aabb_min = aabb_min;
+        summary->aabb_max = aabb_max;
+        summary->com = {(float)cx, (float)cy, (float)cz};
+        summary->radius_of_gyration = (float)sqrt(MAX(0.0, sum_r2 / sum_m - (cx * cx + cy * cy + cz * cz)));
+    } else {
+        summary->aabb_min = summary->aabb_max = summary->com = {0, 0, 0};
+        summary->radius_of_gyration = 0;
+    }
+    summary->unit_cell = frame_data->header.unit_cell;
+
+    vec3_t* chain_com = loaded_traj->chain_coms + idx * loaded_traj->num_chains;
+    for (int64_t c = 0; c < loaded_traj->num_chains; ++c) {
+        const md_range_t range = mol->chain.atom_range[c];
+        double cm = 0, cx = 0, cy = 0, cz = 0;
+        for (int32_t i = range.beg; i < range.end; ++i) {
+            const double w = m ? m[i] : 1.0;
+            cm += w;
+            cx += w * x[i];
+            cy += w * y[i];
+            cz += w * z[i];
+        }
+        chain_com[c] = cm > 0 ? vec3_t{(float)(cx / cm), (float)(cy / cm), (float)(cz / cm)} : vec3_t{0, 0, 0};
+    }
+
+    summary_tag.store(tag, std::memory_order_release);
+}
+
+// Maps a frame index of the view to the frame of the underlying trajectory
+static inline int64_t view_to_source(const LoadedTrajectory* loaded_traj, int64_t idx) {
+    return loaded_traj->view_beg + idx * loaded_traj->view_stride;
+}
+
+// Loads a frame (index within the view) through the cache, prefetch denotes if the request originates from the prefetcher or is an on demand load
+static bool load_frame_internal(LoadedTrajectory* loaded_traj, int64_t view_idx, md_trajectory_frame_header_t* header, float* out_x, float* out_y, float* out_z, bool prefetch) {
+    ASSERT(loaded_traj);
+    ASSERT(0 <= view_idx && view_idx < loaded_traj->view_count);
+    const int64_t idx = view_to_source(loaded_traj, view_idx);
+
+    md_frame_data_t* frame_data;
+    frame_cache_slot_t* slot;
+    bool result = true;
+
+    cache_enter(loaded_traj->pipeline);
+    defer { cache_leave(loaded_traj->pipeline); };
+
+    bool in_cache = frame_cache_find_or_reserve(loaded_traj->cache, idx, &frame_data, &slot);
+
+    PrefetchState* pf = loaded_traj->prefetch;
+    if (prefetch) {
+        if (!in_cache) pf->prefetched++;
+    } else {
+        // Frames within the interpolation support of the playhead are what playback depends on
+        const int64_t playhead = pf->playhead;
+        const bool at_playhead = playhead - 1 <= view_idx && view_idx <= playhead + 2;
+        if (in_cache) {
+            if (at_playhead) pf->hits++;
+        } else {
+            if (at_playhead) pf->stalls++;
+            else pf->misses++;
+        }
+    }
+
+    if (!in_cache) {
+        CompressedFrame* packed = compressed_cache_acquire(loaded_traj->compressed, idx);
+        if (packed) {
+            result = unpack_stage(loaded_traj, packed, frame_data);
+        } else if (!disk_read_stage(loaded_traj, idx, frame_data)) {
+            RawBuffer buf = {};
+            result = fetch_stage(loaded_traj, idx, &buf) && decode_stage(loaded_traj, &buf, frame_data, !prefetch);
+            raw_buffer_release(loaded_traj->pipeline, &buf);
+            if (result) store_stage(loaded_traj, idx, frame_data);
+        }
+        if (result) summarize_stage(loaded_traj, idx, frame_data);
+    }
+
+    if (result) {
+        const int64_t num_atoms = frame_data->header.num_atoms;
+        if (header) {
+            *header = frame_data->header;
+            header->index = view_idx;
+        }
+        if (!prefetch && num_atoms >= PARALLEL_MIN_ATOMS) {
+            PostDecodeJob job = {};
+            job.x = out_x;
+            job.y = out_y;
+            job.z = out_z;
+            job.src_x = frame_data->x;
+            job.src_y = frame_data->y;
+            job.src_z = frame_data->z;
+            task_system::pool_parallel_for(0, (uint32_t)num_atoms, PARALLEL_GRAIN_ATOMS, copy_job, &job);
+        } else {
+            if (out_x) MEMCPY(out_x, frame_data->x, sizeof(float) * num_atoms);
+            if (out_y) MEMCPY(out_y, frame_data->y, sizeof(float) * num_atoms);
+            if (out_z) MEMCPY(out_z, frame_data->z, sizeof(float) * num_atoms);
+        }
+    }
+
+    frame_cache_release(loaded_traj->cache, slot, result);
+
+    return result;
+}
+
+bool decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, [[maybe_unused]] int64_t data_size, md_trajectory_frame_header_t* header, float* out_x, float* out_y, float* out_z) {
+    ASSERT(data_size == sizeof(int64_t));
+    int64_t idx = *((int64_t*)data_ptr);
+    return load_frame_internal((LoadedTrajectory*)inst, idx, header, out_x, out_y, out_z, false);
+}
+
+bool load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    void* frame_data = &idx;
+    return decode_frame_data(inst, frame_data, sizeof(int64_t), header, x, y, z);
+}
+
+// (Re)initializes the frame cache for the given budget, the cache must be free (or not yet initialized)
+static void configure_cache(LoadedTrajectory* inst, uint64_t budget) {
+    const int64_t  num_traj_frames      = md_trajectory_num_frames(inst->traj);
+    const uint64_t approx_frame_size    = (uint64_t)inst->mol->atom.count * 3 * sizeof(float);
+    const int64_t  max_num_cache_frames = (int64_t)(budget / approx_frame_size);
+
+    int64_t num_cache_frames  = MIN(num_traj_frames, max_num_cache_frames);
+    int64_t compressed_budget = 0;
+
+    if (inst->compressed && num_cache_frames < num_traj_frames) {
+        // Only a small part of the budget is kept as decoded frames, for playback and prefetching around the playhead.
+        // The rest holds the compressed frames, which are several times smaller.
+        const int64_t min_hot_frames = MIN(PREFETCH_MIN_FRAMES * 2, max_num_cache_frames);
+        num_cache_frames  = MIN(num_traj_frames, MAX((int64_t)(budget / 8 / approx_frame_size), min_hot_frames));
+        compressed_budget = (int64_t)budget - num_cache_frames * (int64_t)approx_frame_size;
+        MD_LOG_DEBUG("Compressed frame cache budget: %.1f MB.", (double)compressed_budget / MEGABYTES(1));
+    }
+    if (inst->compressed) {
+        compressed_cache_set_budget(inst->compressed, compressed_budget);
+    }
+
+    // Always keep a few frames, even if they exceed the budget
+    num_cache_frames = MAX(num_cache_frames, MIN(4, num_traj_frames));
+
+    MD_LOG_DEBUG("Initializing frame cache with %i frames.", (int)num_cache_frames);
+    inst->cache = frame_cache_create(num_cache_frames, num_traj_frames, inst->mol->atom.count, inst->cache_policy, inst->alloc);
+    inst->cache_limit = budget;
+}
+
+// Rebuilds the frame cache with a new budget, this discards all decoded frames
+static void rebuild_cache(LoadedTrajectory* loaded_traj, uint64_t budget) {
+    PrefetchState* pf = loaded_traj->prefetch;
+    task_system::task_interrupt_and_wait_for(pf->task);
+
+    cache_close_gate(loaded_traj->pipeline);
+    frame_cache_stats_t stats[FRAME_CACHE_POLICY_COUNT];
+    frame_cache_get_stats(loaded_traj->cache, stats);
+    for (int i = 0; i < FRAME_CACHE_POLICY_COUNT; ++i) {
+        loaded_traj->cache_stats[i].hits      += stats[i].hits;
+        loaded_traj->cache_stats[i].misses    += stats[i].misses;
+        loaded_traj->cache_stats[i].evictions += stats[i].evictions;
+    }
+    uint64_t lock_waits;
+    double lock_wait_time;
+    frame_cache_get_contention(loaded_traj->cache, &lock_waits, &lock_wait_time);
+    loaded_traj->telemetry->retired_lock_waits += lock_waits;
+    loaded_traj->telemetry->retired_lock_wait_time += lock_wait_time;
+    frame_cache_destroy(loaded_traj->cache);
+    configure_cache(loaded_traj, budget);
+    cache_open_gate(loaded_traj->pipeline);
+
+    pf->window_beg = pf->window_end = 0;
+}
+
+// Share of the progress of open_file which is attributed to reading the trajectory file(s), the remainder is the setup of the caches
+#define OPEN_PROGRESS_READ 0.9f
+
+static bool multi_traj_open_progress(float fraction, void* user_data) {
+    open_progress_t* progress = (open_progress_t*)user_data;
+    progress->fraction = fraction * OPEN_PROGRESS_READ;
+    return !progress->interrupt;
+}
+
+md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, bool deperiodize_on_load, float cache_precision, const int32_t* atom_subset, int64_t atom_subset_count, open_progress_t* progress) {
+    ASSERT(mol);
+    ASSERT(alloc);
+
+    if (!loader) {
+        loader = get_loader_from_ext(extract_ext(filename));
+    }
+    if (!loader) {
+        MD_LOG_ERROR("Unsupported file extension: '%.*s'", filename.len, filename.ptr);
+        return NULL;
+    }
+
+    md_trajectory_i* internal_traj = NULL;
+    bool indexed = false;
+    bool multi = false;
+
+    // A file name with wildcards denotes a trajectory which is split over multiple files (segments or replicas), which are concatenated in natural order
+    md_array(str_t) files = 0;
+    defer {
+        for (int64_t i = 0; i < md_array_size(files); ++i) str_free(files[i], md_heap_allocator);
+        md_array_free(files, md_heap_allocator);
+    };
+    if (multi_traj_is_pattern(filename)) {
+        files = multi_traj_expand_pattern(filename, md_heap_allocator);
+        if (md_array_size(files) == 0) {
+            MD_LOG_ERROR("No trajectory files match '%.*s'", (int)filename.len, filename.ptr);
+            return NULL;
+        }
+        if (md_array_size(files) == 1) {
+            filename = files[0];
+        } else {
+            internal_traj = multi_traj_open(files, md_array_size(files), loader, alloc, progress ? multi_traj_open_progress : NULL, progress);
+            if (!internal_traj) {
+                return NULL;
+            }
+            multi = true;
+        }
+    }
+
+    if (!multi) {
+        // Skip the scan of the file if there is a valid index, otherwise write one for the next time
+        internal_traj = traj_index_open(filename, loader, alloc);
+        indexed = internal_traj != NULL;
+        if (!indexed) {
+            internal_traj = loader->create(filename, alloc);
+            if (!internal_traj) {
+                return NULL;
+            }
+            traj_index_write(filename, internal_traj);
+        }
+    }
+
+    if (progress) {
+        progress->fraction = OPEN_PROGRESS_READ;
+        if (progress->interrupt) {
+            MD_LOG_INFO("Opening of trajectory was aborted");
+            close_internal_traj(internal_traj, loader, indexed, multi);
+            return NULL;
+        }
+    }
+    
+    const int64_t num_source_atoms = md_trajectory_num_atoms(internal_traj);
+    const bool compatible = atom_subset ?
+        (atom_subset_count == mol->atom.count && atom_subset_count > 0 && atom_subset[atom_subset_count - 1] < num_source_atoms) :
+        (num_source_atoms == mol->atom.count);
+    if (!compatible) {
+        MD_LOG_ERROR("Trajectory is not compatible with the loaded molecule.");
+        close_internal_traj(internal_traj, loader, indexed, multi);
+        return NULL;
+    }
+
+    md_trajectory_i* traj = (md_trajectory_i*)md_alloc(alloc, sizeof(md_trajectory_i));
+    memset(traj, 0, sizeof(md_trajectory_i));
+
+    LoadedTrajectory* inst = alloc_loaded_trajectory((uint64_t)traj);
+    inst->mol = mol;
+    inst->loader = loader;
+    inst->traj = internal_traj;
+    inst->indexed = indexed;
+    inst->multi = multi;
+    inst->cache = 0;
+    inst->recenter_target = {0};
+    inst->recenter_indices = 0;
+    inst->compressed = 0;
+    inst->disk = 0;
+    inst->alloc = alloc;
+    inst->deperiodize = deperiodize_on_load;
+    inst->num_source_atoms = num_source_atoms;
+    inst->subset = 0;
+    if (atom_subset) {
+        md_array_resize(inst->subset, atom_subset_count, alloc);
+        MEMCPY(inst->subset, atom_subset, atom_subset_count * sizeof(int32_t));
+    }
+    inst->prefetch = (PrefetchState*)md_alloc(alloc, sizeof(PrefetchState));
+    MEMSET(inst->prefetch, 0, sizeof(PrefetchState));
+    inst->telemetry = (Telemetry*)md_alloc(alloc, sizeof(Telemetry));
+    MEMSET(inst->telemetry, 0, sizeof(Telemetry));
+    inst->pipeline = (FramePipeline*)md_alloc(alloc, sizeof(FramePipeline));
+    init_pipeline(inst->pipeline);
+    
+    const int64_t num_traj_frames = md_trajectory_num_frames(internal_traj);
+    inst->num_summaries = num_traj_frames;
+    inst->num_chains = mol->chain.atom_range ? mol->chain.count : 0;
+    inst->summaries = (load::traj::frame_summary_t*)md_alloc(alloc, num_traj_frames * sizeof(load::traj::frame_summary_t));
+    inst->summary_tags = (std::atomic_uint64_t*)md_alloc(alloc, num_traj_frames * sizeof(std::atomic_uint64_t));
+    MEMSET(inst->summary_tags, 0, num_traj_frames * sizeof(std::atomic_uint64_t));
+    inst->chain_coms = inst->num_chains > 0 ? (vec3_t*)md_alloc(alloc, num_traj_frames * inst->num_chains * sizeof(vec3_t)) : 0;
+
+    if (cache_precision > 0) {
+        inst->compressed = (CompressedCache*)md_alloc(alloc, sizeof(CompressedCache));
+        compressed_cache_init(inst->compressed, num_traj_frames, 0, cache_precision, alloc);
+    }
+
+    inst->view_beg = 0;
+    inst->view_end = num_traj_frames;
+    inst->view_stride = 1;
+    inst->view_count = num_traj_frames;
+    inst->view_times = 0;
+    {
+        md_trajectory_header_t header;
+        md_trajectory_get_header(internal_traj, &header);
+        md_array_resize(inst->view_times, num_traj_frames, alloc);
+        MEMCPY(inst->view_times, header.frame_times, num_traj_frames * sizeof(double));
+    }
+
+    inst->pbc_spans = 0;
+    inst->pbc_chunks = 0;
+    update_pbc_spans(inst);
+
+    inst->cache_policy = FRAME_CACHE_POLICY_ARC;
+    inst->pin_playhead = true;
+    inst->cache_budget = CLAMP(MEGABYTES((uint64_t)VIAMD_FRAME_CACHE_SIZE), CACHE_BUDGET_MIN, CACHE_BUDGET_MAX);
+    configure_cache(inst, inst->cache_budget);
+
+    // The disk cache is keyed on the stat of a single file, which a multi file trajectory does not have
+    if (!multi) {
+        const uint64_t subset_hash = inst->subset ? hash_bytes(inst->subset, md_array_size(inst->subset) * (int64_t)sizeof(int32_t)) : 0;
+        inst->disk = disk_cache_open(filename, subset_hash, num_traj_frames, mol->atom.count, MEGABYTES((int64_t)VIAMD_DISK_CACHE_SIZE), MEGABYTES((int64_t)VIAMD_DISK_CACHE_TOTAL_SIZE));
+    }
+    inst->frame_tag = compute_frame_tag(inst);
+    md_bitfield_init(&inst->recenter_target, alloc);
+
+    // We only overload load frame and decode frame data to apply PBC upon loading data
+    traj->inst = (md_trajectory_o*)inst;
+    traj->get_header = get_header;
+    traj->load_frame = load_frame;
+    traj->fetch_frame_data = fetch_frame_data;
+    traj->decode_frame_data = decode_frame_data;
+
+    if (progress) {
+        progress->fraction = 1.0f;
+    }
+    return traj;
+}
+
+bool peek_first_frame(str_t filename, md_trajectory_loader_i* loader, int64_t num_atoms, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    if (!loader) {
+        loader = get_loader_from_ext(extract_ext(filename));
+    }
+    if (!loader) return false;
+
+    md_array(str_t) files = 0;
+    defer {
+        for (int64_t i = 0; i < md_array_size(files); ++i) str_free(files[i], md_heap_allocator);
+        md_array_free(files, md_heap_allocator);
+    };
+    if (multi_traj_is_pattern(filename)) {
+        files = multi_traj_expand_pattern(filename, md_heap_allocator);
+        if (md_array_size(files) == 0) return false;
+        filename = files[0];
+    }
+
+    // With a valid index the trajectory is opened without a scan, so there is nothing to gain
+    md_trajectory_header_t traj_header;
+    md_array(double) times = 0;
+    defer { md_array_free(times, md_heap_allocator); };
+    if (traj_index_read_header(filename, &traj_header, &times, md_heap_allocator)) {
+        return false;
+    }
+
+    return traj_index_peek_first_frame(filename, loader, num_atoms, header, x, y, z);
+}
+
+bool close(md_trajectory_i* traj) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        remove_loaded_trajectory(loaded_traj->key);
+        memset(traj, 0, sizeof(md_trajectory_i));
+        return true;
+    }
+    MD_LOG_ERROR("Attempting to free trajectory which was not loaded with loader");
+    ASSERT(false);
+    return false;
+}
+
+bool set_recenter_target(md_trajectory_i* traj, const md_bitfield_t* atom_mask) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        // Running jobs may be decoding frames with the previous target
+        PrefetchState* pf = loaded_traj->prefetch;
+        task_system::task_interrupt_and_wait_for(pf->task);
+        interrupt_streams(loaded_traj->pipeline);
+
+        // The indices are read by every decode (also of load_frame from other tasks), so they are only replaced while no one is within the pipeline
+        cache_close_gate(loaded_traj->pipeline);
+        if (atom_mask) {
+            md_bitfield_copy(&loaded_traj->recenter_target, atom_mask);
+        }
+        else {
+            md_bitfield_clear(&loaded_traj->recenter_target);
+        }
+
+        // Extract the indices once here, rather than for every decoded frame
+        const int64_t count = md_bitfield_popcount(&loaded_traj->recenter_target);
+        md_array_resize(loaded_traj->recenter_indices, count, loaded_traj->alloc);
+        if (count > 0) {
+            const int64_t num_indices = md_bitfield_extract_indices(loaded_traj->recenter_indices, count, &loaded_traj->recenter_target);
+            ASSERT(num_indices == count);
+        }
+        // Frames on disk which were recentered with another target are no longer valid
+        loaded_traj->frame_tag = compute_frame_tag(loaded_traj);
+
+        // Cached frames were recentered with the previous target
+        frame_cache_clear(loaded_traj->cache);
+        if (loaded_traj->compressed) {
+            compressed_cache_clear(loaded_traj->compressed);
+        }
+        cache_open_gate(loaded_traj->pipeline);
+
+        pf->window_beg = pf->window_end = 0;
+        return true;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+    return false;
+}
+
+bool set_deperiodize(md_trajectory_i* traj, bool deperiodize) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+    if (loaded_traj->deperiodize == deperiodize) {
+        return true;
+    }
+
+    // Running jobs may be decoding frames with the previous state
+    task_system::task_interrupt_and_wait_for(loaded_traj->prefetch->task);
+    interrupt_streams(loaded_traj->pipeline);
+    loaded_traj->deperiodize = deperiodize;
+    loaded_traj->frame_tag = compute_frame_tag(loaded_traj);
+
+    // Cached frames hold the previous state
+    return clear_cache(traj);
+}
+
+bool update_structures(md_trajectory_i* traj) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+
+    PrefetchState* pf = loaded_traj->prefetch;
+    task_system::task_interrupt_and_wait_for(pf->task);
+    interrupt_streams(loaded_traj->pipeline);
+
+    // The spans are read by every decode (also of load_frame from other tasks), so they are only replaced while no one is within the pipeline
+    cache_close_gate(loaded_traj->pipeline);
+    update_pbc_spans(loaded_traj);
+    loaded_traj->frame_tag = compute_frame_tag(loaded_traj);
+
+    // Deperiodized frames were made whole with respect to the previous structures
+    if (loaded_traj->deperiodize) {
+        frame_cache_clear(loaded_traj->cache);
+        if (loaded_traj->compressed) {
+            compressed_cache_clear(loaded_traj->compressed);
+        }
+        disk_cache_clear(loaded_traj->disk);
+        pf->window_beg = pf->window_end = 0;
+    }
+    cache_open_gate(loaded_traj->pipeline);
+    return true;
+}
+
+bool clear_cache(md_trajectory_i* traj) {
     ASSERT(traj);
 
     LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
     if (loaded_traj) {
-        md_frame_cache_clear(&loaded_traj->cache);
+        PrefetchState* pf = loaded_traj->prefetch;
+        task_system::task_interrupt_and_wait_for(pf->task);
+        cache_close_gate(loaded_traj->pipeline);
+        frame_cache_clear(loaded_traj->cache);
+        cache_open_gate(loaded_traj->pipeline);
+        if (loaded_traj->compressed) {
+            compressed_cache_clear(loaded_traj->compressed);
+        }
+        // Invalidate the window so it is refilled upon next update
+        pf->window_beg = pf->window_end = 0;
         return true;
     }
     MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
     return false;
 }
 
+int64_t num_summary_chains(md_trajectory_i* traj) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        return loaded_traj->num_chains;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+    return 0;
+}
+
+bool get_frame_summary(md_trajectory_i* traj, int64_t frame_idx, frame_summary_t* summary, vec3_t* chain_com) {
+    ASSERT(traj);
+    ASSERT(summary);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+    if (frame_idx < 0 || loaded_traj->view_count <= frame_idx) {
+        return false;
+    }
+
+    const int64_t idx = view_to_source(loaded_traj, frame_idx);
+    const uint64_t tag = loaded_traj->frame_tag | 1;
+    const std::atomic_uint64_t& summary_tag = loaded_traj->summary_tags[idx];
+    if (summary_tag.load(std::memory_order_acquire) != tag) {
+        return false;
+    }
+
+    *summary = loaded_traj->summaries[idx];
+    if (chain_com && loaded_traj->num_chains > 0) {
+        MEMCPY(chain_com, loaded_traj->chain_coms + idx * loaded_traj->num_chains, loaded_traj->num_chains * sizeof(vec3_t));
+    }
+
+    // The summary may have been rewritten while it was copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return summary_tag.load(std::memory_order_relaxed) == tag;
+}
+
 int64_t num_cache_frames(md_trajectory_i* traj) {
     ASSERT(traj);
 
     LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
     if (loaded_traj) {
-        return md_frame_cache_num_frames(&loaded_traj->cache);
+        return frame_cache_num_slots(loaded_traj->cache);
     }
     MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
     return 0;
 }
 
+static void prefetch_job(uint32_t range_beg, uint32_t range_end, void* user_data) {
+    LoadedTrajectory* loaded_traj = (LoadedTrajectory*)user_data;
+    const PrefetchState* pf = loaded_traj->prefetch;
+    for (uint32_t i = range_beg; i < range_end; ++i) {
+        // A jump of the playhead interrupts the job, which should not finish the frames of the previous window
+        if (task_system::current_task_interrupted()) break;
+        // Fetch in the direction of playback, so the frames closest to the playhead are decoded first
+        const int64_t idx = pf->job_reverse ? pf->job_end - 1 - i : pf->job_beg + i;
+        load_frame_internal(loaded_traj, idx, 0, 0, 0, 0, true);
+        task_system::current_task_progress();
+    }
+}
+
+void prefetch_update(md_trajectory_i* traj, double frame, double dt) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return;
+    }
+
+    const int64_t num_frames = loaded_traj->view_count;
+    const int64_t num_cache_frames = frame_cache_num_slots(loaded_traj->cache);
+    if (num_frames == 0 || num_cache_frames == 0) return;
+
+    PrefetchState* pf = loaded_traj->prefetch;
+    const double delta = frame - pf->frame;
+    const int64_t playhead = CLAMP((int64_t)frame, 0, num_frames - 1);
+    pf->frame = frame;
+    pf->playhead = playhead;
+
+    if (loaded_traj->pin_playhead) {
+        // Frames in the immediate surrounding of the playhead are what the user is looking at, these should survive linear passes over the trajectory
+        const int64_t pin_beg = CLAMP(playhead - PREFETCH_MIN_FRAMES / 2, 0, num_frames - 1);
+        const int64_t pin_end = CLAMP(playhead + PREFETCH_MIN_FRAMES / 2 + 3, 1, num_frames);
+        frame_cache_pin(loaded_traj->cache, view_to_source(loaded_traj, pin_beg), view_to_source(loaded_traj, pin_end - 1) + 1);
+    }
+
+    if (fabs(delta) > PREFETCH_JUMP_FRAMES + 2.0 * fabs(pf->delta)) {
+        // Scrub jump (e.g. from the timeline), whatever is currently being fetched is stale
+        pf->velocity = 0;
+        pf->jumps++;
+        task_system::task_interrupt(pf->task);
+        pf->window_beg = pf->window_end = 0;
+    } else if (dt > 0) {
+        pf->velocity = lerp(pf->velocity, delta / dt, PREFETCH_VELOCITY_SMOOTHING);
+    }
+    pf->delta = delta;
+
+    if (task_system::task_is_running(pf->task)) return;
+
+    // Keep at most half of the cache ahead of the playhead, so the frames we just passed are still available when the direction is reversed
+    const int64_t budget = MAX(1, num_cache_frames / 2);
+    const double  speed  = fabs(pf->velocity);
+    const int64_t ahead  = MIN(MAX((int64_t)(speed * PREFETCH_LOOKAHEAD_SECONDS), PREFETCH_MIN_FRAMES), budget);
+
+    int64_t beg, end;
+    bool reverse = false;
+    if (speed < PREFETCH_IDLE_VELOCITY) {
+        beg = playhead - ahead / 2;
+        end = playhead + ahead / 2 + 1;
+    } else if (pf->velocity > 0) {
+        // Include the interpolation support around the playhead
+        beg = playhead - 1;
+        end = playhead + ahead + 3;
+    } else {
+        beg = playhead - ahead - 1;
+        end = playhead + 3;
+        reverse = true;
+    }
+    beg = CLAMP(beg, 0, num_frames);
+    end = CLAMP(end, 0, num_frames);
+    if (beg == end) return;
+
+    // Only refill when the playhead has consumed a significant part of the previous window
+    const int64_t refill = MAX(1, ahead / 4);
+    const bool covered = reverse ?
+        (end <= pf->window_end && beg >= pf->window_beg - refill) :
+        (beg >= pf->window_beg && end <= pf->window_end + refill);
+    if (covered && pf->window_beg != pf->window_end) return;
+
+    pf->window_beg  = beg;
+    pf->window_end  = end;
+    pf->job_beg     = beg;
+    pf->job_end     = end;
+    pf->job_reverse = reverse;
+    pf->task = task_system::pool_enqueue(STR("##Prefetch Frames"), 0, (uint32_t)(end - beg), prefetch_job, loaded_traj, 0, task_system::PRIORITY_INTERACTIVE);
+}
+
+struct FrameStream {
+    LoadedTrajectory* loaded_traj;
+    int64_t   next;    // Next frame (within the view) to fetch, protected by the io_mutex of the pipeline
+    FrameTask func;
+    void*     user_data;
+};
+
+static void stream_job(uint32_t range_beg, uint32_t range_end, void* user_data) {
+    FrameStream* stream = (FrameStream*)user_data;
+    LoadedTrajectory* loaded_traj = stream->loaded_traj;
+    FramePipeline* pipe = loaded_traj->pipeline;
+
+    // The range only determines how many frames this invocation processes.
+    // Frames are claimed in order under the I/O lock, which keeps the reads sequential,
+    // while the frames which have already been fetched are decoded in parallel by the other workers.
+    for (uint32_t i = range_beg; i < range_end; ++i) {
+        if (task_system::current_task_interrupted()) break;
+
+        md_frame_data_t* frame_data = 0;
+        frame_cache_slot_t* slot = 0;
+        CompressedFrame* packed = 0;
+        RawBuffer buf = {};
+        bool on_disk = false;
+        bool result = true;
+
+        cache_enter(pipe);
+
+        md_mutex_lock(&pipe->io_mutex);
+        const int64_t view_idx = stream->next++;
+        const int64_t idx = view_to_source(loaded_traj, view_idx);
+        const bool in_cache = frame_cache_find_or_reserve(loaded_traj->cache, idx, &frame_data, &slot);
+        if (!in_cache) {
+            packed = compressed_cache_acquire(loaded_traj->compressed, idx);
+            on_disk = !packed && disk_cache_contains(loaded_traj->disk, idx, loaded_traj->frame_tag);
+            if (!packed && !on_disk) {
+                result = fetch_stage(loaded_traj, idx, &buf);
+            }
+        }
+        md_mutex_unlock(&pipe->io_mutex);
+
+        if (!in_cache) {
+            loaded_traj->prefetch->misses++;
+            if (packed) {
+                result = unpack_stage(loaded_traj, packed, frame_data);
+            } else if (on_disk && disk_read_stage(loaded_traj, idx, frame_data)) {
+                result = true;
+            } else {
+                if (on_disk) {
+                    // The slot was overwritten after it was checked, fall back to the trajectory
+                    md_mutex_lock(&pipe->io_mutex);
+                    result = fetch_stage(loaded_traj, idx, &buf);
+                    md_mutex_unlock(&pipe->io_mutex);
+                }
+                result = result && decode_stage(loaded_traj, &buf, frame_data);
+                raw_buffer_release(pipe, &buf);
+                if (result) store_stage(loaded_traj, idx, frame_data);
+            }
+            if (result) summarize_stage(loaded_traj, idx, frame_data);
+        }
+
+        if (result && stream->func) {
+            stream->func(view_idx, &frame_data->header, frame_data->x, frame_data->y, frame_data->z, stream->user_data);
+        }
+
+        frame_cache_release(loaded_traj->cache, slot, result);
+
+        cache_leave(pipe);
+        task_system::current_task_progress();
+    }
+}
+
+task_system::ID stream_frames(md_trajectory_i* traj, str_t label, int64_t beg, int64_t end, FrameTask func, void* user_data) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return task_system::INVALID_ID;
+    }
+
+    const int64_t num_frames = loaded_traj->view_count;
+    beg = CLAMP(beg, 0, num_frames);
+    end = CLAMP(end, beg, num_frames);
+    if (beg == end) {
+        return task_system::INVALID_ID;
+    }
+
+    FrameStream* stream = (FrameStream*)md_alloc(md_heap_allocator, sizeof(FrameStream));
+    stream->loaded_traj = loaded_traj;
+    stream->next = beg;
+    stream->func = func;
+    stream->user_data = user_data;
+
+    task_system::ID id = task_system::pool_enqueue(label, 0, (uint32_t)(end - beg), stream_job, stream);
+    task_system::pool_enqueue(STR("##Release Frame Stream"), [](void* user_data) {
+        md_free(md_heap_allocator, user_data, sizeof(FrameStream));
+    }, stream, id);
+
+    md_array_push(loaded_traj->pipeline->streams, id, loaded_traj->alloc);
+
+    return id;
+}
+
+bool set_cache_budget(md_trajectory_i* traj, uint64_t budget_in_bytes) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+
+    const uint64_t budget = CLAMP(budget_in_bytes, CACHE_BUDGET_MIN, CACHE_BUDGET_MAX);
+    if (budget == loaded_traj->cache_budget) return true;
+
+    loaded_traj->cache_budget = budget;
+    // The governor may currently hold the limit below the new budget, in which case it is kept below
+    const uint64_t limit = loaded_traj->governor ? MIN(budget, loaded_traj->cache_limit) : budget;
+    if (limit != loaded_traj->cache_limit || !loaded_traj->governor) {
+        MD_LOG_INFO("Setting frame cache budget to %.0f MB", (double)limit / MEGABYTES(1));
+        rebuild_cache(loaded_traj, limit);
+    }
+    return true;
+}
+
+uint64_t cache_budget_min() {
+    return CACHE_BUDGET_MIN;
+}
+
+uint64_t cache_budget_max() {
+    return CACHE_BUDGET_MAX;
+}
+
+bool get_cache_budget(md_trajectory_i* traj, uint64_t* budget_in_bytes, uint64_t* limit_in_bytes) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        if (budget_in_bytes) *budget_in_bytes = loaded_traj->cache_budget;
+        if (limit_in_bytes)  *limit_in_bytes  = loaded_traj->cache_limit;
+        return true;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+    return false;
+}
+
+bool set_cache_governor(md_trajectory_i* traj, bool enable) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+
+    loaded_traj->governor = enable;
+    loaded_traj->governor_timer = GOVERNOR_INTERVAL_SECONDS; // Evaluate on next update
+    if (!enable && loaded_traj->cache_limit != loaded_traj->cache_budget) {
+        rebuild_cache(loaded_traj, loaded_traj->cache_budget);
+    }
+    return true;
+}
+
+void update_cache_governor(md_trajectory_i* traj, double dt) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return;
+    }
+    if (!loaded_traj->governor) return;
+
+    loaded_traj->governor_timer += dt;
+    if (loaded_traj->governor_timer < GOVERNOR_INTERVAL_SECONDS) return;
+    loaded_traj->governor_timer = 0;
+
+    const uint64_t avail = available_physical_memory();
+    const uint64_t total = md_os_physical_ram();
+    if (avail == 0 || total == 0) return; // Unknown on this platform
+
+    const uint64_t low    = (uint64_t)(total * GOVERNOR_LOW_WATERMARK);
+    const uint64_t high   = (uint64_t)(total * GOVERNOR_HIGH_WATERMARK);
+    const uint64_t budget = loaded_traj->cache_budget;
+    const uint64_t limit  = loaded_traj->cache_limit;
+    const uint64_t lower  = MIN(budget, (uint64_t)GOVERNOR_MIN_BUDGET);
+
+    uint64_t new_limit = limit;
+    if (avail < low) {
+        // Release enough to get back above the high watermark, which leaves some headroom before the next shrink
+        const uint64_t deficit = high - avail;
+        new_limit = (limit > lower + deficit) ? limit - deficit : lower;
+    } else if (avail > high && limit < budget) {
+        // Only grow by half of the surplus, as the growth itself consumes available memory
+        new_limit = MIN(budget, limit + (avail - high) / 2);
+    }
+
+    const uint64_t change = new_limit > limit ? new_limit - limit : limit - new_limit;
+    if (change > 0 && (change >= (uint64_t)(limit * GOVERNOR_MIN_CHANGE) || new_limit == budget || new_limit == lower)) {
+        MD_LOG_INFO("Memory governor: %s frame cache to %.0f MB (%.0f MB available)", new_limit < limit ? "shrinking" : "growing",
+            (double)new_limit / MEGABYTES(1), (double)avail / MEGABYTES(1));
+        rebuild_cache(loaded_traj, new_limit);
+    }
+}
+
+bool set_cache_policy(md_trajectory_i* traj, frame_cache_policy_t policy, bool pin_playhead) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+    if (policy < 0 || policy >= FRAME_CACHE_POLICY_COUNT) {
+        MD_LOG_ERROR("Invalid frame cache policy");
+        return false;
+    }
+
+    loaded_traj->cache_policy = policy;
+    loaded_traj->pin_playhead = pin_playhead;
+    frame_cache_set_policy(loaded_traj->cache, policy);
+    if (!pin_playhead) {
+        frame_cache_pin(loaded_traj->cache, 0, 0);
+    }
+    return true;
+}
+
+bool get_cache_stats(md_trajectory_i* traj, frame_cache_stats_t stats[FRAME_CACHE_POLICY_COUNT]) {
+    ASSERT(traj);
+    ASSERT(stats);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+
+    frame_cache_get_stats(loaded_traj->cache, stats);
+    for (int i = 0; i < FRAME_CACHE_POLICY_COUNT; ++i) {
+        stats[i].hits      += loaded_traj->cache_stats[i].hits;
+        stats[i].misses    += loaded_traj->cache_stats[i].misses;
+        stats[i].evictions += loaded_traj->cache_stats[i].evictions;
+    }
+    return true;
+}
+
+bool set_view(md_trajectory_i* traj, int64_t beg, int64_t end, int64_t stride) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+
+    md_trajectory_header_t header;
+    if (!md_trajectory_get_header(loaded_traj->traj, &header)) {
+        return false;
+    }
+    const int64_t num_frames = (int64_t)header.num_frames;
+    beg = CLAMP(beg, 0, num_frames);
+    end = end < 0 ? num_frames : CLAMP(end, beg, num_frames);
+    stride = MAX(1, stride);
+    if (beg == end) {
+        MD_LOG_ERROR("Trajectory view does not contain any frames");
+        return false;
+    }
+
+    // Running jobs address frames through the current view
+    PrefetchState* pf = loaded_traj->prefetch;
+    task_system::task_interrupt_and_wait_for(pf->task);
+    interrupt_streams(loaded_traj->pipeline);
+
+    loaded_traj->view_beg    = beg;
+    loaded_traj->view_end    = end;
+    loaded_traj->view_stride = stride;
+    loaded_traj->view_count  = (end - beg + stride - 1) / stride;
+    md_array_resize(loaded_traj->view_times, loaded_traj->view_count, loaded_traj->alloc);
+    for (int64_t i = 0; i < loaded_traj->view_count; ++i) {
+        loaded_traj->view_times[i] = header.frame_times[view_to_source(loaded_traj, i)];
+    }
+
+    frame_cache_pin(loaded_traj->cache, 0, 0);
+    pf->window_beg = pf->window_end = 0;
+    pf->frame = 0;
+    pf->playhead = 0;
+    return true;
+}
+
+bool get_view(md_trajectory_i* traj, int64_t* beg, int64_t* end, int64_t* stride, int64_t* num_source_frames) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+    if (beg)    *beg    = loaded_traj->view_beg;
+    if (end)    *end    = loaded_traj->view_end;
+    if (stride) *stride = loaded_traj->view_stride;
+    if (num_source_frames) *num_source_frames = md_trajectory_num_frames(loaded_traj->traj);
+    return true;
+}
+
+bool get_prefetch_stats(md_trajectory_i* traj, prefetch_stats_t* stats) {
+    ASSERT(traj);
+    ASSERT(stats);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (loaded_traj) {
+        const PrefetchState* pf = loaded_traj->prefetch;
+        stats->hits       = pf->hits;
+        stats->stalls     = pf->stalls;
+        stats->misses     = pf->misses;
+        stats->prefetched = pf->prefetched;
+        stats->jumps      = pf->jumps;
+        stats->window_beg = pf->window_beg;
+        stats->window_end = pf->window_end;
+        stats->velocity   = pf->velocity;
+        return true;
+    }
+    MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+    return false;
+}
+
+static telemetry_t read_telemetry(LoadedTrajectory* loaded_traj) {
+    telemetry_t t = {};
+
+    frame_cache_stats_t stats[FRAME_CACHE_POLICY_COUNT];
+    get_cache_stats((md_trajectory_i*)loaded_traj->key, stats);
+    for (int i = 0; i < FRAME_CACHE_POLICY_COUNT; ++i) {
+        t.cache_hits      += stats[i].hits;
+        t.cache_misses    += stats[i].misses;
+        t.cache_evictions += stats[i].evictions;
+    }
+
+    const Telemetry* tm = loaded_traj->telemetry;
+    frame_cache_get_contention(loaded_traj->cache, &t.lock_waits, &t.lock_wait_time);
+    t.lock_waits     += tm->retired_lock_waits;
+    t.lock_wait_time += tm->retired_lock_wait_time;
+
+    t.compressed_hits  = tm->compressed_hits;
+    t.disk_hits        = tm->disk_hits;
+    t.frames_fetched   = tm->fetched;
+    t.bytes_read       = tm->bytes_read;
+    t.fetch_time       = md_time_as_seconds((md_timestamp_t)tm->fetch_ticks.load());
+    t.decode_time      = md_time_as_seconds((md_timestamp_t)tm->decode_ticks.load());
+    t.recenter_time    = md_time_as_seconds((md_timestamp_t)tm->recenter_ticks.load());
+    t.deperiodize_time = md_time_as_seconds((md_timestamp_t)tm->deperiodize_ticks.load());
+    t.unpack_time      = md_time_as_seconds((md_timestamp_t)tm->unpack_ticks.load());
+    t.disk_read_time   = md_time_as_seconds((md_timestamp_t)tm->disk_read_ticks.load());
+    return t;
+}
+
+bool get_telemetry(md_trajectory_i* traj, telemetry_t* telemetry) {
+    ASSERT(traj);
+    ASSERT(telemetry);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+
+    const telemetry_t cur  = read_telemetry(loaded_traj);
+    const telemetry_t base = loaded_traj->telemetry_base;
+    telemetry->cache_hits       = cur.cache_hits       - base.cache_hits;
+    telemetry->cache_misses     = cur.cache_misses     - base.cache_misses;
+    telemetry->cache_evictions  = cur.cache_evictions  - base.cache_evictions;
+    telemetry->compressed_hits  = cur.compressed_hits  - base.compressed_hits;
+    telemetry->disk_hits        = cur.disk_hits        - base.disk_hits;
+    telemetry->frames_fetched   = cur.frames_fetched   - base.frames_fetched;
+    telemetry->bytes_read       = cur.bytes_read       - base.bytes_read;
+    telemetry->lock_waits       = cur.lock_waits       - base.lock_waits;
+    telemetry->fetch_time       = cur.fetch_time       - base.fetch_time;
+    telemetry->decode_time      = cur.decode_time      - base.decode_time;
+    telemetry->recenter_time    = cur.recenter_time    - base.recenter_time;
+    telemetry->deperiodize_time = cur.deperiodize_time - base.deperiodize_time;
+    telemetry->unpack_time      = cur.unpack_time      - base.unpack_time;
+    telemetry->disk_read_time   = cur.disk_read_time   - base.disk_read_time;
+    telemetry->lock_wait_time   = cur.lock_wait_time   - base.lock_wait_time;
+    return true;
+}
+
+bool reset_telemetry(md_trajectory_i* traj) {
+    ASSERT(traj);
+
+    LoadedTrajectory* loaded_traj = find_loaded_trajectory((uint64_t)traj);
+    if (!loaded_traj) {
+        MD_LOG_ERROR("Supplied trajectory was not loaded with loader");
+        return false;
+    }
+    loaded_traj->telemetry_base = read_telemetry(loaded_traj);
+    return true;
+}
+
+bool write_telemetry_json(md_trajectory_i* traj, str_t path) {
+    ASSERT(traj);
+
+    telemetry_t t;
+    prefetch_stats_t pf;
+    frame_cache_stats_t stats[FRAME_CACHE_POLICY_COUNT];
+    uint64_t budget = 0, limit = 0;
+    if (!get_telemetry(traj, &t) || !get_prefetch_stats(traj, &pf) || !get_cache_stats(traj, stats) || !get_cache_budget(traj, &budget, &limit)) {
+        return false;
+    }
+
+    char file_path[2048];
+    snprintf(file_path, sizeof(file_path), "%.*s", (int)path.len, path.ptr);
+    FILE* file = fopen(file_path, "w");
+    if (!file) {
+        MD_LOG_ERROR("Could not open file '%s' for writing", file_path);
+        return false;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"num_frames\": %lld,\n", (long long)md_trajectory_num_frames(traj));
+    fprintf(file, "  \"num_cache_frames\": %lld,\n", (long long)num_cache_frames(traj));
+    fprintf(file, "  \"cache_budget\": %llu,\n", (unsigned long long)budget);
+    fprintf(file, "  \"cache_limit\": %llu,\n", (unsigned long long)limit);
+    fprintf(file, "  \"cache\": {\"hits\": %llu, \"misses\": %llu, \"evictions\": %llu, \"lock_waits\": %llu, \"lock_wait_time\": %.6f},\n",
+        (unsigned long long)t.cache_hits, (unsigned long long)t.cache_misses, (unsigned long long)t.cache_evictions, (unsigned long long)t.lock_waits, t.lock_wait_time);
+    fprintf(file, "  \"levels\": {\"compressed_hits\": %llu, \"disk_hits\": %llu, \"frames_fetched\": %llu, \"bytes_read\": %llu},\n",
+        (unsigned long long)t.compressed_hits, (unsigned long long)t.disk_hits, (unsigned long long)t.frames_fetched, (unsigned long long)t.bytes_read);
+    fprintf(file, "  \"time\": {\"fetch\": %.6f, \"decode\": %.6f, \"recenter\": %.6f, \"deperiodize\": %.6f, \"unpack\": %.6f, \"disk_read\": %.6f},\n",
+        t.fetch_time, t.decode_time, t.recenter_time, t.deperiodize_time, t.unpack_time, t.disk_read_time);
+    fprintf(file, "  \"prefetch\": {\"hits\": %llu, \"stalls\": %llu, \"misses\": %llu, \"prefetched\": %llu, \"jumps\": %llu},\n",
+        (unsigned long long)pf.hits, (unsigned long long)pf.stalls, (unsigned long long)pf.misses, (unsigned long long)pf.prefetched, (unsigned long long)pf.jumps);
+    fprintf(file, "  \"policies\": {");
+    for (int i = 0; i < FRAME_CACHE_POLICY_COUNT; ++i) {
+        fprintf(file, "%s\"%s\": {\"hits\": %llu, \"misses\": %llu, \"evictions\": %llu}", i > 0 ? ", " : "", frame_cache_policy_name((frame_cache_policy_t)i),
+            (unsigned long long)stats[i].hits, (unsigned long long)stats[i].misses, (unsigned long long)stats[i].evictions);
+    }
+    fprintf(file, "}\n");
+    fprintf(file, "}\n");
+    fclose(file);
+    return true;
+}
+
 }  // namespace traj
 
 }  // namespace load
@@ -1,6 +1,12 @@
 #pragma once
 
 #include <core/md_str.h>
+#include <task_system.h>
+#include <frame_cache.h>
+#include <core/md_vec_math.h>
+#include <md_trajectory.h>
+
+#include <atomic>
 
 struct md_allocator_i;
 struct md_molecule_t;
@@ -8,6 +14,7 @@ struct md_molecule_loader_i;
 struct md_trajectory_i;
 struct md_trajectory_loader_i;
 struct md_bitfield_t;
+struct md_trajectory_frame_header_t;
 
 namespace load {
     int64_t supported_extension_count();
@@ -15,18 +22,151 @@ namespace load {
 
 namespace mol {
     md_molecule_loader_i* get_loader_from_ext(str_t filename);
+
+    // Extracts the atoms given by indices (unique and ascending) of src into dst, e.g. to leave out the solvent of a large system.
+    // Residues and chains are kept if any of their atoms are kept. Bonds and other derived data are not extracted, the molecule should be postprocessed after.
+    bool extract_subset(md_molecule_t* dst, const md_molecule_t* src, const int32_t* indices, int64_t count, md_allocator_i* alloc);
 }
 
 namespace traj {
     md_trajectory_loader_i* get_loader_from_ext(str_t filename);
 
+    // Progress of open_file, which can be polled from another thread while the trajectory is being opened (e.g. from a pool task)
+    struct open_progress_t {
+        std::atomic<float> fraction = 0.0f;
+        std::atomic_bool   interrupt = false;   // Set to abort the open, which is checked between the stages of the open
+    };
+
     // loader is optional, the default loader (determined from file extension will be used) if NULL
-    md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, bool deperiodize_on_load);
+    // If cache_precision is non-zero and the trajectory does not fit in the frame cache, frames are additionally kept in a compressed level of the cache,
+    // quantized with the given precision (in Ångström). This fits several times more frames in the same amount of memory.
+    // If atom_subset is given, mol holds the subset (see mol::extract_subset) of the atoms of the file given by these indices.
+    // Only the subset is then kept in the frames, which reduces the memory of the cache and the cost of copying frames in proportion.
+    md_trajectory_i* open_file(str_t filename, md_trajectory_loader_i* loader, const md_molecule_t* mol, md_allocator_i* alloc, bool deperiodize_on_load, float cache_precision = 0,
+                               const int32_t* atom_subset = 0, int64_t atom_subset_count = 0, open_progress_t* progress = 0);
+
+    // Loads the first frame of the file (of the first file if filename is a pattern) without opening the trajectory, which requires a scan of the whole file.
+    // The coordinates are as stored in the file (num_atoms of the file, no deperiodization). Returns false if it is not possible or not worthwhile, in which case opening is fast.
+    bool peek_first_frame(str_t filename, md_trajectory_loader_i* loader, int64_t num_atoms, md_trajectory_frame_header_t* header, float* x, float* y, float* z);
     bool close(md_trajectory_i* traj);
 
+    // Recentering is applied when frames are decoded, changing the target flushes the cache.
+    // Tasks which load frames should be interrupted first, as frames they load in the meantime wait for the change.
     bool set_recenter_target(md_trajectory_i* traj, const md_bitfield_t* atom_mask);
+
+    // Deperiodization (PBC) of frames is applied once when they are decoded, the cached frames hold the result.
+    // Changing it flushes the cache.
+    bool set_deperiodize(md_trajectory_i* traj, bool deperiodize);
+
+    // Call when the structures of the molecule have changed (e.g. after the bonds were recomputed), as these are what deperiodization keeps whole
+    bool update_structures(md_trajectory_i* traj);
     bool clear_cache(md_trajectory_i* traj);
     int64_t num_cache_frames(md_trajectory_i* traj);
+
+    // Read-ahead prefetching of frames around the playhead.
+    // Call once per frame from the main thread with the current (fractional) frame and the elapsed time in seconds since the previous call.
+    // The playback velocity and direction is estimated from consecutive calls and a buffer of decoded frames is kept ahead of the playhead.
+    // Large discontinuous changes (scrubbing on the timeline) are detected as jumps, which restarts the read-ahead at the new position.
+    void prefetch_update(md_trajectory_i* traj, double frame, double dt);
+
+    // Restricts the frames exposed by the trajectory to every stride'th frame within [beg, end) of the file, e.g. for a quick look at a long trajectory.
+    // end < 0 denotes the last frame, set_view(traj, 0, -1, 1) restores the full resolution. Frame indices (load_frame, prefetch_update, stream_frames)
+    // refer to the view after this call, so everything derived from the frames has to be recomputed, but the topology is unaffected.
+    // Decoded frames are retained, as the caches are indexed by the frames of the file.
+    bool set_view(md_trajectory_i* traj, int64_t beg, int64_t end, int64_t stride);
+
+    // num_source_frames is the number of frames of the file
+    bool get_view(md_trajectory_i* traj, int64_t* beg, int64_t* end, int64_t* stride, int64_t* num_source_frames);
+
+    struct prefetch_stats_t {
+        uint64_t hits;          // On demand loads at the playhead which were served from the cache
+        uint64_t stalls;        // On demand loads at the playhead which had to be decoded (playback blocked on decode)
+        uint64_t misses;        // Other on demand loads which had to be decoded (evaluation, random access, etc.)
+        uint64_t prefetched;    // Frames decoded by the prefetcher
+        uint64_t jumps;         // Detected scrub jumps
+        int64_t  window_beg;    // Current read-ahead window [beg, end)
+        int64_t  window_end;
+        double   velocity;      // Estimated playback velocity in frames per second
+    };
+
+    bool get_prefetch_stats(md_trajectory_i* traj, prefetch_stats_t* stats);
+
+    // Counters of the frame cache and the decode pipeline since the trajectory was opened (or since the last reset)
+    struct telemetry_t {
+        uint64_t cache_hits;        // Requests served by the frame cache
+        uint64_t cache_misses;
+        uint64_t cache_evictions;
+        uint64_t compressed_hits;   // Misses served by the compressed level
+        uint64_t disk_hits;         // Misses served by the disk level
+        uint64_t frames_fetched;    // Frames read from the trajectory
+        uint64_t bytes_read;
+        uint64_t lock_waits;        // Requests which were blocked within the frame cache
+
+        // Accumulated time in seconds (summed over all threads)
+        double fetch_time;
+        double decode_time;
+        double recenter_time;
+        double deperiodize_time;
+        double unpack_time;         // Decoding of compressed frames
+        double disk_read_time;
+        double lock_wait_time;
+    };
+
+    bool get_telemetry(md_trajectory_i* traj, telemetry_t* telemetry);
+    bool reset_telemetry(md_trajectory_i* traj);
+
+    // Writes the telemetry together with the prefetch and per policy cache statistics as a JSON object, for tracking of regressions
+    bool write_telemetry_json(md_trajectory_i* traj, str_t path);
+
+    // Sets the memory budget of the frame cache (including the compressed level), which is clamped to a sensible range.
+    // Changing the budget rebuilds the cache, so the decoded frames are discarded.
+    bool set_cache_budget(md_trajectory_i* traj, uint64_t budget_in_bytes);
+
+    // The range which budgets are clamped to (the maximum depends on the physical memory of the system)
+    uint64_t cache_budget_min();
+    uint64_t cache_budget_max();
+
+    // limit is the effective budget, which may be lower than the requested budget when the governor is active
+    bool get_cache_budget(md_trajectory_i* traj, uint64_t* budget_in_bytes, uint64_t* limit_in_bytes);
+
+    // The governor monitors the available system memory and lowers the effective budget of the cache under memory pressure (instead of letting the OS swap),
+    // and raises it back towards the requested budget when memory becomes available again.
+    bool set_cache_governor(md_trajectory_i* traj, bool enable);
+
+    // Call once per frame from the main thread, dt is the elapsed time in seconds since the previous call
+    void update_cache_governor(md_trajectory_i* traj, double dt);
+
+    // Replacement policy of the frame cache. If pin_playhead is set, the frames around the playhead (as given to prefetch_update) are never evicted.
+    // The default is ARC with pinning, which keeps the frames in view when linear passes (e.g. evaluation of properties) stream through the cache.
+    bool set_cache_policy(md_trajectory_i* traj, frame_cache_policy_t policy, bool pin_playhead);
+
+    // Hits, misses and evictions of the frame cache, accumulated per policy over the lifetime of the trajectory
+    bool get_cache_stats(md_trajectory_i* traj, frame_cache_stats_t stats[FRAME_CACHE_POLICY_COUNT]);
+
+    // Summary of a frame, computed once when the frame is first decoded (by any task: playback, prefetching, streams, evaluation)
+    // and retained for the lifetime of the trajectory, independent of whether the frame is still in the caches.
+    struct frame_summary_t {
+        vec3_t aabb_min;            // Of the atom spheres if the molecule has radii, of the atom positions otherwise
+        vec3_t aabb_max;
+        vec3_t com;                 // Mass weighted if the molecule has masses
+        float  radius_of_gyration;
+        md_unit_cell_t unit_cell;
+    };
+
+    // Number of chains of the molecule, which is the length of chain_com in get_frame_summary
+    int64_t num_summary_chains(md_trajectory_i* traj);
+
+    // frame_idx is an index within the view. chain_com is optional and receives the center of mass of every chain of the molecule.
+    // Returns false if the frame has not been decoded with the current processing (recenter target, deperiodization) yet, it does not load the frame.
+    bool get_frame_summary(md_trajectory_i* traj, int64_t frame_idx, frame_summary_t* summary, vec3_t* chain_com = 0);
+
+    // Invoked for every frame passing through a stream (from a worker thread), the coordinates are only valid for the duration of the call
+    using FrameTask = void (*)(int64_t frame_idx, const md_trajectory_frame_header_t* header, const float* x, const float* y, const float* z, void* user_data);
+
+    // Streams the frames [beg, end) through a pipeline of fetch (raw bytes, sequential I/O) -> decode + PBC -> insertion into the frame cache.
+    // The fetches are serialized and issued in order, while the decoding is spread over the worker pool, so the disk and the cores are kept busy at the same time.
+    // The optional func is invoked for each frame once it has been inserted. Returns the id of the task which completes when all frames have been processed.
+    task_system::ID stream_frames(md_trajectory_i* traj, str_t label, int64_t beg, int64_t end, FrameTask func = 0, void* user_data = 0);
 }
 
 }  // namespace load
@@ -47,6 +47,7 @@
 #include <task_system.h>
 #include <color_utils.h>
 #include <loader.h>
+#include <multi_traj.h>
 #include <ramachandran.h>
 #include <image.h>
 #include <application/application.h>
@@ -80,8 +81,8 @@
 #define GL_COLOR_ATTACHMENT_POST_TONEMAP GL_COLOR_ATTACHMENT4
 
 // For cpu profiling
-#define PUSH_CPU_SECTION(lbl) {};
-#define POP_CPU_SECTION() {};
+#define PUSH_CPU_SECTION(lbl) task_system::profiler_push_section(lbl);
+#define POP_CPU_SECTION() task_system::profiler_pop_section();
 
 // For gpu profiling
 #define PUSH_GPU_SECTION(lbl)                                                                   \
@@ -427,11 +428,34 @@ struct LoadDatasetWindowState {
     bool coarse_grained = false;
     bool keep_representations = false;
     bool deperiodize_on_load = true;
+    bool compress_frame_cache = false;
+    float frame_cache_precision = 0.01f;
+    char atom_subset[256] = "";
     bool show_window = false;
     bool show_file_dialog = false;
     int  loader_idx = -1;
 };
 
+struct ApplicationData;
+
+// Trajectory which is opened on the thread-pool (see load_trajectory_data) and handed over to the main thread once it is open
+struct TrajectoryOpenRequest {
+    ApplicationData* data;
+    uint32_t generation;        // Stale if it does not match the generation of ApplicationData::traj_open
+    char     path[2048];
+    md_trajectory_loader_i* loader;
+    bool     deperiodize;
+    float    cache_precision;
+    bool     optional;          // Failure is not an error (the file holds both the molecule and possibly a trajectory)
+    bool     preview;           // Show the first frame while the file is being scanned
+    bool     ran;               // If the task was executed (it is skipped if it was interrupted before it started)
+    int64_t  num_source_atoms;
+    int      view_beg;          // Range of the view which is applied once opened (restored from a workspace)
+    int      view_end;
+    load::traj::open_progress_t progress;
+    md_trajectory_i* traj;      // Result
+};
+
 struct ApplicationData {
     // --- APPLICATION ---
     application::Context ctx {};
@@ -447,8 +471,41 @@ struct ApplicationData {
 
         bool coarse_grained = false;
         bool deperiodize    = false;
+        float cache_precision = 0.0f; // Precision of the compressed frame cache, 0 if disabled
+        char atom_subset[256] = {0};  // Filter of the atoms which are kept of the molecule and its trajectory, empty if all atoms are kept
     } files;
 
+    struct {
+        int  budget_mb    = VIAMD_FRAME_CACHE_SIZE;
+        bool governor     = false;
+        int  policy       = FRAME_CACHE_POLICY_ARC;
+        bool pin_playhead = true;
+    } frame_cache;
+
+    // Threads of the task system, set from the command line or the environment at startup (see parse_worker_settings).
+    // These are specific to the machine and are not stored in workspaces.
+    struct {
+        int num_threads = 0;
+        int first_core  = -1;   // Threads are pinned to consecutive cores from this one, -1 if not pinned
+        bool apply_pending = false; // Changed in the settings, applied once the pool is idle (see apply_worker_settings)
+        float main_budget_ms = 4.0f;    // Time per frame for executing tasks on the main thread, the rest are deferred (0 = unlimited)
+    } workers;
+
+    // Subsampled view of the trajectory frames (see load::traj::set_view), in frames of the file
+    struct {
+        int beg    = 0;
+        int end    = -1;    // Exclusive, -1 denotes the last frame
+        int stride = 1;     // Also applied when a trajectory is opened
+    } traj_view;
+
+    struct {
+        TrajectoryOpenRequest* request = nullptr; // Pending open, NULL if there is none
+        uint32_t generation = 0;
+        md_array(float) preview_xyz = 0;          // First frame of the file being opened (x, y, z of all atoms of the file)
+        md_unit_cell_t  preview_cell = {};
+        uint32_t preview_generation = 0;
+    } traj_open;
+
     // --- CAMERA ---
     struct {
         Camera camera{};
@@ -483,6 +540,8 @@ struct ApplicationData {
 #endif
         md_molecule_t       mol = {};
         md_trajectory_i*    traj = nullptr;
+        md_array(int32_t)   subset_indices = 0; // Atoms of the file which are kept in mol (files.atom_subset), NULL if all atoms are kept
+        int64_t             source_atom_count = 0; // Number of atoms of the file
 
         vec3_t              mol_aabb_min = {};
         vec3_t              mol_aabb_max = {};
@@ -520,12 +579,12 @@ struct ApplicationData {
     // --- ASYNC TASKS HANDLES ---
     struct {
         task_system::ID backbone_computations = task_system::INVALID_ID;
-        task_system::ID prefetch_frames = task_system::INVALID_ID;
         task_system::ID evaluate_full = task_system::INVALID_ID;
         task_system::ID evaluate_filt = task_system::INVALID_ID;
         task_system::ID shape_space_evaluate = task_system::INVALID_ID;
         task_system::ID ramachandran_compute_full_density = task_system::INVALID_ID;
         task_system::ID ramachandran_compute_filt_density = task_system::INVALID_ID;
+        task_system::ID open_trajectory = task_system::INVALID_ID;
     } tasks;
 
     // --- ATOM SELECTION ---
@@ -1099,8 +1158,6 @@ static int64_t single_selection_sequence_count(const SingleSelectionSequence* se
     return i;
 }
 
-//static void launch_prefetch_job(ApplicationData* data);
-
 static void init_dataset_items(ApplicationData* data);
 static void clear_dataset_items(ApplicationData* data);
 
@@ -1156,10 +1213,14 @@ static void update_md_buffers(ApplicationData* data);
 
 static void init_molecule_data(ApplicationData* data);
 static void init_trajectory_data(ApplicationData* data);
+static void apply_trajectory_view(ApplicationData* data, int64_t beg, int64_t end, int64_t stride);
+static void reinit_trajectory_frame_data(ApplicationData* data);
 
 static void interrupt_async_tasks(ApplicationData* data);
+static void cancel_trajectory_open(ApplicationData* data);
+static bool load_trajectory_data(ApplicationData* data, str_t filename, md_trajectory_loader_i* loader, bool deperiodize_on_load, float cache_precision, bool optional = false);
 
-static bool load_dataset_from_file(ApplicationData* data, str_t path_to_file, md_molecule_loader_i* mol_api = NULL, md_trajectory_loader_i* traj_api = NULL, bool coarse_grained = false, bool deperiodize_on_load = true);
+static bool load_dataset_from_file(ApplicationData* data, str_t path_to_file, md_molecule_loader_i* mol_api = NULL, md_trajectory_loader_i* traj_api = NULL, bool coarse_grained = false, bool deperiodize_on_load = true, float cache_precision = 0.0f, str_t atom_subset = {});
 
 static void load_workspace(ApplicationData* data, str_t file);
 static void save_workspace(ApplicationData* data, str_t file);
@@ -1273,7 +1334,47 @@ uint32_t djb2_hash(const char *str) {
     return hash;
 }
 
-int main(int, char**) {
+// The number of threads of the task system and their pinning, given by (in order of precedence) the command line (--workers N, --pin-workers FIRST_CORE),
+// the environment (VIAMD_NUM_WORKER_THREADS, VIAMD_PIN_WORKERS) or the build configuration.
+static void parse_worker_settings(ApplicationData* data, int argc, char** argv) {
+    int num_threads = VIAMD_NUM_WORKER_THREADS;
+    int first_core  = -1;
+
+    if (const char* env = getenv("VIAMD_NUM_WORKER_THREADS")) {
+        num_threads = (int)parse_int(str_from_cstr(env));
+    }
+    if (const char* env = getenv("VIAMD_PIN_WORKERS")) {
+        first_core = (int)parse_int(str_from_cstr(env));
+    }
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (strcmp(argv[i], "--workers") == 0) {
+            num_threads = (int)parse_int(str_from_cstr(argv[++i]));
+        } else if (strcmp(argv[i], "--pin-workers") == 0) {
+            first_core = (int)parse_int(str_from_cstr(argv[++i]));
+        }
+    }
+
+    const int num_cores = (int)md_os_num_processors();
+    data->workers.num_threads = CLAMP(num_threads == 0 ? num_cores : num_threads, 2, num_cores);
+    data->workers.first_core  = first_core;
+}
+
+// Resizing the pool waits for all of its tasks, so a change is deferred while tasks are running (e.g. the open of a trajectory) rather than stalling the UI.
+// Called once per frame.
+static void apply_worker_settings(ApplicationData* data) {
+    if (!data->workers.apply_pending) return;
+    const task_system::ID* running = task_system::pool_running_tasks(frame_allocator);
+    if (md_array_size(running) > 0 || task_system::main_queue_stats().num_ready > 0) return;
+    data->workers.apply_pending = false;
+
+    const int num_cores = (int)md_os_num_processors();
+    data->workers.num_threads = CLAMP(data->workers.num_threads, 2, num_cores);
+    task_system::set_num_threads((uint32_t)data->workers.num_threads, data->workers.first_core);
+    // Pinning is dropped if the range of cores is invalid
+    data->workers.first_core = task_system::pinned_first_core();
+}
+
+int main(int argc, char** argv) {
     const int64_t linear_size = MEGABYTES(256);
     void* linear_mem = md_alloc(md_heap_allocator, linear_size);
     md_linear_allocator_t linear_alloc {};
@@ -1408,8 +1509,9 @@ int main(int, char**) {
     LOG_DEBUG("Initializing volume...");
     volume::initialize();
     LOG_DEBUG("Initializing task system...");
-    const int num_threads = VIAMD_NUM_WORKER_THREADS == 0 ? md_os_num_processors() : VIAMD_NUM_WORKER_THREADS;
-    task_system::initialize(CLAMP(num_threads, 2, (uint32_t)md_os_num_processors()));
+    parse_worker_settings(&data, argc, argv);
+    task_system::initialize((uint32_t)data.workers.num_threads, data.workers.first_core);
+    data.workers.first_core = task_system::pinned_first_core();
 
     rama_init(&data.ramachandran.data);
 
@@ -1569,33 +1671,11 @@ int main(int, char**) {
                 data.animation.mode = PlaybackMode::Stopped;
                 data.animation.frame = 0;
             }
+        }
 
-            if (!task_system::task_is_running(data.tasks.prefetch_frames)) {
-                uint32_t traj_frames = md_trajectory_num_frames(data.mold.traj);
-                if (traj_frames > 0 && load::traj::num_cache_frames(data.mold.traj) < traj_frames) {
-                    uint32_t frame_beg = 0;
-                    uint32_t frame_end = 0;
-                    // @NOTE: This is certainly something which can be improved upon.
-                    // It prefetches frames in the direction of the animation.
-                    // In a more optimal case, it should never yield until it catches up with the number of frames it expects to have as a buffer.
-                    
-                    if (data.animation.fps > 0) {
-                        frame_beg = CLAMP((uint32_t)data.animation.frame, 0, traj_frames - 1);
-                        frame_end = CLAMP((uint32_t)data.animation.frame + 20, 0, traj_frames);
-                    } else {
-                        frame_beg = CLAMP((uint32_t)data.animation.frame - 20, 0, traj_frames - 1);
-                        frame_end = CLAMP((uint32_t)data.animation.frame, 0, traj_frames);
-                    }
-                    if (frame_beg != frame_end) {
-                        data.tasks.prefetch_frames = task_system::pool_enqueue(STR("##Prefetch Frames"), frame_beg, frame_end, [](uint32_t frame_beg, uint32_t frame_end, void* user_data) {
-                            ApplicationData* data = (ApplicationData*)user_data;
-                            for (uint32_t i = frame_beg; i < frame_end; ++i) {
-                                md_trajectory_load_frame(data->mold.traj, i, 0, 0, 0, 0);
-                            }
-                        }, &data);
-                    }
-                }
-            }
+        if (traj) {
+            load::traj::prefetch_update(traj, data.animation.frame, data.ctx.timing.delta_s);
+            load::traj::update_cache_governor(traj, data.ctx.timing.delta_s);
         }
 
         {
@@ -1635,11 +1715,8 @@ int main(int, char**) {
 
             PUSH_CPU_SECTION("Interpolate Position")
             if (traj) {
+                // PBC is applied to the frames when they are decoded (see load::traj::set_deperiodize)
                 interpolate_atomic_properties(&data);
-
-                if (data.animation.apply_pbc) {
-                    md_util_deperiodize_system(mol.atom.x, mol.atom.y, mol.atom.z, mol.atom.mass, mol.atom.count, &mol.unit_cell, &mol.structures);
-                }
             }
             POP_CPU_SECTION()
 
@@ -1832,10 +1909,11 @@ int main(int, char**) {
                             data.mold.script.evaluate_full = false;
                             md_script_eval_clear(data.mold.script.full_eval);
 
+                            // One frame per invocation, which bounds the latency of an interrupt to the evaluation of a single frame
                             data.tasks.evaluate_full = task_system::pool_enqueue(STR("Eval Full"), 0, (uint32_t)num_frames, [](uint32_t frame_beg, uint32_t frame_end, void* user_data) {
                                 ApplicationData* data = (ApplicationData*)user_data;
                                 md_script_eval_frame_range(data->mold.script.full_eval, data->mold.script.eval_ir, &data->mold.mol, data->mold.traj, frame_beg, frame_end);
-                            }, &data);
+                            }, &data, 0, task_system::PRIORITY_BACKGROUND, 1);
                             
 #if MEASURE_EVALUATION_TIME
                             uint64_t time = (uint64_t)md_time_current();
@@ -2005,12 +2083,14 @@ int main(int, char**) {
         // Swap buffers
         application::swap_buffers(&data.ctx);
 
-        task_system::execute_queued_tasks();
+        apply_worker_settings(&data);
+        task_system::execute_queued_tasks(data.workers.main_budget_ms);
 
         // Reset frame allocator
         md_linear_allocator_reset(&linear_alloc);
     }
 
+    cancel_trajectory_open(&data);
     interrupt_async_tasks(&data);
 
     // shutdown subsystems
@@ -2624,7 +2704,14 @@ static void interpolate_atomic_properties(ApplicationData* data) {
             ASSERT(false);
     }
 
-    md_util_compute_aabb(&data->mold.mol_aabb_min, &data->mold.mol_aabb_max, mol.atom.x, mol.atom.y, mol.atom.z, mol.atom.radius, 0, mol.atom.count);
+    // The bounds of a frame shown as is are known from its summary, interpolated coordinates may fall outside of the bounds of their frames
+    load::traj::frame_summary_t summary;
+    if (mode == InterpolationMode::Nearest && load::traj::get_frame_summary(traj, nearest_frame, &summary)) {
+        data->mold.mol_aabb_min = summary.aabb_min;
+        data->mold.mol_aabb_max = summary.aabb_max;
+    } else {
+        md_util_compute_aabb(&data->mold.mol_aabb_min, &data->mold.mol_aabb_max, mol.atom.x, mol.atom.y, mol.atom.z, mol.atom.radius, 0, mol.atom.count);
+    }
 
     if (mol.backbone.angle) {
         const md_backbone_angles_t* src_angles[4] = {
@@ -2796,7 +2883,15 @@ static void reset_view(ApplicationData* data, bool move_camera, bool smooth_tran
 		md_util_compute_aabb(&aabb_min, &aabb_max, mol.atom.x, mol.atom.y, mol.atom.z, nullptr, indices, len);
         md_linear_allocator_pop(linear_allocator, popcount * sizeof(int32_t));
     } else {
-        md_util_compute_aabb(&aabb_min, &aabb_max, mol.atom.x, mol.atom.y, mol.atom.z, nullptr, nullptr, mol.atom.count);
+        // The bounds of the current frame are known from its summary (which includes the atom radii) if it has been decoded
+        load::traj::frame_summary_t summary;
+        const int64_t frame = (int64_t)(data->animation.frame + 0.5);
+        if (data->mold.traj && load::traj::get_frame_summary(data->mold.traj, frame, &summary)) {
+            aabb_min = summary.aabb_min;
+            aabb_max = summary.aabb_max;
+        } else {
+            md_util_compute_aabb(&aabb_min, &aabb_max, mol.atom.x, mol.atom.y, mol.atom.z, nullptr, nullptr, mol.atom.count);
+        }
     }
 
     const vec3_t ext = aabb_max - aabb_min;
@@ -3242,6 +3337,118 @@ ImGui::EndGroup();
                 ImGui::EndCombo();
             }
 
+            ImGui::Separator();
+            ImGui::Text("Worker Threads");
+            ImGui::SliderInt("Threads", &data->workers.num_threads, 2, (int)md_os_num_processors());
+            // Resizing the pool waits for the running tasks, so it is only applied once the user is done editing
+            bool workers_changed = ImGui::IsItemDeactivatedAfterEdit();
+            bool pin = data->workers.first_core >= 0;
+            if (ImGui::Checkbox("Pin to Cores", &pin)) {
+                data->workers.first_core = pin ? 0 : -1;
+                workers_changed = true;
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Pin the threads to a fixed range of cores, e.g. to share a large machine between sessions");
+            }
+            if (pin) {
+                ImGui::InputInt("First Core", &data->workers.first_core);
+                data->workers.first_core = MAX(0, data->workers.first_core);
+                workers_changed |= ImGui::IsItemDeactivatedAfterEdit();
+            }
+            if (workers_changed) {
+                data->workers.apply_pending = true;
+            }
+            if (data->workers.apply_pending) {
+                ImGui::TextDisabled("Applied once the running tasks have completed");
+            }
+            ImGui::SliderFloat("Main Thread Budget", &data->workers.main_budget_ms, 0.0f, 16.0f, data->workers.main_budget_ms > 0.0f ? "%.1f ms" : "Unlimited");
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Time per frame for completing tasks on the main thread (e.g. texture uploads), the remaining tasks are deferred to the next frames");
+            }
+
+            ImGui::Separator();
+            ImGui::Text("Frame Cache");
+            const int min_budget_mb = (int)(load::traj::cache_budget_min() / MEGABYTES(1));
+            const int max_budget_mb = (int)(load::traj::cache_budget_max() / MEGABYTES(1));
+            ImGui::SliderInt("Budget (MB)", &data->frame_cache.budget_mb, min_budget_mb, max_budget_mb, "%d", ImGuiSliderFlags_Logarithmic);
+            // Changing the budget flushes the cache, so it is only applied once the user is done editing
+            if (ImGui::IsItemDeactivatedAfterEdit() && data->mold.traj) {
+                load::traj::set_cache_budget(data->mold.traj, MEGABYTES((uint64_t)data->frame_cache.budget_mb));
+            }
+            if (ImGui::Checkbox("Memory Governor", &data->frame_cache.governor) && data->mold.traj) {
+                load::traj::set_cache_governor(data->mold.traj, data->frame_cache.governor);
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Shrink the frame cache when the system runs low on memory and grow it back when memory is available");
+            }
+            uint64_t budget, limit;
+            if (data->mold.traj && load::traj::get_cache_budget(data->mold.traj, &budget, &limit)) {
+                ImGui::Text("Effective budget: %.0f / %.0f MB", (double)limit / MEGABYTES(1), (double)budget / MEGABYTES(1));
+            }
+
+            bool policy_changed = false;
+            if (ImGui::BeginCombo("Policy", frame_cache_policy_name((frame_cache_policy_t)data->frame_cache.policy))) {
+                for (int i = 0; i < FRAME_CACHE_POLICY_COUNT; ++i) {
+                    if (ImGui::Selectable(frame_cache_policy_name((frame_cache_policy_t)i), i == data->frame_cache.policy)) {
+                        data->frame_cache.policy = i;
+                        policy_changed = true;
+                    }
+                }
+                ImGui::EndCombo();
+            }
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Replacement policy of the frame cache.\n2Q and ARC keep frames which are revisited (e.g. when scrubbing) when the full trajectory is streamed through the cache");
+            }
+            policy_changed |= ImGui::Checkbox("Pin Frames at Playhead", &data->frame_cache.pin_playhead);
+            if (policy_changed && data->mold.traj) {
+                load::traj::set_cache_policy(data->mold.traj, (frame_cache_policy_t)data->frame_cache.policy, data->frame_cache.pin_playhead);
+            }
+
+            frame_cache_stats_t stats[FRAME_CACHE_POLICY_COUNT];
+            if (data->mold.traj && load::traj::get_cache_stats(data->mold.traj, stats)) {
+                for (int i = 0; i < FRAME_CACHE_POLICY_COUNT; ++i) {
+                    const uint64_t total = stats[i].hits + stats[i].misses;
+                    if (total == 0) continue;
+                    ImGui::Text("%-4s hit rate: %5.1f%% (%llu requests, %llu evictions)", frame_cache_policy_name((frame_cache_policy_t)i), 100.0 * (double)stats[i].hits / (double)total,
+                        (unsigned long long)total, (unsigned long long)stats[i].evictions);
+                }
+            }
+
+            ImGui::Separator();
+            ImGui::Text("Trajectory View");
+            ImGui::InputInt("Stride", &data->traj_view.stride);
+            data->traj_view.stride = MAX(1, data->traj_view.stride);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Only every n:th frame is loaded, which speeds up all analysis for a first look at long trajectories");
+            }
+            int64_t view_beg, view_end, view_stride, num_file_frames;
+            if (data->mold.traj && load::traj::get_view(data->mold.traj, &view_beg, &view_end, &view_stride, &num_file_frames)) {
+                int range[2] = {data->traj_view.beg, (data->traj_view.end < 0 ? (int)num_file_frames : data->traj_view.end) - 1};
+                if (ImGui::DragIntRange2("Frames", &range[0], &range[1], 1.0f, 0, (int)num_file_frames - 1)) {
+                    data->traj_view.beg = range[0];
+                    data->traj_view.end = range[1] + 1;
+                }
+                ImGui::Text("Showing %lld of %lld frames", (long long)md_trajectory_num_frames(data->mold.traj), (long long)num_file_frames);
+                if (ImGui::Button("Apply")) {
+                    apply_trajectory_view(data, data->traj_view.beg, data->traj_view.end, data->traj_view.stride);
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Timeline Filter")) {
+                    // The filter is given in frames of the current view
+                    const int64_t beg = view_beg + (int64_t)data->timeline.filter.beg_frame * view_stride;
+                    const int64_t end = view_beg + (int64_t)data->timeline.filter.end_frame * view_stride + 1;
+                    apply_trajectory_view(data, beg, end, data->traj_view.stride);
+                }
+                if (ImGui::IsItemHovered()) {
+                    ImGui::SetTooltip("Restrict the view to the time window of the timeline filter");
+                }
+                ImGui::SameLine();
+                if (ImGui::Button("Full Resolution")) {
+                    data->traj_view.stride = 1;
+                    apply_trajectory_view(data, 0, -1, 1);
+                }
+            }
+
             /*
             ImGui::Text("Units");
             char buf[64];
@@ -3360,7 +3567,12 @@ void draw_load_dataset_window(ApplicationData* data) {
         
         if (state.path_changed) {
             state.path_changed = false;
-            state.path_is_valid = md_path_is_valid(path) && !md_path_is_directory(path);
+            if (multi_traj_is_pattern(path)) {
+                md_array(str_t) files = multi_traj_expand_pattern(path, frame_allocator);
+                state.path_is_valid = md_array_size(files) > 0;
+            } else {
+                state.path_is_valid = md_path_is_valid(path) && !md_path_is_directory(path);
+            }
 
             // Try to assign loader_idx from extension
             state.loader_idx = -1;
@@ -3397,6 +3609,13 @@ void draw_load_dataset_window(ApplicationData* data) {
             }
         }
 
+        if (show_cg) {
+            ImGui::InputTextWithHint("Atom Subset", "all atoms", state.atom_subset, sizeof(state.atom_subset));
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Filter of the atoms to keep, e.g. 'not water'.\nOnly these atoms are kept in the frames of trajectories, which saves memory and bandwidth for large amounts of solvent");
+            }
+        }
+
         bool show_keep_rep = state.path_is_valid && mol_loader;
         if (show_keep_rep) {
             ImGui::Checkbox("Keep Representations", &state.keep_representations);
@@ -3412,12 +3631,22 @@ void draw_load_dataset_window(ApplicationData* data) {
             if (ImGui::IsItemHovered()) {
                 ImGui::SetTooltip("Enable if the loaded frames should be deperiodized");
             }
+            ImGui::Checkbox("Compress Frame Cache", &state.compress_frame_cache);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Keep frames which do not fit in the frame cache in a compressed form.\nThe coordinates are quantized with the given precision, which fits several times more frames in memory");
+            }
+            if (state.compress_frame_cache) {
+                ImGui::InputFloat("Precision", &state.frame_cache_precision, 0.001f, 0.01f, "%.3f");
+                state.frame_cache_precision = CLAMP(state.frame_cache_precision, 0.001f, 1.0f);
+            }
         }
 
         bool load_enabled = (state.path_is_valid && state.loader_idx > -1);
         if (!load_enabled) ImGui::PushDisabled();
         if (ImGui::Button("Load")) {
-            if (load_dataset_from_file(data, path, mol_loader, traj_loader, show_cg && state.coarse_grained, show_dp && state.deperiodize_on_load)) {
+            const float cache_precision = (show_dp && state.compress_frame_cache) ? state.frame_cache_precision : 0.0f;
+            const str_t atom_subset = show_cg ? str_from_cstr(state.atom_subset) : str_t{};
+            if (load_dataset_from_file(data, path, mol_loader, traj_loader, show_cg && state.coarse_grained, show_dp && state.deperiodize_on_load, cache_precision, atom_subset)) {
                 if (mol_loader && !state.keep_representations) {
                     clear_representations(data);
                     create_default_representations(data);
@@ -3462,10 +3691,31 @@ AtomElementMapping* add_atom_elem_mapping(ApplicationData* data, str_t lbl, md_e
 }
 
 void apply_atom_elem_mappings(ApplicationData* data) {
-    if (data->mold.mol.atom.count == 0 || !data->mold.mol.atom.element) {
+    if (data->mold.mol.atom.count == 0 || !data->mold.mol.atom.element || md_array_size(data->dataset.atom_element_remappings) == 0) {
         return;
     }
 
+    // A pending open reads the molecule and derives the PBC of the trajectory from its structures,
+    // so it is cancelled before the molecule is modified and started again afterwards
+    TrajectoryOpenRequest* pending = data->traj_open.request;
+    char pending_path[sizeof(pending->path)] = "";
+    md_trajectory_loader_i* pending_loader = nullptr;
+    bool  pending_deperiodize = false;
+    float pending_cache_precision = 0.0f;
+    bool  pending_optional = false;
+    int   pending_view_beg = 0;
+    int   pending_view_end = -1;
+    if (pending) {
+        MEMCPY(pending_path, pending->path, sizeof(pending_path));
+        pending_loader          = pending->loader;
+        pending_deperiodize     = pending->deperiodize;
+        pending_cache_precision = pending->cache_precision;
+        pending_optional        = pending->optional;
+        pending_view_beg        = pending->view_beg;
+        pending_view_end        = pending->view_end;
+        cancel_trajectory_open(data);
+    }
+
     for (int64_t j = 0; j < md_array_size(data->dataset.atom_element_remappings); ++j) {
         str_t lbl = str_from_cstr(data->dataset.atom_element_remappings[j].lbl);
         md_element_t elem = data->dataset.atom_element_remappings[j].elem;
@@ -3480,6 +3730,9 @@ void apply_atom_elem_mappings(ApplicationData* data) {
         }
     }
     md_molecule_t* mol = &data->mold.mol;
+
+    // Tasks which load frames read the structures of the molecule (deperiodization), these are recomputed below
+    interrupt_async_tasks(data);
     
     md_array_free(mol->bond.pairs, data->mold.mol_alloc);
     md_array_free(mol->bond.order, data->mold.mol_alloc);
@@ -3495,6 +3748,16 @@ void apply_atom_elem_mappings(ApplicationData* data) {
     md_util_postprocess_molecule(mol, data->mold.mol_alloc, MD_UTIL_POSTPROCESS_BOND_BIT | MD_UTIL_POSTPROCESS_CONNECTIVITY_BIT);
     data->mold.dirty_buffers |= MolBit_DirtyBonds;
 
+    if (data->mold.traj) {
+        load::traj::update_structures(data->mold.traj);
+        reinit_trajectory_frame_data(data);
+    }
+
+    if (pending && load_trajectory_data(data, str_from_cstr(pending_path), pending_loader, pending_deperiodize, pending_cache_precision, pending_optional)) {
+        data->traj_open.request->view_beg = pending_view_beg;
+        data->traj_open.request->view_end = pending_view_end;
+    }
+
     update_all_representations(data);
 }
 
@@ -4084,9 +4347,10 @@ void draw_context_popup(ApplicationData* data) {
                     data->mold.dirty_buffers |= MolBit_DirtyFlags;
 
                     if (apply) {
+                        // Tasks which load frames must not decode while the target is replaced, the data they computed is recomputed with the new target
+                        interrupt_async_tasks(data);
                         load::traj::set_recenter_target(data->mold.traj, &mask);
-                        load::traj::clear_cache(data->mold.traj);
-                        //launch_prefetch_job(data);
+                        reinit_trajectory_frame_data(data);
                         interpolate_atomic_properties(data);
                         data->mold.dirty_buffers |= MolBit_DirtyPosition;
                         update_md_buffers(data);
@@ -4308,7 +4572,12 @@ static void draw_animation_window(ApplicationData* data) {
                 ImGui::SetTooltip("Tension of the Cubic Spline");
             }
         }
-        ImGui::Checkbox("Apply PBC", &data->animation.apply_pbc);
+        if (ImGui::Checkbox("Apply PBC", &data->animation.apply_pbc) && data->mold.traj) {
+            interrupt_async_tasks(data);
+            load::traj::set_deperiodize(data->mold.traj, data->animation.apply_pbc);
+            data->files.deperiodize = data->animation.apply_pbc;
+            reinit_trajectory_frame_data(data);
+        }
         switch (data->animation.mode) {
             case PlaybackMode::Playing:
                 if (ImGui::Button((const char*)ICON_FA_PAUSE)) data->animation.mode = PlaybackMode::Stopped;
@@ -4657,6 +4926,10 @@ static void draw_async_task_window(ApplicationData* data) {
 
             if (!label || label[0] == '\0' || (label[0] == '#' && label[1] == '#')) continue;
 
+            if (id == data->tasks.open_trajectory && data->traj_open.request) {
+                fract = data->traj_open.request->progress.fraction;
+            }
+
             snprintf(buf, sizeof(buf), "%.*s %.1f%%", (int)label.len, label.ptr, fract * 100.f);
             ImGui::ProgressBar(fract, ImVec2(ImGui::GetContentRegionAvail().x - (size + pad),0), buf);
             ImGui::SameLine();
@@ -4668,6 +4941,9 @@ static void draw_async_task_window(ApplicationData* data) {
                 else if(id == data->tasks.evaluate_filt) {
                     md_script_eval_interrupt(data->mold.script.filt_eval);
                 }
+                else if (id == data->tasks.open_trajectory && data->traj_open.request) {
+                    data->traj_open.request->progress.interrupt = true;
+                }
             }
         }
 
@@ -6442,10 +6718,10 @@ static void draw_shape_space_window(ApplicationData* data) {
 
                         data->tasks.shape_space_evaluate = task_system::pool_enqueue(STR("Eval Shape Space"), 0, (uint32_t)num_frames, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
                             ApplicationData* data = (ApplicationData*)user_data;
+                            // Scratch memory of the worker, which is released when the invocation returns
+                            md_allocator_i* scratch = task_system::current_task_scratch();
                             int64_t stride = ALIGN_TO(data->mold.mol.atom.count, 8);
-                            const int64_t bytes = stride * 3 * sizeof(float);
-                            float* coords = (float*)md_alloc(md_heap_allocator, bytes);
-                            defer { md_free(md_heap_allocator, coords, bytes); };
+                            float* coords = (float*)md_alloc(scratch, stride * 3 * sizeof(float));
                             float* x = coords + stride * 0;
                             float* y = coords + stride * 1;
                             float* z = coords + stride * 2;
@@ -6453,24 +6729,31 @@ static void draw_shape_space_window(ApplicationData* data) {
 
                             const vec2_t p[3] = {{0.0f, 0.0f}, {1.0f, 0.0f}, {0.5f, 0.86602540378f}};
 
-                            md_array(int32_t) indices = 0;
+                            // Sized for the largest structure, so the indices of every structure are extracted without reallocation
+                            const int64_t num_structures = md_array_size(data->shape_space.bitfields);
+                            int64_t max_count = 0;
+                            for (int64_t i = 0; i < num_structures; ++i) {
+                                max_count = MAX(max_count, (int64_t)md_bitfield_popcount(&data->shape_space.bitfields[i]));
+                            }
+                            int32_t* indices = (int32_t*)md_alloc(scratch, MAX(1, max_count) * sizeof(int32_t));
+
                             for (uint32_t frame_idx = range_beg; frame_idx < range_end; ++frame_idx) {
+                                if (task_system::current_task_interrupted()) break;
                                 md_trajectory_load_frame(data->mold.traj, frame_idx, NULL, x, y, z);
-                                for (int64_t i = 0; i < md_array_size(data->shape_space.bitfields); ++i) {
-                                    md_array_resize(indices, (int64_t)md_bitfield_popcount(&data->shape_space.bitfields[i]), md_heap_allocator);
-                                    md_bitfield_extract_indices(indices, md_array_size(indices), &data->shape_space.bitfields[i]);
+                                for (int64_t i = 0; i < num_structures; ++i) {
+                                    const int64_t count = md_bitfield_extract_indices(indices, max_count, &data->shape_space.bitfields[i]);
 
-                                    const vec3_t com = md_util_compute_com(x, y, z, w, indices, md_array_size(indices));
-                                    const mat3_t M = mat3_covariance_matrix(x, y, z, w, indices, com, md_array_size(indices));
+                                    const vec3_t com = md_util_compute_com(x, y, z, w, indices, count);
+                                    const mat3_t M = mat3_covariance_matrix(x, y, z, w, indices, com, count);
                                     const vec3_t weights = md_util_shape_weights(&M);
 
                                     const int64_t dst_idx = data->shape_space.num_frames * i + frame_idx;
                                     data->shape_space.weights[dst_idx] = weights;
                                     data->shape_space.coords[dst_idx] = p[0] * weights[0] + p[1] * weights[1] + p[2] * weights[2];
                                 }
+                                task_system::current_task_progress();
                             }
-                            md_array_free(indices, md_heap_allocator);
-                        }, data);
+                        }, data, 0, task_system::PRIORITY_BACKGROUND);
                     } else {
                         snprintf(data->shape_space.error, sizeof(data->shape_space.error), "Expression did not evaluate into any bitfields");
                     }
@@ -7581,6 +7864,132 @@ static void draw_debug_window(ApplicationData* data) {
             }
         }
 
+        load::traj::prefetch_stats_t prefetch = {};
+        if (data->mold.traj && load::traj::get_prefetch_stats(data->mold.traj, &prefetch)) {
+            ImGui::Separator();
+            ImGui::Text("Frame Prefetch:");
+            ImGui::Text("Window: [%i, %i), Velocity: %.2f frames/s", (int)prefetch.window_beg, (int)prefetch.window_end, prefetch.velocity);
+            ImGui::Text("Playhead hits: %llu, stalls: %llu", (unsigned long long)prefetch.hits, (unsigned long long)prefetch.stalls);
+            ImGui::Text("Other misses: %llu, prefetched: %llu, jumps: %llu", (unsigned long long)prefetch.misses, (unsigned long long)prefetch.prefetched, (unsigned long long)prefetch.jumps);
+            ImGui::Separator();
+        }
+
+        load::traj::telemetry_t tm = {};
+        if (data->mold.traj && load::traj::get_telemetry(data->mold.traj, &tm)) {
+            // Average time per frame in milliseconds
+            auto ms_per = [](double seconds, uint64_t count) { return count > 0 ? seconds * 1000.0 / (double)count : 0.0; };
+            const uint64_t requests = tm.cache_hits + tm.cache_misses;
+            const uint64_t decoded  = tm.frames_fetched;
+
+            ImGui::Text("Frame Cache:");
+            ImGui::Text("Hits: %llu, misses: %llu (%.1f%% hit rate), evictions: %llu", (unsigned long long)tm.cache_hits, (unsigned long long)tm.cache_misses,
+                requests > 0 ? 100.0 * (double)tm.cache_hits / (double)requests : 0.0, (unsigned long long)tm.cache_evictions);
+            ImGui::Text("Lock waits: %llu, %.2f ms total", (unsigned long long)tm.lock_waits, tm.lock_wait_time * 1000.0);
+            ImGui::Text("Compressed hits: %llu (%.3f ms/frame), disk hits: %llu (%.3f ms/frame)",
+                (unsigned long long)tm.compressed_hits, ms_per(tm.unpack_time, tm.compressed_hits), (unsigned long long)tm.disk_hits, ms_per(tm.disk_read_time, tm.disk_hits));
+            ImGui::Text("Fetched: %llu frames, %.1f MB (%.3f ms/frame)", (unsigned long long)decoded, (double)tm.bytes_read / (1024.0 * 1024.0), ms_per(tm.fetch_time, decoded));
+            ImGui::Text("Decode: %.3f ms/frame, recenter: %.3f ms/frame, deperiodize: %.3f ms/frame",
+                ms_per(tm.decode_time, decoded), ms_per(tm.recenter_time, decoded), ms_per(tm.deperiodize_time, decoded));
+            if (ImGui::Button("Reset")) {
+                load::traj::reset_telemetry(data->mold.traj);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Dump JSON")) {
+                char path_buf[1024] = "";
+                if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, "json")) {
+                    if (load::traj::write_telemetry_json(data->mold.traj, str_from_cstr(path_buf))) {
+                        MD_LOG_INFO("Wrote frame cache telemetry to '%s'", path_buf);
+                    }
+                }
+            }
+            ImGui::Separator();
+        }
+
+        {
+            const task_system::main_queue_stats_t mq = task_system::main_queue_stats();
+            ImGui::Text("Main queue: %u deferred tasks (~%.2f ms), %.2f ms last frame, %.3f ms/task", mq.num_ready, mq.estimated_ms, mq.last_frame_ms, mq.avg_task_ms);
+
+            // Timeline of the task bodies executed by each thread over the last seconds
+            ImGui::Text("Task Timeline:");
+            bool record = task_system::profiler_enabled();
+            if (ImGui::Checkbox("Record", &record)) {
+                task_system::profiler_set_enabled(record);
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Clear##Task Timeline")) {
+                task_system::profiler_clear();
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Export Chrome Trace")) {
+                char path_buf[1024] = "";
+                if (application::file_dialog(path_buf, sizeof(path_buf), application::FileDialogFlag_Save, "json")) {
+                    if (task_system::profiler_write_chrome_trace(str_from_cstr(path_buf))) {
+                        MD_LOG_INFO("Wrote task trace to '%s'", path_buf);
+                    }
+                }
+            }
+
+            if (record) {
+                const double window = 2.0;  // Seconds
+                const uint32_t num_threads = task_system::pool_num_threads();
+                const float row_height = ImGui::GetTextLineHeight();
+                const ImVec2 canvas_sz = {MAX(ImGui::GetContentRegionAvail().x, 50.0f), row_height * num_threads};
+                ImGui::InvisibleButton("##Task Timeline", canvas_sz);
+                const ImVec2 canvas_p0 = ImGui::GetItemRectMin();
+                const ImVec2 canvas_p1 = ImGui::GetItemRectMax();
+                ImDrawList* draw_list = ImGui::GetWindowDrawList();
+                draw_list->AddRectFilled(canvas_p0, canvas_p1, IM_COL32(30, 30, 30, 255));
+
+                const md_timestamp_t now = md_time_current();
+                const ImVec2 mouse = ImGui::GetIO().MousePos;
+                const bool hovered = ImGui::IsItemHovered();
+                task_system::trace_event_t* events = task_system::profiler_events(frame_allocator);
+                for (int64_t i = 0; i < md_array_size(events); ++i) {
+                    const task_system::trace_event_t& e = events[i];
+                    const double t_beg = window - md_time_as_seconds(now - (md_timestamp_t)e.beg);
+                    const double t_end = window - md_time_as_seconds(now - (md_timestamp_t)e.end);
+                    if (t_end < 0.0 || e.thread >= num_threads) continue;
+
+                    const float x0 = canvas_p0.x + (float)(MAX(t_beg, 0.0) / window) * canvas_sz.x;
+                    const float x1 = MAX(canvas_p0.x + (float)(MIN(t_end, window) / window) * canvas_sz.x, x0 + 1.0f);
+                    const float y0 = canvas_p0.y + row_height * e.thread;
+                    const float y1 = y0 + row_height - 1.0f;
+
+                    // Color by label, so the partitions of a task share a color
+                    uint32_t hash = 2166136261u;
+                    for (const char* c = e.label; *c; ++c) hash = (hash ^ (uint8_t)*c) * 16777619u;
+                    const ImU32 color = ImColor::HSV((float)(hash & 0xFFFF) / 65535.0f, 0.6f, 0.8f);
+                    draw_list->AddRectFilled({x0, y0}, {x1, y1}, color);
+
+                    if (hovered && x0 <= mouse.x && mouse.x <= x1 && y0 <= mouse.y && mouse.y <= y1) {
+                        ImGui::SetTooltip("%s\nThread %u, %.3f ms", e.label, e.thread, md_time_as_seconds((md_timestamp_t)(e.end - e.beg)) * 1000.0);
+                    }
+                }
+            }
+            ImGui::Separator();
+        }
+
+        if (data->mold.traj) {
+            // Overview of the frames which have been decoded so far, from their summaries
+            const int64_t num_frames = md_trajectory_num_frames(data->mold.traj);
+            md_array(float) frame_idx = 0;
+            md_array(float) rg = 0;
+            for (int64_t i = 0; i < num_frames; ++i) {
+                load::traj::frame_summary_t summary;
+                if (load::traj::get_frame_summary(data->mold.traj, i, &summary)) {
+                    md_array_push(frame_idx, (float)i, frame_allocator);
+                    md_array_push(rg, summary.radius_of_gyration, frame_allocator);
+                }
+            }
+            ImGui::Text("Frame Summaries: %i / %i frames", (int)md_array_size(frame_idx), (int)num_frames);
+            if (md_array_size(frame_idx) > 0 && ImPlot::BeginPlot("##Frame Summaries", ImVec2(-1, 150))) {
+                ImPlot::SetupAxes("Frame", "Radius of gyration", ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+                ImPlot::PlotLine("Rg", frame_idx, rg, (int)md_array_size(frame_idx));
+                ImPlot::EndPlot();
+            }
+            ImGui::Separator();
+        }
+
         ImGuiID active = ImGui::GetActiveID();
         ImGuiID hover  = ImGui::GetHoveredID();
         ImGui::Text("Active ID: %u, Hover ID: %u", active, hover);
@@ -8316,13 +8725,24 @@ static void interrupt_async_tasks(ApplicationData* data) {
     task_system::task_wait_for(data->tasks.backbone_computations);
     task_system::task_wait_for(data->tasks.evaluate_full);
     task_system::task_wait_for(data->tasks.evaluate_filt);
-    task_system::task_wait_for(data->tasks.prefetch_frames);
     task_system::task_wait_for(data->tasks.ramachandran_compute_full_density);
     task_system::task_wait_for(data->tasks.ramachandran_compute_filt_density);
     task_system::task_wait_for(data->tasks.shape_space_evaluate);
 }
 
 // #trajectorydata
+// Clears the data which is computed per frame of the trajectory
+static void clear_trajectory_frame_data(ApplicationData* data) {
+    md_array_shrink(data->timeline.x_values,  0);
+    md_array_shrink(data->display_properties, 0);
+
+    data->shape_space.input_valid = false;
+    data->shape_space.num_frames = 0;
+    data->shape_space.num_structures = 0;
+    md_array_shrink(data->shape_space.weights, 0);
+    md_array_shrink(data->shape_space.coords, 0);
+}
+
 static void free_trajectory_data(ApplicationData* data) {
     ASSERT(data);
     interrupt_async_tasks(data);
@@ -8334,14 +8754,7 @@ static void free_trajectory_data(ApplicationData* data) {
     MEMSET(data->files.trajectory, 0, sizeof(data->files.trajectory));
     
     data->mold.mol.unit_cell = {};
-    md_array_shrink(data->timeline.x_values,  0);
-    md_array_shrink(data->display_properties, 0);
-
-    data->shape_space.input_valid = false;
-    data->shape_space.num_frames = 0;
-    data->shape_space.num_structures = 0;
-    md_array_shrink(data->shape_space.weights, 0);
-    md_array_shrink(data->shape_space.coords, 0);
+    clear_trajectory_frame_data(data);
 }
 
 static void init_trajectory_data(ApplicationData* data) {
@@ -8387,26 +8800,21 @@ static void init_trajectory_data(ApplicationData* data) {
             // Launch work to compute the values
             task_system::task_interrupt_and_wait_for(data->tasks.backbone_computations);
 
-            data->tasks.backbone_computations = task_system::pool_enqueue(STR("Backbone Operations"), 0, (uint32_t)num_frames, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
+            // Stream the frames through the loader pipeline, such that reading and decoding overlaps with the computations
+            data->tasks.backbone_computations = load::traj::stream_frames(data->mold.traj, STR("Backbone Operations"), 0, num_frames,
+                [](int64_t frame_idx, const md_trajectory_frame_header_t*, const float* x, const float* y, const float* z, void* user_data) {
                 ApplicationData* data = (ApplicationData*)user_data;
                 
                 // Create copy here of molecule since we use the full structure as input
                 md_molecule_t mol = data->mold.mol;
 
-                const int64_t stride = ALIGN_TO(mol.atom.count, 8);
-                const int64_t bytes = stride * sizeof(float) * 3;
-                float* coords = (float*)md_alloc(md_heap_allocator, bytes);
-                defer { md_free(md_heap_allocator, coords, bytes); };
-                // Overwrite the coordinate section, since we will load trajectory frame data into these
-                mol.atom.x = coords + stride * 0;
-                mol.atom.y = coords + stride * 1;
-                mol.atom.z = coords + stride * 2;
+                // Point the coordinate section to the frame data, it is only read by the computations
+                mol.atom.x = (float*)x;
+                mol.atom.y = (float*)y;
+                mol.atom.z = (float*)z;
 
-                for (uint32_t frame_idx = range_beg; frame_idx < range_end; ++frame_idx) {
-                    md_trajectory_load_frame(data->mold.traj, frame_idx, NULL, mol.atom.x, mol.atom.y, mol.atom.z);
-                    md_util_backbone_angles_compute(data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.stride * frame_idx, data->trajectory_data.backbone_angles.stride, &mol);
-                    md_util_backbone_secondary_structure_compute(data->trajectory_data.secondary_structure.data + data->trajectory_data.secondary_structure.stride * frame_idx, data->trajectory_data.secondary_structure.stride, &mol);
-                }
+                md_util_backbone_angles_compute(data->trajectory_data.backbone_angles.data + data->trajectory_data.backbone_angles.stride * frame_idx, data->trajectory_data.backbone_angles.stride, &mol);
+                md_util_backbone_secondary_structure_compute(data->trajectory_data.secondary_structure.data + data->trajectory_data.secondary_structure.stride * frame_idx, data->trajectory_data.secondary_structure.stride, &mol);
             }, data);
 
             task_system::main_enqueue(STR("Update Trajectory Data"), [](void* user_data) {
@@ -8424,35 +8832,217 @@ static void init_trajectory_data(ApplicationData* data) {
         data->mold.dirty_buffers |= MolBit_DirtyPosition;
         update_md_buffers(data);
         md_gl_molecule_zero_velocity(&data->mold.gl_mol); // Do this explicitly to update the previous position to avoid motion blur trails
+    }
+}
 
-        // Prefetch frames
-        //launch_prefetch_job(data);
+// Shows the first frame of the file which is being opened, while there is no trajectory to show frames from
+static void show_trajectory_preview(void* user_data) {
+    ApplicationData* data = (ApplicationData*)user_data;
+    const TrajectoryOpenRequest* req = data->traj_open.request;
+    if (!req || data->mold.traj || data->traj_open.preview_generation != req->generation) return;
+
+    md_molecule_t& mol = data->mold.mol;
+    const int64_t n = req->num_source_atoms;
+    const float* x = data->traj_open.preview_xyz;
+    const float* y = x + n;
+    const float* z = y + n;
+    if (data->mold.subset_indices) {
+        for (int64_t i = 0; i < mol.atom.count; ++i) {
+            const int32_t idx = data->mold.subset_indices[i];
+            mol.atom.x[i] = x[idx];
+            mol.atom.y[i] = y[idx];
+            mol.atom.z[i] = z[idx];
+        }
+    } else {
+        MEMCPY(mol.atom.x, x, mol.atom.count * sizeof(float));
+        MEMCPY(mol.atom.y, y, mol.atom.count * sizeof(float));
+        MEMCPY(mol.atom.z, z, mol.atom.count * sizeof(float));
     }
+    mol.unit_cell = data->traj_open.preview_cell;
+    if (req->deperiodize && mol.unit_cell.flags) {
+        md_util_deperiodize_system(mol.atom.x, mol.atom.y, mol.atom.z, mol.atom.mass, mol.atom.count, &mol.unit_cell, &mol.structures);
+    }
+
+    data->mold.dirty_buffers |= MolBit_DirtyPosition;
+    update_md_buffers(data);
+    md_gl_molecule_zero_velocity(&data->mold.gl_mol);
 }
 
-static bool load_trajectory_data(ApplicationData* data, str_t filename, md_trajectory_loader_i* loader, bool deperiodize_on_load) {
-    md_trajectory_i* traj = load::traj::open_file(filename, loader, &data->mold.mol, persistent_allocator, deperiodize_on_load);
-    if (traj) {
-        free_trajectory_data(data);
-        data->mold.traj = traj;
-        str_copy_to_char_buf(data->files.trajectory, sizeof(data->files.trajectory), filename);
-        data->files.deperiodize = deperiodize_on_load;
-        init_trajectory_data(data);
-        data->animation.frame = 0;
-        return true;
+static void open_trajectory_task(void* user_data) {
+    TrajectoryOpenRequest* req = (TrajectoryOpenRequest*)user_data;
+    ApplicationData* data = req->data;
+    req->ran = true;
+    if (req->progress.interrupt) return;
+
+    const str_t path = str_from_cstr(req->path);
+    if (req->preview) {
+        const int64_t n = req->num_source_atoms;
+        float* x = data->traj_open.preview_xyz;
+        md_trajectory_frame_header_t header;
+        if (load::traj::peek_first_frame(path, req->loader, n, &header, x, x + n, x + 2 * n)) {
+            data->traj_open.preview_cell = header.unit_cell;
+            data->traj_open.preview_generation = req->generation;
+            task_system::main_enqueue(STR("##Show Trajectory Preview"), show_trajectory_preview, data);
+        }
     }
 
-    return false;
+    req->traj = load::traj::open_file(path, req->loader, &data->mold.mol, persistent_allocator, req->deperiodize, req->cache_precision,
+                                      data->mold.subset_indices, md_array_size(data->mold.subset_indices), &req->progress);
+    if (req->traj && md_trajectory_num_frames(req->traj) > 0) {
+        // Decode the first frame into the cache, so it is at hand when the trajectory is handed over
+        md_trajectory_load_frame(req->traj, 0, NULL, NULL, NULL, NULL);
+    }
+}
+
+static void finish_trajectory_open(void* user_data);
+
+static void enqueue_trajectory_open(ApplicationData* data, TrajectoryOpenRequest* req) {
+    data->tasks.open_trajectory = task_system::pool_enqueue(STR("Open Trajectory"), open_trajectory_task, req);
+    task_system::main_enqueue(STR("##Finish Trajectory Open"), finish_trajectory_open, req, data->tasks.open_trajectory);
+}
+
+// Hands the opened trajectory over to the application (on the main thread)
+static void finish_trajectory_open(void* user_data) {
+    TrajectoryOpenRequest* req = (TrajectoryOpenRequest*)user_data;
+    ApplicationData* data = req->data;
+    const str_t path = str_from_cstr(req->path);
+
+    if (req->generation == data->traj_open.generation && !req->ran && !req->progress.interrupt) {
+        // The task was interrupted before it started (by interrupt_async_tasks), which was not meant for it
+        enqueue_trajectory_open(data, req);
+        return;
+    }
+    defer { md_free(md_heap_allocator, req, sizeof(TrajectoryOpenRequest)); };
+
+    if (req->generation != data->traj_open.generation) {
+        // Cancelled or superseded by another open
+        if (req->traj) load::traj::close(req->traj);
+        return;
+    }
+    data->traj_open.request = nullptr;
+    data->tasks.open_trajectory = task_system::INVALID_ID;
+
+    if (!req->traj) {
+        if (req->progress.interrupt) {
+            LOG_INFO("Opening of trajectory '%.*s' was cancelled", (int)path.len, path.ptr);
+        } else if (!req->optional) {
+            LOG_ERROR("Failed to open trajectory from file '%.*s'", (int)path.len, path.ptr);
+        }
+        return;
+    }
+
+    md_trajectory_i* traj = req->traj;
+    free_trajectory_data(data);
+    data->mold.traj = traj;
+    str_copy_to_char_buf(data->files.trajectory, sizeof(data->files.trajectory), path);
+    data->files.deperiodize = req->deperiodize;
+    data->animation.apply_pbc = req->deperiodize;
+    data->files.cache_precision = req->cache_precision;
+    load::traj::set_cache_budget(traj, MEGABYTES((uint64_t)data->frame_cache.budget_mb));
+    load::traj::set_cache_governor(traj, data->frame_cache.governor);
+    load::traj::set_cache_policy(traj, (frame_cache_policy_t)CLAMP(data->frame_cache.policy, 0, FRAME_CACHE_POLICY_COUNT - 1), data->frame_cache.pin_playhead);
+    data->traj_view.beg = 0;
+    data->traj_view.end = -1;
+    if (data->traj_view.stride > 1) {
+        load::traj::set_view(traj, 0, -1, data->traj_view.stride);
+    }
+    data->animation.frame = 0;
+    init_trajectory_data(data);
+    if (req->view_beg > 0 || req->view_end >= 0) {
+        apply_trajectory_view(data, req->view_beg, req->view_end, data->traj_view.stride);
+    }
+    LOG_SUCCESS("Successfully opened trajectory from file '%.*s'", (int)path.len, path.ptr);
+}
+
+// Discards a pending open. Must be called before the molecule is modified, which is read while the trajectory is opened.
+static void cancel_trajectory_open(ApplicationData* data) {
+    if (!data->traj_open.request) return;
+    data->traj_open.request->progress.interrupt = true;
+    task_system::task_wait_for(data->tasks.open_trajectory);
+    // The request is released by its finish handler, which closes the trajectory if it was opened regardless
+    data->traj_open.request = nullptr;
+    data->traj_open.generation++;
+    data->tasks.open_trajectory = task_system::INVALID_ID;
+}
+
+// Opens the trajectory on the thread-pool, the UI remains responsive while the file is scanned. Once it is open it is handed over to the main thread,
+// which replaces the current trajectory. If optional is set, failure to open is not reported as an error.
+static bool load_trajectory_data(ApplicationData* data, str_t filename, md_trajectory_loader_i* loader, bool deperiodize_on_load, float cache_precision, bool optional) {
+    ASSERT(data);
+    if (!loader) {
+        loader = load::traj::get_loader_from_ext(extract_ext(filename));
+    }
+    if (!loader || !data->mold.mol.atom.count) return false;
+
+    cancel_trajectory_open(data);
+
+    TrajectoryOpenRequest* req = (TrajectoryOpenRequest*)md_alloc(md_heap_allocator, sizeof(TrajectoryOpenRequest));
+    MEMSET(req, 0, sizeof(TrajectoryOpenRequest));
+    req->data = data;
+    req->generation = ++data->traj_open.generation;
+    str_copy_to_char_buf(req->path, sizeof(req->path), filename);
+    req->loader = loader;
+    req->deperiodize = deperiodize_on_load;
+    req->cache_precision = cache_precision;
+    req->optional = optional;
+    req->view_beg = 0;
+    req->view_end = -1;
+    req->num_source_atoms = data->mold.subset_indices ? data->mold.source_atom_count : data->mold.mol.atom.count;
+
+    // Frames of a current trajectory are shown until the new one is handed over
+    req->preview = data->mold.traj == nullptr;
+    if (req->preview) {
+        md_array_resize(data->traj_open.preview_xyz, req->num_source_atoms * 3, persistent_allocator);
+    }
+
+    data->traj_open.request = req;
+    enqueue_trajectory_open(data, req);
+    return true;
+}
+
+// Recomputes everything which is derived from the frames after they changed (view, PBC), the topology and representations are kept
+static void reinit_trajectory_frame_data(ApplicationData* data) {
+    clear_trajectory_frame_data(data);
+    init_trajectory_data(data);
+    data->mold.script.eval_init = true;
+}
+
+static void apply_trajectory_view(ApplicationData* data, int64_t beg, int64_t end, int64_t stride) {
+    ASSERT(data);
+    if (!data->mold.traj) return;
+
+    // Keep the playhead at the same frame of the file
+    int64_t cur_beg, cur_stride;
+    load::traj::get_view(data->mold.traj, &cur_beg, NULL, &cur_stride, NULL);
+    const double file_frame = (double)cur_beg + data->animation.frame * (double)cur_stride;
+
+    interrupt_async_tasks(data);
+    if (!load::traj::set_view(data->mold.traj, beg, end, stride)) {
+        LOG_ERROR("Failed to apply trajectory view");
+        return;
+    }
+    int64_t num_file_frames;
+    load::traj::get_view(data->mold.traj, &beg, &end, &stride, &num_file_frames);
+    data->traj_view.beg    = (int)beg;
+    data->traj_view.end    = end < num_file_frames ? (int)end : -1;
+    data->traj_view.stride = (int)stride;
+
+    data->animation.frame = MAX(0.0, (file_frame - (double)beg) / (double)stride);
+    reinit_trajectory_frame_data(data);
 }
 
 // #moleculedata
 static void free_molecule_data(ApplicationData* data) {
     ASSERT(data);
+    cancel_trajectory_open(data);
     interrupt_async_tasks(data);
 
     //md_molecule_free(&data->mold.mol, persistent_allocator);
     md_arena_allocator_reset(data->mold.mol_alloc);
     MEMSET(&data->mold.mol, 0, sizeof(data->mold.mol));
+    data->mold.subset_indices = 0;
+    data->mold.source_atom_count = 0;
+    MEMSET(data->files.atom_subset, 0, sizeof(data->files.atom_subset));
 
     md_gl_molecule_free(&data->mold.gl_mol);
     MEMSET(data->files.molecule, 0, sizeof(data->files.molecule));
@@ -8512,31 +9102,68 @@ static void init_molecule_data(ApplicationData* data) {
     }
 }
 
-static void launch_prefetch_job(ApplicationData* data) {
-    const uint32_t num_frames = MIN((uint32_t)md_trajectory_num_frames(data->mold.traj), (uint32_t)load::traj::num_cache_frames(data->mold.traj));
-    if (!num_frames) return;
+// Trajectory paths may contain wildcards in the file name (multi file trajectories), which cannot be resolved, so only the directory is made canonical
+static str_t make_canonical_path(str_t path, md_allocator_i* alloc) {
+    if (!multi_traj_is_pattern(path)) {
+        return md_path_make_canonical(path, alloc);
+    }
+    str_t dir = extract_path_without_file(path);
+    str_t can_dir = md_path_make_canonical(dir.len > 0 ? dir : STR("."), alloc);
+    if (!can_dir) return {};
+    md_strb_t sb = md_strb_create(alloc);
+    sb += can_dir;
+    if (can_dir.ptr[can_dir.len - 1] != '/' && can_dir.ptr[can_dir.len - 1] != '\\') sb += STR("/");
+    sb += extract_file(path);
+    return md_strb_to_str(&sb);
+}
 
-    task_system::task_interrupt_and_wait_for(data->tasks.prefetch_frames);
-    data->tasks.prefetch_frames = task_system::pool_enqueue(STR("Prefetch Frames"), 0, num_frames, [](uint32_t range_beg, uint32_t range_end, void* user_data) {
-        ApplicationData* data = (ApplicationData*)user_data;
-        for (uint32_t i = range_beg; i < range_end; ++i) {
-            md_trajectory_frame_header_t header;
-            md_trajectory_load_frame(data->mold.traj, i, &header, 0, 0, 0);
-        }
-    }, data);
+// Reduces the freshly loaded (full) molecule to the atoms matching the filter, trajectories opened for it are reduced to the same atoms
+static bool apply_atom_subset(ApplicationData* data, str_t filter, md_util_postprocess_flags_t flags) {
+    md_molecule_t* mol = &data->mold.mol;
 
-    task_system::main_enqueue(STR("Prefetch Complete"), [](void* user_data) {
-        ApplicationData* data = (ApplicationData*)user_data;
-        interpolate_atomic_properties(data);
-        update_md_buffers(data);
-        md_gl_molecule_zero_velocity(&data->mold.gl_mol); // Do this explicitly to update the previous position to avoid motion blur trails
-    }, data, data->tasks.prefetch_frames);
+    char err_buf[256] = "";
+    md_bitfield_t mask = md_bitfield_create(frame_allocator);
+    if (!md_filter(&mask, filter, mol, NULL, NULL, err_buf, sizeof(err_buf))) {
+        LOG_ERROR("Invalid atom subset '%.*s': %s", (int)filter.len, filter.ptr, err_buf);
+        return false;
+    }
+
+    const int64_t count = md_bitfield_popcount(&mask);
+    if (count == 0) {
+        LOG_ERROR("Atom subset '%.*s' does not match any atoms", (int)filter.len, filter.ptr);
+        return false;
+    }
+    if (count == mol->atom.count) {
+        return true;
+    }
+
+    md_array(int32_t) indices = 0;
+    md_array_resize(indices, count, data->mold.mol_alloc);
+    int64_t i = 0;
+    md_bitfield_iter_t it = md_bitfield_iter_create(&mask);
+    while (md_bitfield_iter_next(&it)) {
+        indices[i++] = (int32_t)md_bitfield_iter_idx(&it);
+    }
+
+    // The full molecule remains in the arena of the molecule until it is reset, which is only the topology of a single frame
+    md_molecule_t subset = {};
+    if (!load::mol::extract_subset(&subset, mol, indices, count, data->mold.mol_alloc)) {
+        return false;
+    }
+    LOG_INFO("Keeping %i of %i atoms (atom subset '%.*s')", (int)count, (int)mol->atom.count, (int)filter.len, filter.ptr);
+
+    data->mold.source_atom_count = mol->atom.count;
+    *mol = subset;
+    md_util_postprocess_molecule(mol, data->mold.mol_alloc, flags);
+    data->mold.subset_indices = indices;
+    str_copy_to_char_buf(data->files.atom_subset, sizeof(data->files.atom_subset), filter);
+    return true;
 }
 
-static bool load_dataset_from_file(ApplicationData* data, str_t path_to_file, md_molecule_loader_i* mol_loader, md_trajectory_loader_i* traj_loader, bool coarse_grained, bool deperiodize_on_load) {
+static bool load_dataset_from_file(ApplicationData* data, str_t path_to_file, md_molecule_loader_i* mol_loader, md_trajectory_loader_i* traj_loader, bool coarse_grained, bool deperiodize_on_load, float cache_precision, str_t atom_subset) {
     ASSERT(data);
 
-    path_to_file = md_path_make_canonical(path_to_file, frame_allocator);
+    path_to_file = make_canonical_path(path_to_file, frame_allocator);
     if (path_to_file) {
         if (mol_loader) {
             /*
@@ -8561,6 +9188,10 @@ static bool load_dataset_from_file(ApplicationData* data, str_t path_to_file, md
             // @NOTE: If the dataset is coarse-grained, then postprocessing must be aware
             md_util_postprocess_flags_t flags = coarse_grained ? MD_UTIL_POSTPROCESS_COARSE_GRAINED : MD_UTIL_POSTPROCESS_ALL;
             md_util_postprocess_molecule(&data->mold.mol, data->mold.mol_alloc, flags);
+            atom_subset = str_trim(atom_subset);
+            if (atom_subset.len > 0 && !apply_atom_subset(data, atom_subset, flags)) {
+                LOG_ERROR("Failed to apply atom subset, all atoms are kept");
+            }
             init_molecule_data(data);
 
             // @NOTE: Some files contain both atomic coordinates and trajectory
@@ -8585,17 +9216,13 @@ static bool load_dataset_from_file(ApplicationData* data, str_t path_to_file, md
             }
             */
 
-            bool success = load_trajectory_data(data, path_to_file, traj_loader, deperiodize_on_load);
-            if (success) {
-                LOG_SUCCESS("Successfully opened trajectory from file '%.*s'", path_to_file.len, path_to_file.ptr);
+            // The trajectory is opened asynchronously, the outcome is reported once it has completed (see finish_trajectory_open).
+            // If the file also holds the molecule, the trajectory is optional (In case of PDB for example), so failure is not recorded as an error.
+            bool success = load_trajectory_data(data, path_to_file, traj_loader, deperiodize_on_load, cache_precision, mol_and_traj);
+            if (success || mol_and_traj) {
                 return true;
-            } else {
-                if (mol_and_traj) {
-					// Don't record this as an error, as the trajectory may be optional (In case of PDB for example)
-                    return true;
-                }
-                LOG_ERROR("Failed to opened trajectory from file '%.*s'", path_to_file.len, path_to_file.ptr);
             }
+            LOG_ERROR("Failed to opened trajectory from file '%.*s'", path_to_file.len, path_to_file.ptr);
         }
     }
 
@@ -8750,6 +9377,19 @@ SerializationObject serialization_targets[] = {
     {"[File]", "TrajectoryFile",           SerializationType_Path,      offsetof(ApplicationData, files.trajectory),   sizeof(ApplicationData::files.trajectory)},
     {"[File]", "CoarseGrained",            SerializationType_Bool,      offsetof(ApplicationData, files.coarse_grained)},
     {"[File]", "Deperiodize",              SerializationType_Bool,      offsetof(ApplicationData, files.deperiodize)},
+    {"[File]", "CachePrecision",           SerializationType_Float,     offsetof(ApplicationData, files.cache_precision)},
+    {"[File]", "AtomSubset",               SerializationType_String,    offsetof(ApplicationData, files.atom_subset),  sizeof(ApplicationData::files.atom_subset)},
+
+    {"[FrameCache]", "BudgetMB",            SerializationType_Int32,    offsetof(ApplicationData, frame_cache.budget_mb)},
+    {"[FrameCache]", "Governor",            SerializationType_Bool,     offsetof(ApplicationData, frame_cache.governor)},
+    {"[FrameCache]", "Policy",              SerializationType_Int32,    offsetof(ApplicationData, frame_cache.policy)},
+    {"[FrameCache]", "PinPlayhead",         SerializationType_Bool,     offsetof(ApplicationData, frame_cache.pin_playhead)},
+
+    {"[Workers]", "MainBudget",             SerializationType_Float,    offsetof(ApplicationData, workers.main_budget_ms)},
+
+    {"[TrajectoryView]", "Beg",             SerializationType_Int32,    offsetof(ApplicationData, traj_view.beg)},
+    {"[TrajectoryView]", "End",             SerializationType_Int32,    offsetof(ApplicationData, traj_view.end)},
+    {"[TrajectoryView]", "Stride",          SerializationType_Int32,    offsetof(ApplicationData, traj_view.stride)},
     
     {"[Animation]", "Frame",                SerializationType_Double,   offsetof(ApplicationData, animation.frame)},
     {"[Animation]", "Fps",                  SerializationType_Float,    offsetof(ApplicationData, animation.fps)},
@@ -8914,7 +9554,7 @@ static void deserialize_object(const SerializationObject* target, char* ptr, str
             md_strb_t path = md_strb_create(frame_allocator);
             path += extract_path_without_file(filename);
             path += arg;
-            str_t can_path = md_path_make_canonical(path, frame_allocator);
+            str_t can_path = make_canonical_path(path, frame_allocator);
             if (can_path.ptr && can_path.len > 0) {
                 size_t copy_len = MIN(target->capacity - 1, (size_t)can_path.len);
                 memcpy(ptr + target->struct_byte_offset, can_path.ptr, copy_len);
@@ -9022,6 +9662,8 @@ static void load_workspace(ApplicationData* data, str_t filename) {
     str_t cur_trajectory_file   = str_copy_cstr(data->files.trajectory, frame_allocator);
     bool  cur_coarse_grained    = data->files.coarse_grained;
     bool  cur_deperiodize       = data->files.deperiodize;
+    float cur_cache_precision   = data->files.cache_precision;
+    str_t cur_atom_subset       = str_copy_cstr(data->files.atom_subset, frame_allocator);
 
     const SerializationArray* arr_group = NULL;
     void* ptr = 0;
@@ -9061,6 +9703,8 @@ static void load_workspace(ApplicationData* data, str_t filename) {
     str_t new_trajectory_file = str_copy_cstr(data->files.trajectory, frame_allocator);
     bool  new_coarse_grained  = data->files.coarse_grained;
     bool  new_deperiodize     = data->files.deperiodize;
+    float new_cache_precision = data->files.cache_precision;
+    str_t new_atom_subset     = str_copy_cstr(data->files.atom_subset, frame_allocator);
 
     str_copy_to_char_buf(data->files.workspace, sizeof(data->files.workspace), filename);
     
@@ -9070,22 +9714,43 @@ static void load_workspace(ApplicationData* data, str_t filename) {
     str_copy_to_char_buf(data->files.trajectory, sizeof(data->files.trajectory), cur_trajectory_file);
     data->files.coarse_grained  = cur_coarse_grained;
     data->files.deperiodize     = cur_deperiodize;
+    data->files.cache_precision = cur_cache_precision;
+    str_copy_to_char_buf(data->files.atom_subset, sizeof(data->files.atom_subset), cur_atom_subset);
+
+    // Opening the trajectory resets the range of the view
+    const int view_beg = data->traj_view.beg;
+    const int view_end = data->traj_view.end;
 
     str_t mol_ext  = extract_ext(new_molecule_file);
     str_t traj_ext = extract_ext(new_trajectory_file); 
     md_molecule_loader_i* mol_api = load::mol::get_loader_from_ext(mol_ext);
     md_trajectory_loader_i* traj_api = load::traj::get_loader_from_ext(traj_ext);
 
-    if (new_molecule_file && load_dataset_from_file(data, new_molecule_file, mol_api, nullptr, new_coarse_grained, new_deperiodize)) {
+    if (new_molecule_file && load_dataset_from_file(data, new_molecule_file, mol_api, nullptr, new_coarse_grained, new_deperiodize, 0.0f, new_atom_subset)) {
         init_all_representations(data);
         update_all_representations(data);
     }
 
+    // Before the trajectory is opened, which reads the molecule
+    apply_atom_elem_mappings(data);
+
     if (new_trajectory_file) {
-        load_dataset_from_file(data, new_trajectory_file, nullptr, traj_api);
+        load_dataset_from_file(data, new_trajectory_file, nullptr, traj_api, new_coarse_grained, new_deperiodize, new_cache_precision);
     }
 
-    apply_atom_elem_mappings(data);
+    if (data->traj_open.request) {
+        // The frame cache settings are applied when the trajectory has been opened, together with the view
+        data->traj_open.request->view_beg = view_beg;
+        data->traj_open.request->view_end = view_end;
+    } else if (data->mold.traj) {
+        // The trajectory may have been kept, in which case the frame cache settings of the workspace are not applied by the load
+        load::traj::set_cache_budget(data->mold.traj, MEGABYTES((uint64_t)data->frame_cache.budget_mb));
+        load::traj::set_cache_governor(data->mold.traj, data->frame_cache.governor);
+        load::traj::set_cache_policy(data->mold.traj, (frame_cache_policy_t)CLAMP(data->frame_cache.policy, 0, FRAME_CACHE_POLICY_COUNT - 1), data->frame_cache.pin_playhead);
+        if (view_beg > 0 || view_end >= 0) {
+            apply_trajectory_view(data, view_beg, view_end, data->traj_view.stride);
+        }
+    }
 }
 
 static void write_entry(FILE* file, SerializationObject target, const void* ptr, str_t filename) {
@@ -0,0 +1,301 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <mapped_file.h>
+
+#include <core/md_common.h>
+#include <core/md_platform.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if MD_PLATFORM_WINDOWS
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#endif
+
+#if MD_PLATFORM_OSX
+#include <mach/mach.h>
+#endif
+
+bool mapped_file_open(mapped_file_t* file, const char* path, int64_t size, uint32_t flags) {
+    ASSERT(file);
+    ASSERT(path);
+    MEMSET(file, 0, sizeof(mapped_file_t));
+
+    const bool write  = flags & MAPPED_FILE_WRITE;
+    const bool create = flags & MAPPED_FILE_CREATE;
+    ASSERT(!create || (write && size > 0));
+
+#if MD_PLATFORM_WINDOWS
+    // Windows does not allow other writers while the file is open with write access, which makes it exclusive
+    const DWORD access = write ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+    const DWORD share  = write ? FILE_SHARE_READ : (FILE_SHARE_READ | FILE_SHARE_WRITE);
+    HANDLE handle = CreateFileA(path, access, share, NULL, create ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE) return false;
+
+    if (size == 0) {
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0) {
+            CloseHandle(handle);
+            return false;
+        }
+        size = file_size.QuadPart;
+    }
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, write ? PAGE_READWRITE : PAGE_READONLY, (DWORD)((uint64_t)size >> 32), (DWORD)((uint64_t)size & 0xFFFFFFFF), NULL);
+    if (!mapping) {
+        CloseHandle(handle);
+        return false;
+    }
+    void* ptr = MapViewOfFile(mapping, write ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, (SIZE_T)size);
+    if (!ptr) {
+        CloseHandle(mapping);
+        CloseHandle(handle);
+        return false;
+    }
+    file->handle[0] = (intptr_t)handle;
+    file->handle[1] = (intptr_t)mapping;
+#else
+    int fd = open(path, (write ? O_RDWR : O_RDONLY) | (create ? O_CREAT : 0), 0644);
+    if (fd == -1) return false;
+
+    if ((flags & MAPPED_FILE_EXCLUSIVE) && flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    if (size == 0) {
+        size = st.st_size;
+    } else if (st.st_size != size) {
+        // The file is extended sparsely, so the disk is only consumed by the parts which are actually written
+        if (!create || ftruncate(fd, size) != 0) {
+            ::close(fd);
+            return false;
+        }
+    }
+    if (size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* ptr = mmap(NULL, (size_t)size, write ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+        ::close(fd);
+        return false;
+    }
+    file->handle[0] = fd;
+#endif
+    file->ptr  = (uint8_t*)ptr;
+    file->size = size;
+    return true;
+}
+
+void mapped_file_close(mapped_file_t* file) {
+    ASSERT(file);
+    if (!file->ptr) return;
+#if MD_PLATFORM_WINDOWS
+    UnmapViewOfFile(file->ptr);
+    CloseHandle((HANDLE)file->handle[1]);
+    CloseHandle((HANDLE)file->handle[0]);
+#else
+    munmap(file->ptr, (size_t)file->size);
+    ::close((int)file->handle[0]);
+#endif
+    MEMSET(file, 0, sizeof(mapped_file_t));
+}
+
+bool file_stat(const char* path, uint64_t* size, int64_t* mtime) {
+#if MD_PLATFORM_WINDOWS
+    struct _stat64 st;
+    if (_stat64(path, &st) != 0) return false;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+#endif
+    if (size)  *size  = (uint64_t)st.st_size;
+    if (mtime) *mtime = (int64_t)st.st_mtime;
+    return true;
+}
+
+uint64_t file_allocated_size(const char* path) {
+#if MD_PLATFORM_WINDOWS
+    DWORD high = 0;
+    const DWORD low = GetCompressedFileSizeA(path, &high);
+    if (low == INVALID_FILE_SIZE && GetLastError() != NO_ERROR) return 0;
+    return ((uint64_t)high << 32) | low;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    return (uint64_t)st.st_blocks * 512;
+#endif
+}
+
+void file_touch(const char* path) {
+#if MD_PLATFORM_WINDOWS
+    _utime(path, NULL);
+#else
+    utime(path, NULL);
+#endif
+}
+
+bool remove_unused_file(const char* path) {
+#if MD_PLATFORM_WINDOWS
+    // Fails while the file is open, since it is never opened with FILE_SHARE_DELETE
+    return DeleteFileA(path) != 0;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+    // Holding the lock while unlinking ensures no other process maps the file in between
+    bool result = false;
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        result = unlink(path) == 0;
+    }
+    ::close(fd);
+    return result;
+#endif
+}
+
+static bool has_extension(const char* name, const char* ext) {
+    const size_t name_len = strlen(name);
+    const size_t ext_len  = strlen(ext);
+    return name_len > ext_len && strcmp(name + name_len - ext_len, ext) == 0;
+}
+
+void list_files(const char* dir, const char* ext, void (*callback)(const char* path, void* user_data), void* user_data) {
+    ASSERT(dir);
+    ASSERT(ext);
+    ASSERT(callback);
+    char path[2048];
+#if MD_PLATFORM_WINDOWS
+    char search[2048];
+    snprintf(search, sizeof(search), "%s\\*%s", dir, ext);
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(search, &data);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && has_extension(data.cFileName, ext)) {
+                snprintf(path, sizeof(path), "%s\\%s", dir, data.cFileName);
+                callback(path, user_data);
+            }
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+#else
+    DIR* d = opendir(dir);
+    if (d) {
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] == '.' || !has_extension(entry->d_name, ext)) continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            struct stat st;
+            if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+                callback(path, user_data);
+            }
+        }
+        closedir(d);
+    }
+#endif
+}
+
+static void make_dir(const char* path) {
+#if MD_PLATFORM_WINDOWS
+    _mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+}
+
+bool get_cache_dir(char* buf, size_t cap) {
+    const char* env = getenv("VIAMD_CACHE_DIR");
+    if (env && env[0]) {
+        snprintf(buf, cap, "%s", env);
+        make_dir(buf);
+        return true;
+    }
+#if MD_PLATFORM_WINDOWS
+    const char* base = getenv("LOCALAPPDATA");
+    if (!base) return false;
+    snprintf(buf, cap, "%s\\viamd", base);
+    make_dir(buf);
+    snprintf(buf, cap, "%s\\viamd\\cache", base);
+#elif MD_PLATFORM_OSX
+    const char* home = getenv("HOME");
+    if (!home) return false;
+    snprintf(buf, cap, "%s/Library/Caches/viamd", home);
+#else
+    const char* xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && xdg[0]) {
+        snprintf(buf, cap, "%s/viamd", xdg);
+    } else {
+        const char* home = getenv("HOME");
+        if (!home) return false;
+        snprintf(buf, cap, "%s/.cache", home);
+        make_dir(buf);
+        snprintf(buf, cap, "%s/.cache/viamd", home);
+    }
+#endif
+    make_dir(buf);
+    return true;
+}
+
+uint64_t available_physical_memory() {
+#if MD_PLATFORM_WINDOWS
+    MEMORYSTATUSEX status = {};
+    status.dwLength = sizeof(status);
+    if (!GlobalMemoryStatusEx(&status)) return 0;
+    return (uint64_t)status.ullAvailPhys;
+#elif MD_PLATFORM_OSX
+    vm_statistics64_data_t stats;
+    mach_msg_type_number_t count = HOST_VM_INFO64_COUNT;
+    if (host_statistics64(mach_host_self(), HOST_VM_INFO64, (host_info64_t)&stats, &count) != KERN_SUCCESS) return 0;
+    // Inactive pages are reclaimed by the system before it resorts to swapping
+    return ((uint64_t)stats.free_count + (uint64_t)stats.inactive_count) * (uint64_t)vm_page_size;
+#else
+    FILE* file = fopen("/proc/meminfo", "r");
+    if (!file) return 0;
+    uint64_t result = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long long kb;
+        if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1) {
+            result = (uint64_t)kb * 1024;
+            break;
+        }
+    }
+    fclose(file);
+    return result;
+#endif
+}
+
+uint64_t hash_bytes(const void* data, int64_t len, uint64_t seed) {
+    uint64_t hash = seed;
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (int64_t i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
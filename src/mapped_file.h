@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Thin platform layer for memory mapped files, file metadata and memory status, used by the caches of the loader
+
+enum {
+    MAPPED_FILE_WRITE     = 1, // Map with write access (changes are written back to the file)
+    MAPPED_FILE_CREATE    = 2, // Create the file if it does not exist and resize it to the requested size (sparsely where supported)
+    MAPPED_FILE_EXCLUSIVE = 4, // Fail if the file is already mapped exclusively by another process
+};
+
+typedef struct mapped_file_t {
+    uint8_t* ptr;
+    int64_t  size;
+    intptr_t handle[2];
+} mapped_file_t;
+
+// If size is 0, the file is mapped with its current size
+bool mapped_file_open(mapped_file_t* file, const char* path, int64_t size, uint32_t flags);
+void mapped_file_close(mapped_file_t* file);
+
+bool file_stat(const char* path, uint64_t* size, int64_t* mtime);
+
+// Bytes which are actually allocated on disk for the file (less than its size for sparse files), 0 on failure
+uint64_t file_allocated_size(const char* path);
+
+// Sets the modification time of the file to now
+void file_touch(const char* path);
+
+// Deletes the file unless it is currently opened with MAPPED_FILE_EXCLUSIVE (i.e. in use by another process)
+bool remove_unused_file(const char* path);
+
+// Invokes the callback with the full path of every regular file in dir whose name ends with ext
+void list_files(const char* dir, const char* ext, void (*callback)(const char* path, void* user_data), void* user_data);
+
+// Writes the (created) directory for cache files into buf, without trailing separator.
+// The environment variable VIAMD_CACHE_DIR overrides the default user cache directory of the platform.
+bool get_cache_dir(char* buf, size_t cap);
+
+// Physical memory which is currently available to the application without swapping (including reclaimable file caches).
+// Returns 0 if this cannot be determined on the platform.
+uint64_t available_physical_memory();
+
+// FNV-1a
+uint64_t hash_bytes(const void* data, int64_t len, uint64_t seed = 0xcbf29ce484222325ull);
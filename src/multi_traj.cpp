@@ -0,0 +1,436 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <multi_traj.h>
+#include <traj_index.h>
+
+#include <core/md_common.h>
+#include <core/md_platform.h>
+#include <core/md_allocator.h>
+#include <core/md_log.h>
+#include <core/md_os.h>
+#include <md_trajectory.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if MD_PLATFORM_WINDOWS
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+// Max number of segments which are kept open at the same time (each holds a file handle and possibly a stub trajectory)
+#define MULTI_TRAJ_MAX_OPEN_SEGMENTS 16
+
+// Fetched frame data is prefixed with the segment and the global frame index, as decode_frame_data has no other way of knowing which segment it belongs to
+struct FramePrefix {
+    int64_t segment;
+    int64_t frame;
+};
+
+struct Segment {
+    str_t   path;
+    int64_t first;          // Global index of the first frame which is not skipped
+    int64_t num_frames;     // Frames of the file, including the skipped ones
+    int64_t skip;           // Leading frames which overlap with the previous segment (e.g. the checkpoint frame of a restart), which are dropped
+    md_trajectory_i* traj;  // NULL while closed
+    bool     indexed;       // If traj was opened through its index
+    uint32_t refs;
+    uint64_t last_use;
+};
+
+struct MultiTrajectory {
+    Segment* segments;
+    int64_t  num_segments;
+    int64_t  num_open;
+    uint64_t clock;
+    md_mutex_t mutex;       // Protects the open state of the segments
+
+    md_trajectory_header_t header;
+    md_array(double) frame_times;
+    md_trajectory_loader_i* loader;
+    md_allocator_i* alloc;
+};
+
+static void close_segment(MultiTrajectory* mt, Segment* seg) {
+    ASSERT(seg->traj && seg->refs == 0);
+    if (seg->indexed) {
+        traj_index_close(seg->traj);
+    } else {
+        mt->loader->destroy(seg->traj);
+    }
+    seg->traj = NULL;
+    mt->num_open--;
+}
+
+// Opens the segment if needed and holds a reference to it, which keeps it open until released
+static Segment* acquire_segment(MultiTrajectory* mt, int64_t seg_idx) {
+    ASSERT(0 <= seg_idx && seg_idx < mt->num_segments);
+    Segment* seg = &mt->segments[seg_idx];
+
+    md_mutex_lock(&mt->mutex);
+    if (!seg->traj) {
+        // Make room by closing the least recently used segment which is not in use
+        if (mt->num_open >= MULTI_TRAJ_MAX_OPEN_SEGMENTS) {
+            Segment* lru = NULL;
+            for (int64_t i = 0; i < mt->num_segments; ++i) {
+                Segment* s = &mt->segments[i];
+                if (s->traj && s->refs == 0 && (!lru || s->last_use < lru->last_use)) lru = s;
+            }
+            if (lru) close_segment(mt, lru);
+        }
+
+        seg->traj = traj_index_open(seg->path, mt->loader, mt->alloc);
+        seg->indexed = seg->traj != NULL;
+        if (!seg->traj) {
+            seg->traj = mt->loader->create(seg->path, mt->alloc);
+        }
+        if (!seg->traj || md_trajectory_num_frames(seg->traj) != seg->num_frames) {
+            MD_LOG_ERROR("Multi-file trajectory: failed to open segment '%.*s'", (int)seg->path.len, seg->path.ptr);
+            if (seg->traj) {
+                seg->indexed ? traj_index_close(seg->traj) : mt->loader->destroy(seg->traj);
+                seg->traj = NULL;
+            }
+            md_mutex_unlock(&mt->mutex);
+            return NULL;
+        }
+        mt->num_open++;
+    }
+    seg->refs++;
+    seg->last_use = ++mt->clock;
+    md_mutex_unlock(&mt->mutex);
+    return seg;
+}
+
+static void release_segment(MultiTrajectory* mt, Segment* seg) {
+    md_mutex_lock(&mt->mutex);
+    ASSERT(seg->refs > 0);
+    seg->refs--;
+    md_mutex_unlock(&mt->mutex);
+}
+
+static int64_t find_segment(const MultiTrajectory* mt, int64_t frame_idx) {
+    int64_t lo = 0;
+    int64_t hi = mt->num_segments - 1;
+    while (lo < hi) {
+        const int64_t mid = (lo + hi + 1) / 2;
+        if (mt->segments[mid].first <= frame_idx) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+static inline void fix_frame_header(const MultiTrajectory* mt, md_trajectory_frame_header_t* header, int64_t frame_idx) {
+    if (header) {
+        header->index = frame_idx;
+        header->timestamp = mt->frame_times[frame_idx];
+    }
+}
+
+static bool get_header(struct md_trajectory_o* inst, md_trajectory_header_t* header) {
+    MultiTrajectory* mt = (MultiTrajectory*)inst;
+    *header = mt->header;
+    return true;
+}
+
+static int64_t fetch_frame_data(struct md_trajectory_o* inst, int64_t idx, void* data_ptr) {
+    MultiTrajectory* mt = (MultiTrajectory*)inst;
+    if (idx < 0 || idx >= (int64_t)mt->header.num_frames) return 0;
+
+    const int64_t seg_idx = find_segment(mt, idx);
+    Segment* seg = acquire_segment(mt, seg_idx);
+    if (!seg) return 0;
+
+    const int64_t size = md_trajectory_fetch_frame_data(seg->traj, idx - seg->first + seg->skip, data_ptr ? (uint8_t*)data_ptr + sizeof(FramePrefix) : NULL);
+    release_segment(mt, seg);
+    if (size <= 0) return 0;
+
+    if (data_ptr) {
+        const FramePrefix prefix = {seg_idx, idx};
+        MEMCPY(data_ptr, &prefix, sizeof(prefix));
+    }
+    return size + (int64_t)sizeof(FramePrefix);
+}
+
+static bool decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, int64_t data_size, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    MultiTrajectory* mt = (MultiTrajectory*)inst;
+    if (data_size <= (int64_t)sizeof(FramePrefix)) return false;
+
+    FramePrefix prefix;
+    MEMCPY(&prefix, data_ptr, sizeof(prefix));
+    if (prefix.segment < 0 || prefix.segment >= mt->num_segments) return false;
+
+    Segment* seg = acquire_segment(mt, prefix.segment);
+    if (!seg) return false;
+    const bool result = md_trajectory_decode_frame_data(seg->traj, (const uint8_t*)data_ptr + sizeof(FramePrefix), data_size - (int64_t)sizeof(FramePrefix), header, x, y, z);
+    release_segment(mt, seg);
+
+    if (result) fix_frame_header(mt, header, prefix.frame);
+    return result;
+}
+
+static bool load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    MultiTrajectory* mt = (MultiTrajectory*)inst;
+    if (idx < 0 || idx >= (int64_t)mt->header.num_frames) return false;
+
+    Segment* seg = acquire_segment(mt, find_segment(mt, idx));
+    if (!seg) return false;
+    const bool result = md_trajectory_load_frame(seg->traj, idx - seg->first + seg->skip, header, x, y, z);
+    release_segment(mt, seg);
+
+    if (result) fix_frame_header(mt, header, idx);
+    return result;
+}
+
+// Reads the header of a segment, preferably from its index. Otherwise the segment is opened (scanned) and an index is written for subsequent opens.
+static bool read_segment_header(MultiTrajectory* mt, Segment* seg, md_trajectory_header_t* header, md_array(double)* times) {
+    if (traj_index_read_header(seg->path, header, times, mt->alloc)) {
+        return true;
+    }
+
+    md_trajectory_i* traj = mt->loader->create(seg->path, mt->alloc);
+    if (!traj) return false;
+    if (!md_trajectory_get_header(traj, header)) {
+        mt->loader->destroy(traj);
+        return false;
+    }
+
+    md_array_resize(*times, (int64_t)header->num_frames, mt->alloc);
+    for (int64_t i = 0; i < (int64_t)header->num_frames; ++i) {
+        (*times)[i] = header->frame_times ? header->frame_times[i] : (double)i;
+    }
+    header->frame_times = *times;
+
+    if (traj_index_write(seg->path, traj)) {
+        mt->loader->destroy(traj);
+    } else {
+        // Without an index, reopening the segment would require another scan, so it is kept open
+        seg->traj = traj;
+        mt->num_open++;
+    }
+    return true;
+}
+
+md_trajectory_i* multi_traj_open(const str_t* files, int64_t num_files, md_trajectory_loader_i* loader, md_allocator_i* alloc, multi_traj_progress_fn progress, void* progress_user_data) {
+    ASSERT(files);
+    ASSERT(loader);
+    ASSERT(alloc);
+    if (num_files <= 0) return NULL;
+
+    MultiTrajectory* mt = (MultiTrajectory*)md_alloc(alloc, sizeof(MultiTrajectory));
+    MEMSET(mt, 0, sizeof(MultiTrajectory));
+    mt->loader = loader;
+    mt->alloc  = alloc;
+    mt->num_segments = num_files;
+    mt->segments = (Segment*)md_alloc(alloc, sizeof(Segment) * num_files);
+    MEMSET(mt->segments, 0, sizeof(Segment) * num_files);
+    md_mutex_init(&mt->mutex);
+
+    md_trajectory_i* traj = (md_trajectory_i*)md_alloc(alloc, sizeof(md_trajectory_i));
+    MEMSET(traj, 0, sizeof(md_trajectory_i));
+    traj->inst = (md_trajectory_o*)mt;
+    traj->get_header = get_header;
+    traj->load_frame = load_frame;
+    traj->fetch_frame_data = fetch_frame_data;
+    traj->decode_frame_data = decode_frame_data;
+
+    md_array(double) times = 0;
+    defer { md_array_free(times, alloc); };
+
+    int64_t num_frames = 0;
+    for (int64_t i = 0; i < num_files; ++i) {
+        Segment* seg = &mt->segments[i];
+        seg->path  = str_copy(files[i], alloc);
+        seg->first = num_frames;
+
+        md_trajectory_header_t header;
+        if (!read_segment_header(mt, seg, &header, &times)) {
+            MD_LOG_ERROR("Multi-file trajectory: failed to read segment '%.*s'", (int)files[i].len, files[i].ptr);
+            multi_traj_close(traj);
+            return NULL;
+        }
+        if (i == 0) {
+            mt->header.num_atoms = header.num_atoms;
+            mt->header.time_unit = header.time_unit;
+        } else if (header.num_atoms != mt->header.num_atoms) {
+            MD_LOG_ERROR("Multi-file trajectory: segment '%.*s' has %i atoms, expected %i", (int)files[i].len, files[i].ptr, (int)header.num_atoms, (int)mt->header.num_atoms);
+            multi_traj_close(traj);
+            return NULL;
+        }
+        mt->header.max_frame_data_size = MAX(mt->header.max_frame_data_size, header.max_frame_data_size);
+        seg->num_frames = (int64_t)header.num_frames;
+
+        double offset = 0.0;
+        const int64_t prev = md_array_size(mt->frame_times);
+        if (prev > 0 && seg->num_frames > 0) {
+            const double last = mt->frame_times[prev - 1];
+            if (times[0] <= 0.0 && last > 0.0) {
+                // The segment restarts its time (e.g. a replica), continue the time of the previous segment
+                const double dt = prev > 1 ? last - mt->frame_times[prev - 2] : 1.0;
+                offset = last + dt - times[0];
+            } else {
+                // Frames which overlap with the previous segment (as of a restart from a checkpoint) are dropped, as gmx trjcat does
+                while (seg->skip < seg->num_frames && times[seg->skip] <= last) seg->skip++;
+                if (seg->skip > 0) {
+                    MD_LOG_INFO("Multi-file trajectory: skipping %i frames of segment '%.*s' which overlap with the previous segment", (int)seg->skip, (int)files[i].len, files[i].ptr);
+                }
+            }
+        }
+        for (int64_t j = seg->skip; j < seg->num_frames; ++j) {
+            md_array_push(mt->frame_times, times[j] + offset, alloc);
+        }
+        num_frames += seg->num_frames - seg->skip;
+
+        if (progress && !progress((float)(i + 1) / (float)num_files, progress_user_data)) {
+            MD_LOG_INFO("Opening of multi-file trajectory was aborted");
+            multi_traj_close(traj);
+            return NULL;
+        }
+    }
+
+    mt->header.num_frames = num_frames;
+    mt->header.max_frame_data_size += sizeof(FramePrefix);
+    mt->header.frame_times = mt->frame_times;
+
+    MD_LOG_INFO("Opened multi-file trajectory with %i segments (%i frames)", (int)num_files, (int)num_frames);
+    return traj;
+}
+
+void multi_traj_close(md_trajectory_i* traj) {
+    ASSERT(traj);
+    MultiTrajectory* mt = (MultiTrajectory*)traj->inst;
+    md_allocator_i* alloc = mt->alloc;
+    for (int64_t i = 0; i < mt->num_segments; ++i) {
+        Segment* seg = &mt->segments[i];
+        if (seg->traj) close_segment(mt, seg);
+        if (seg->path.ptr) str_free(seg->path, alloc);
+    }
+    md_array_free(mt->frame_times, alloc);
+    md_mutex_destroy(&mt->mutex);
+    md_free(alloc, mt->segments, sizeof(Segment) * mt->num_segments);
+    md_free(alloc, mt, sizeof(MultiTrajectory));
+    md_free(alloc, traj, sizeof(md_trajectory_i));
+}
+
+static int64_t file_name_offset(str_t path) {
+    for (int64_t i = (int64_t)path.len - 1; i >= 0; --i) {
+        if (path.ptr[i] == '/' || path.ptr[i] == '\\') return i + 1;
+    }
+    return 0;
+}
+
+bool multi_traj_is_pattern(str_t path) {
+    for (int64_t i = file_name_offset(path); i < (int64_t)path.len; ++i) {
+        if (path.ptr[i] == '*' || path.ptr[i] == '?') return true;
+    }
+    return false;
+}
+
+static bool wildcard_match(const char* pattern, const char* name) {
+    if (*pattern == '\0') return *name == '\0';
+    if (*pattern == '*') {
+        // Collapse consecutive stars and try every split
+        while (*pattern == '*') ++pattern;
+        for (const char* n = name;; ++n) {
+            if (wildcard_match(pattern, n)) return true;
+            if (*n == '\0') return false;
+        }
+    }
+    if (*name == '\0') return false;
+    return (*pattern == '?' || *pattern == *name) && wildcard_match(pattern + 1, name + 1);
+}
+
+static inline bool is_digit(char c) { return '0' <= c && c <= '9'; }
+
+// Compares runs of digits by their numeric value, so that part2 is ordered before part10
+static int natural_compare(const void* a, const void* b) {
+    const str_t* sa = (const str_t*)a;
+    const str_t* sb = (const str_t*)b;
+    int64_t i = 0, j = 0;
+    while (i < (int64_t)sa->len && j < (int64_t)sb->len) {
+        if (is_digit(sa->ptr[i]) && is_digit(sb->ptr[j])) {
+            while (i < (int64_t)sa->len && sa->ptr[i] == '0') ++i;
+            while (j < (int64_t)sb->len && sb->ptr[j] == '0') ++j;
+            int64_t ni = i, nj = j;
+            while (ni < (int64_t)sa->len && is_digit(sa->ptr[ni])) ++ni;
+            while (nj < (int64_t)sb->len && is_digit(sb->ptr[nj])) ++nj;
+            if (ni - i != nj - j) return (ni - i) < (nj - j) ? -1 : 1;
+            const int cmp = strncmp(sa->ptr + i, sb->ptr + j, (size_t)(ni - i));
+            if (cmp != 0) return cmp;
+            i = ni;
+            j = nj;
+        } else {
+            if (sa->ptr[i] != sb->ptr[j]) return (unsigned char)sa->ptr[i] < (unsigned char)sb->ptr[j] ? -1 : 1;
+            ++i;
+            ++j;
+        }
+    }
+    return (int)(((int64_t)sa->len - i) - ((int64_t)sb->len - j));
+}
+
+static void add_match(md_array(str_t)* files, str_t dir, const char* name, const char* pattern, md_allocator_i* alloc) {
+    if (!wildcard_match(pattern, name)) return;
+    // Skip the sidecar index files of the trajectories
+    const size_t len = strlen(name);
+    if (len >= 5 && strcmp(name + len - 5, ".vidx") == 0) return;
+
+    char buf[2048];
+    const int n = snprintf(buf, sizeof(buf), "%.*s%s", (int)dir.len, dir.ptr, name);
+    if (n <= 0 || n >= (int)sizeof(buf)) return;
+    md_array_push(*files, str_copy(str_from_cstr(buf), alloc), alloc);
+}
+
+md_array(str_t) multi_traj_expand_pattern(str_t pattern, md_allocator_i* alloc) {
+    ASSERT(alloc);
+    md_array(str_t) files = 0;
+
+    const int64_t name_offset = file_name_offset(pattern);
+    const str_t dir = {pattern.ptr, name_offset};
+    char name_pattern[512];
+    snprintf(name_pattern, sizeof(name_pattern), "%.*s", (int)(pattern.len - name_offset), pattern.ptr + name_offset);
+
+    char dir_path[2048];
+    snprintf(dir_path, sizeof(dir_path), "%.*s", (int)dir.len, dir.ptr);
+
+#if MD_PLATFORM_WINDOWS
+    char search[2048];
+    snprintf(search, sizeof(search), "%s*", dir_path);
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(search, &data);
+    if (find != INVALID_HANDLE_VALUE) {
+        do {
+            if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+                add_match(&files, dir, data.cFileName, name_pattern, alloc);
+            }
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+#else
+    DIR* d = opendir(dir_path[0] ? dir_path : ".");
+    if (d) {
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] == '.') continue;
+            add_match(&files, dir, entry->d_name, name_pattern, alloc);
+        }
+        closedir(d);
+    }
+#endif
+
+    if (md_array_size(files) > 1) {
+        qsort(files, (size_t)md_array_size(files), sizeof(str_t), natural_compare);
+    }
+    return files;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <core/md_str.h>
+#include <core/md_array.h>
+
+#include <stdint.h>
+
+struct md_allocator_i;
+struct md_trajectory_i;
+struct md_trajectory_loader_i;
+
+// Virtual trajectory which presents an ordered list of trajectory files (segments of a run or replicas) as one continuous trajectory.
+// Global frame indices are mapped to segments through the merged frame counts of the segments, which are read from their sidecar indices (see traj_index.h)
+// if available, so segments are only opened once their frames are accessed. At most a limited number of segments are kept open at a time.
+//
+// Frame times continue across segments: a segment which restarts its time at zero (e.g. a replica) is offset to follow the previous segment,
+// while the leading frames of a segment which overlap with the previous one (e.g. the checkpoint frame of a restart with -noappend) are dropped.
+
+// Invoked after each segment has been read with the fraction of segments completed, returning false aborts the open
+typedef bool (*multi_traj_progress_fn)(float fraction, void* user_data);
+
+// Returns NULL if any of the segments cannot be opened, if they do not share the same number of atoms or if the open was aborted through progress
+md_trajectory_i* multi_traj_open(const str_t* files, int64_t num_files, md_trajectory_loader_i* loader, md_allocator_i* alloc, multi_traj_progress_fn progress = 0, void* progress_user_data = 0);
+void multi_traj_close(md_trajectory_i* traj);
+
+// If the file name of path contains wildcards ('*' or '?'), which denote a multi file trajectory
+bool multi_traj_is_pattern(str_t path);
+
+// Expands the wildcards of the file name component of pattern into the matching files of the directory, sorted in natural order (part2 before part10)
+md_array(str_t) multi_traj_expand_pattern(str_t pattern, md_allocator_i* alloc);
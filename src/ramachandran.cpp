@@ -669,7 +669,7 @@ task_system::ID rama_rep_compute_density(rama_rep_t* rep, const md_backbone_angl
         data->rep->den_sum[1] = (float)sum[1];
         data->rep->den_sum[2] = (float)sum[2];
         data->rep->den_sum[3] = (float)sum[3];
-    }, user_data);
+    }, user_data, 0, task_system::PRIORITY_INTERACTIVE);
 
     task_system::main_enqueue(STR("##Update rama texture"), [](void* user_data) {
         UserData* data = (UserData*)user_data;
@@ -2,16 +2,37 @@
 #define _CRT_SECURE_NO_WARNINGS
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+
 #include "task_system.h"
 #include <TaskScheduler.h>
 #include <core/md_common.h>
 #include <core/md_log.h>
 #include <core/md_allocator.h>
+#include <core/md_arena_allocator.h>
 #include <core/md_array.h>
 #include <core/md_os.h>
+#include <core/md_platform.h>
 
 #include <string.h>
-#include <atomic_queue.h>
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+
+#if MD_PLATFORM_WINDOWS
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif !MD_PLATFORM_OSX
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 // Blatantly stolen from ImGui (thanks Omar!)
 struct NewDummy {};
@@ -21,65 +42,199 @@ inline void  operator delete(void*, NewDummy, void*)   {} // This is only requir
 
 namespace task_system {
 
-constexpr uint32_t MAX_TASKS = 256;
 constexpr uint32_t LABEL_SIZE = 64;
 
-static inline ID generate_id(uint32_t slot_idx) {
-    return (md_time_current() << 8) | (slot_idx & (MAX_TASKS - 1));
+// Tasks live in slots, which are allocated in pages as they are needed. Pages are never moved or freed (until shutdown),
+// as the scheduler holds pointers to the tasks.
+constexpr uint32_t SLOT_BITS  = 16;
+constexpr uint32_t PAGE_SIZE  = 256;
+constexpr uint32_t MAX_PAGES  = (1 << SLOT_BITS) / PAGE_SIZE;
+
+// A task releases its slot at the end of its body, but the scheduler still touches the task until it reports it as complete.
+// Released slots are therefore retired first and only become free once GetIsComplete() holds (see slot_pool_reclaim).
+
+// An ID is composed of the slot index, the kind of task (pool or main) and the generation of the slot, which is incremented every time the slot is allocated.
+// Generations start at 1, so a valid ID is never INVALID_ID, and an ID of a completed task never matches the task which reuses its slot.
+enum TaskKind : uint32_t {
+    TASK_KIND_POOL = 0,
+    TASK_KIND_MAIN = 1,
+};
+
+static inline ID make_id(TaskKind kind, uint32_t slot_idx, uint64_t generation) {
+    return (generation << (SLOT_BITS + 1)) | ((uint64_t)kind << SLOT_BITS) | slot_idx;
 }
 
 static inline uint32_t get_slot_idx(ID id) {
-    return (uint32_t)(id & (MAX_TASKS - 1));
+    return (uint32_t)(id & ((1 << SLOT_BITS) - 1));
 }
 
-namespace main {
-    static atomic_queue::AtomicQueue<uint32_t, MAX_TASKS, 0xFFFFFFFF> free_slots;
-    static atomic_queue::AtomicQueue<uint32_t, MAX_TASKS, 0xFFFFFFFF> queued_slots;
+static inline TaskKind get_kind(ID id) {
+    return (TaskKind)((id >> SLOT_BITS) & 1);
 }
 
-namespace pool {
-    static atomic_queue::AtomicQueue<uint32_t, MAX_TASKS, 0xFFFFFFFF> free_slots;
-    static atomic_queue::AtomicQueue<uint32_t, MAX_TASKS, 0xFFFFFFFF> queued_slots;
+static void free_pool_slot(uint32_t slot_idx);
+static void free_main_slot(uint32_t slot_idx);
+static void yield_to_interactive();
+
+// Lanes are mapped onto the priorities of the scheduler, which workers pick tasks from in order. The highest priority is reserved for pool_parallel_for.
+// Normal and background tasks share the lowest priority, the difference being that background tasks yield between their partitions (see yield_to_interactive).
+static inline enki::TaskPriority scheduler_priority(Priority priority) {
+    return priority == PRIORITY_INTERACTIVE ? enki::TASK_PRIORITY_MED : enki::TASK_PRIORITY_LOW;
+}
+
+// Interactive tasks which have been submitted to the scheduler and have not completed yet, and the ID of the most recently submitted one
+static std::atomic_uint32_t interactive_pending = 0;
+static std::atomic<ID>      interactive_last = INVALID_ID;
+
+class PoolTask;
+
+// Task graphs are tracked by the tasks themselves rather than by the scheduler: every task holds the IDs of the tasks which depend on it
+// and releases them once it has completed (see complete_task), a task is launched once all of its dependencies have released it.
+// The list and the completed flag are guarded by dependency_mutex, so a dependency is either registered before the task completes or seen as completed.
+struct TaskLink {
+    md_array(ID) dependents = 0;            // Tasks which wait for this task
+    bool completed = false;                 // Set once the task has completed, dependents are not registered beyond this point
+    std::atomic_uint32_t num_waiting = 1;   // Dependencies which have not completed, plus one which is held until all dependencies are registered
+};
+
+static md_mutex_t dependency_mutex;
+
+static void complete_task(TaskLink* link);
+
+// The pool task whose body is executed by the calling thread (see current_task).
+// It is saved and restored around the execution of bodies, as a thread may execute other tasks while it waits within a body.
+struct CurrentTask {
+    PoolTask* task;
+    uint32_t  chunk_size;   // Number of items of the range which is executed
+    uint32_t  reported;     // Items of the range which the body has reported as completed
+};
+
+static thread_local CurrentTask current = {};
+
+// Profiler: every thread of the scheduler records the execution of task bodies into its own ring buffer, which it is the only writer of.
+// Readers copy the events and discard the ones which may have been overwritten while they were copied (see profiler_events).
+constexpr uint32_t TRACE_RING_SIZE = 4096;
+constexpr uint32_t MAX_TRACE_SECTIONS = 16;
+
+struct TraceRing {
+    trace_event_t events[TRACE_RING_SIZE];
+    std::atomic_uint64_t head;  // Number of events written
+};
+
+namespace profiler {
+    static std::atomic_bool enabled = false;
+    static TraceRing** rings;   // One per thread of the scheduler, allocated when first enabled
+    static uint32_t num_rings;
+    static uint64_t clear_time; // Events which began before this are not reported
+
+    // Open sections (see profiler_push_section) of the calling thread
+    struct Section {
+        uint64_t beg;
+        const char* label;
+    };
+    static thread_local Section sections[MAX_TRACE_SECTIONS];
+    static thread_local uint32_t num_sections;
+}
+
+// Scratch arenas (see current_task_scratch): one per thread of the scheduler, which is created when the thread first asks for it.
+// The arena is reset when the outermost task body of its thread returns, bodies which the thread executes while a body waits share the arena of that body.
+constexpr int64_t SCRATCH_PAGE_SIZE = MEGABYTES(4);
+
+namespace scratch {
+    static md_allocator_i** arenas;     // Indexed by thread number, each arena is only used by its thread
+    static uint32_t num_arenas;
+    static thread_local uint32_t depth; // Task bodies which are executing on the calling thread
+}
+
+static inline void scratch_enter() {
+    scratch::depth += 1;
+}
+
+static inline void scratch_leave(uint32_t thread) {
+    scratch::depth -= 1;
+    if (scratch::depth == 0 && thread < scratch::num_arenas && scratch::arenas[thread]) {
+        md_arena_allocator_reset(scratch::arenas[thread]);
+    }
+}
+
+static inline bool trace_enabled() {
+    return profiler::enabled.load(std::memory_order_acquire);
+}
+
+static void trace_record(uint32_t thread, uint64_t beg, uint64_t end, ID id, str_t label) {
+    if (thread >= profiler::num_rings) return;
+    TraceRing* ring = profiler::rings[thread];
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    trace_event_t& event = ring->events[head % TRACE_RING_SIZE];
+    event.beg = beg;
+    event.end = end;
+    event.id = id;
+    event.thread = thread;
+    const int64_t len = MIN(label.len, (int64_t)sizeof(event.label) - 1);
+    MEMCPY(event.label, label.ptr, len);
+    event.label[len] = '\0';
+    ring->head.store(head + 1, std::memory_order_release);
 }
 
 class PoolTask : public enki::ITaskSet {
 public:
     PoolTask() = default;
-    PoolTask(uint32_t set_beg_, uint32_t set_end_, RangeTask set_func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, enki::ICompletable* dependency = 0)
-        : ITaskSet(set_end_-set_beg_), m_set_func(set_func_), m_user_data(user_data_), m_range_offset(set_beg_), m_set_completed(0), m_interrupt(false), m_id(id) {
+    PoolTask(uint32_t set_beg_, uint32_t set_end_, RangeTask set_func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, Priority priority = PRIORITY_NORMAL, uint32_t partition_size = 0)
+        : ITaskSet(set_end_-set_beg_), m_set_func(set_func_), m_user_data(user_data_), m_range_offset(set_beg_), m_partition_size(partition_size), m_set_completed(0), m_progress(0), m_interrupt(false), m_priority(priority), m_id(id) {
+        m_Priority = scheduler_priority(priority);
         int64_t len = MIN(lbl_.len, LABEL_SIZE-1);
         m_label = {strncpy(m_buf, lbl_.ptr, len), len};
-        if (dependency) {
-            SetDependency(m_dependency, dependency);
-        }
     }
 
-    PoolTask(Task func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, enki::ICompletable* dependency = 0)
-        : ITaskSet(1), m_func(func_), m_user_data(user_data_), m_set_completed(0), m_interrupt(false), m_id(id) {
+    PoolTask(Task func_, void* user_data_, str_t lbl_ = {}, ID id = INVALID_ID, Priority priority = PRIORITY_NORMAL)
+        : ITaskSet(1), m_func(func_), m_user_data(user_data_), m_set_completed(0), m_progress(0), m_interrupt(false), m_priority(priority), m_id(id) {
+        m_Priority = scheduler_priority(priority);
         int64_t len = MIN(lbl_.len, LABEL_SIZE-1);
         m_label = {strncpy(m_buf, lbl_.ptr, len), len};
-        if (dependency) {
-            SetDependency(m_dependency, dependency);
-        }
     }
 
     virtual ~PoolTask() {}
 
     virtual void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) final {
-        (void)threadnum;
-        if (!m_interrupt) {
+        const CurrentTask prev = current;
+
+        // The partition of the scheduler is executed in chunks of at most the partition size, the interrupt is checked before each chunk
+        uint32_t range_ext = (range.end - range.start);
+        const uint32_t chunk_size = m_partition_size > 0 ? m_partition_size : range_ext;
+        for (uint32_t beg = range.start; beg < range.end; beg += chunk_size) {
+            const uint32_t end = MIN(beg + chunk_size, range.end);
+            if (m_priority == PRIORITY_BACKGROUND) {
+                yield_to_interactive();
+            }
+            current = {this, end - beg, 0};
+            if (m_interrupt) continue;  // Skipped chunks are not progress
+
+            const bool trace = trace_enabled();
+            const uint64_t t0 = trace ? (uint64_t)md_time_current() : 0;
+            scratch_enter();
             if (m_set_func)
-                m_set_func(m_range_offset + range.start, m_range_offset + range.end, m_user_data);
+                m_set_func(m_range_offset + beg, m_range_offset + end, m_user_data);
             else if (m_func)
                 m_func(m_user_data);
+            scratch_leave(threadnum);
+            if (trace) {
+                trace_record(threadnum, t0, (uint64_t)md_time_current(), m_id, m_label);
+            }
+            // Items which the body did not report itself, unless it may have returned early because of the interrupt (then only the reported items count)
+            if (!m_interrupt) {
+                m_progress += (end - beg) - current.reported;
+            }
         }
-       
-        uint32_t range_ext = (range.end - range.start);
+        current = prev;
 
-        // This should be protected with a mutex or something to ensure that only a single thread does this
+        // The atomic add makes sure that exactly one partition (the last one to finish) completes the task
         uint32_t set_size = m_set_completed += range_ext;
         if (set_size == m_SetSize) {
-            pool::free_slots.push(get_slot_idx(m_id));
+            if (m_counted_pending) {
+                interactive_pending -= 1;
+            }
+            complete_task(&m_link);
+            free_pool_slot(get_slot_idx(m_id));
         }
     }
 
@@ -91,193 +246,913 @@ public:
     Task       m_func     = nullptr;
     void*      m_user_data = nullptr;
     uint32_t   m_range_offset = 0;
+    uint32_t   m_partition_size = 0;    // Max number of items per invocation of the body, 0 if determined by the scheduler
     std::atomic_uint32_t m_set_completed = 0;
+    std::atomic_uint32_t m_progress = 0; // Completed items, which includes the items reported by bodies which are still executing
     std::atomic_bool m_interrupt = false;
-    enki::Dependency m_dependency;
+    Priority   m_priority = PRIORITY_NORMAL;
+    bool       m_counted_pending = false;  // If the task is counted in interactive_pending
+    TaskLink   m_link;
     char m_buf[LABEL_SIZE];
     str_t m_label = {};
     ID m_id = INVALID_ID;
 };
 
+// Task of pool_parallel_for, which lives on the stack of the caller.
+// These run at a higher priority than the queued pool tasks, which lets the caller restrict itself to these while it waits for completion:
+// the caller may hold a lock (e.g. a frame in the cache) which a queued task would block on if it was picked up by the waiting thread.
+class ImmediateTask : public enki::ITaskSet {
+public:
+    ImmediateTask(uint32_t set_beg_, uint32_t set_end_, uint32_t grain_size, RangeTask set_func_, void* user_data_)
+        : ITaskSet(set_end_ - set_beg_, grain_size), m_set_func(set_func_), m_user_data(user_data_), m_range_offset(set_beg_) {
+        m_Priority = enki::TASK_PRIORITY_HIGH;
+    }
+
+    virtual void ExecuteRange(enki::TaskSetPartition range, uint32_t threadnum) final {
+        // The chunks are not part of any pool task, even if the thread picked them up while it executes one
+        const CurrentTask prev = current;
+        current = {};
+        const bool trace = trace_enabled();
+        const uint64_t t0 = trace ? (uint64_t)md_time_current() : 0;
+        scratch_enter();
+        m_set_func(m_range_offset + range.start, m_range_offset + range.end, m_user_data);
+        scratch_leave(threadnum);
+        if (trace) {
+            trace_record(threadnum, t0, (uint64_t)md_time_current(), INVALID_ID, STR("##Parallel For"));
+        }
+        current = prev;
+    }
+
+    RangeTask m_set_func = nullptr;
+    void*     m_user_data = nullptr;
+    uint32_t  m_range_offset = 0;
+};
+
 class MainTask : public enki::IPinnedTask {
 public:
     MainTask() = default;
-    MainTask(Task func, void* user_data, str_t lbl = {}, ID id = INVALID_ID, enki::ICompletable* dependency = 0) :
+    MainTask(Task func, void* user_data, str_t lbl = {}, ID id = INVALID_ID) :
         IPinnedTask(0), m_function(func), m_user_data(user_data), m_id(id) {
         int64_t len = MIN(lbl.len, LABEL_SIZE-1);
         m_label = {strncpy(m_buf, lbl.ptr, len), len};
-        if (dependency) {
-            SetDependency(m_dependency, dependency);
-        }
     }
     virtual void Execute() final {
+        const bool trace = trace_enabled();
+        const uint64_t t0 = trace ? (uint64_t)md_time_current() : 0;
+        scratch_enter();
         m_function(m_user_data);
-        main::free_slots.push(get_slot_idx(m_id));
+        scratch_leave(threadNum);
+        if (trace) {
+            trace_record(threadNum, t0, (uint64_t)md_time_current(), m_id, m_label);
+        }
+        complete_task(&m_link);
+        free_main_slot(get_slot_idx(m_id));
     }
 
     Task m_function = nullptr;
     void* m_user_data = nullptr;
-    enki::Dependency m_dependency;
+    TaskLink m_link;
     char m_buf[LABEL_SIZE];
     str_t m_label = {};
     ID m_id = INVALID_ID;
 };
 
+template <typename T>
+struct SlotPage {
+    T        tasks[PAGE_SIZE];
+    uint64_t generation[PAGE_SIZE];
+};
+
+// Growable pool of task slots. Allocation and release of slots are serialized by a mutex, which is only held for a few instructions,
+// so enqueueing never waits for other tasks to complete. Lookups of tasks by slot are lock free, as pages are published before they are counted.
+template <typename T>
+struct SlotPool {
+    SlotPage<T>* pages[MAX_PAGES];
+    std::atomic_uint32_t num_pages;
+    md_mutex_t mutex;
+
+    // FIFO of free slots, which has the capacity of all slots so it never overflows
+    uint32_t* free_ring;
+    uint32_t  free_cap;
+    uint32_t  free_head;
+    uint32_t  free_count;
+
+    // Slots of tasks which have completed their body, which the scheduler may still be finishing
+    md_array(uint32_t) retired;
+
+    // Slots of tasks which are enqueued without dependencies, which are submitted to the scheduler in execute_queued_tasks
+    md_array(uint32_t) queued;
+};
+
+template <typename T>
+static inline T* slot_task(SlotPool<T>& slots, uint32_t slot_idx) {
+    const uint32_t page_idx = slot_idx / PAGE_SIZE;
+    if (page_idx >= slots.num_pages.load(std::memory_order_acquire)) return NULL;
+    return &slots.pages[page_idx]->tasks[slot_idx % PAGE_SIZE];
+}
+
+template <typename T>
+static bool slot_pool_grow(SlotPool<T>& slots) {
+    const uint32_t page_idx = slots.num_pages.load(std::memory_order_relaxed);
+    if (page_idx == MAX_PAGES) return false;
+
+    SlotPage<T>* page = (SlotPage<T>*)md_alloc(md_heap_allocator, sizeof(SlotPage<T>));
+    PLACEMENT_NEW(page) SlotPage<T>();
+    MEMSET(page->generation, 0, sizeof(page->generation));
+    slots.pages[page_idx] = page;
+
+    // Linearize the ring into a larger one, the new slots go after the existing free slots
+    const uint32_t new_cap = (page_idx + 1) * PAGE_SIZE;
+    uint32_t* ring = (uint32_t*)md_alloc(md_heap_allocator, new_cap * sizeof(uint32_t));
+    for (uint32_t i = 0; i < slots.free_count; ++i) {
+        ring[i] = slots.free_ring[(slots.free_head + i) % slots.free_cap];
+    }
+    for (uint32_t i = 0; i < PAGE_SIZE; ++i) {
+        ring[slots.free_count + i] = page_idx * PAGE_SIZE + i;
+    }
+    if (slots.free_ring) {
+        md_free(md_heap_allocator, slots.free_ring, slots.free_cap * sizeof(uint32_t));
+    }
+    slots.free_ring  = ring;
+    slots.free_cap   = new_cap;
+    slots.free_head  = 0;
+    slots.free_count += PAGE_SIZE;
+
+    slots.num_pages.store(page_idx + 1, std::memory_order_release);
+    return true;
+}
+
+// Moves the retired slots whose tasks the scheduler has completed to the free slots, must be called with the mutex held
+template <typename T>
+static void slot_pool_reclaim(SlotPool<T>& slots) {
+    int64_t num_retired = 0;
+    for (int64_t i = 0; i < md_array_size(slots.retired); ++i) {
+        const uint32_t idx = slots.retired[i];
+        if (slots.pages[idx / PAGE_SIZE]->tasks[idx % PAGE_SIZE].GetIsComplete()) {
+            ASSERT(slots.free_count < slots.free_cap);
+            slots.free_ring[(slots.free_head + slots.free_count) % slots.free_cap] = idx;
+            slots.free_count += 1;
+        } else {
+            slots.retired[num_retired++] = idx;
+        }
+    }
+    md_array_shrink(slots.retired, num_retired);
+}
+
+// Returns the slot index and sets the generation of the allocated slot, or returns false if the pool is at its limit and all slots are in use
+template <typename T>
+static bool slot_pool_alloc(SlotPool<T>& slots, uint32_t* slot_idx, uint64_t* generation) {
+    md_mutex_lock(&slots.mutex);
+    if (slots.free_count == 0) {
+        slot_pool_reclaim(slots);
+    }
+    if (slots.free_count == 0) {
+        slot_pool_grow(slots);
+    }
+    bool result = false;
+    if (slots.free_count > 0) {
+        const uint32_t idx = slots.free_ring[slots.free_head];
+        slots.free_head = (slots.free_head + 1) % slots.free_cap;
+        slots.free_count -= 1;
+        *slot_idx   = idx;
+        *generation = ++slots.pages[idx / PAGE_SIZE]->generation[idx % PAGE_SIZE];
+        result = true;
+    }
+    md_mutex_unlock(&slots.mutex);
+    return result;
+}
+
+// Called by the task once it has completed, the slot is reused once the scheduler has completed the task as well
+template <typename T>
+static void slot_pool_retire(SlotPool<T>& slots, uint32_t slot_idx) {
+    md_mutex_lock(&slots.mutex);
+    md_array_push(slots.retired, slot_idx, md_heap_allocator);
+    md_mutex_unlock(&slots.mutex);
+}
+
+template <typename T>
+static void slot_pool_push_queued(SlotPool<T>& slots, uint32_t slot_idx) {
+    md_mutex_lock(&slots.mutex);
+    md_array_push(slots.queued, slot_idx, md_heap_allocator);
+    md_mutex_unlock(&slots.mutex);
+}
+
+// Moves the queued slots into out (which is cleared first), so they can be submitted without holding the lock
+// (submitting may execute the task on this thread if the pipe of the scheduler is full, which may in turn enqueue tasks)
+template <typename T>
+static void slot_pool_take_queued(SlotPool<T>& slots, md_array(uint32_t)* out) {
+    md_array_shrink(*out, 0);
+    md_mutex_lock(&slots.mutex);
+    if (md_array_size(slots.queued) > 0) {
+        md_array_push_array(*out, slots.queued, md_array_size(slots.queued), md_heap_allocator);
+        md_array_shrink(slots.queued, 0);
+    }
+    md_mutex_unlock(&slots.mutex);
+}
+
+template <typename T>
+static void slot_pool_init(SlotPool<T>& slots) {
+    md_mutex_init(&slots.mutex);
+    slot_pool_grow(slots);
+}
+
+template <typename T>
+static void slot_pool_free_all(SlotPool<T>& slots) {
+    const uint32_t num_pages = slots.num_pages.load(std::memory_order_acquire);
+    // The tasks are not destructed, only the dependents of tasks which never completed are freed
+    for (uint32_t i = 0; i < num_pages; ++i) {
+        for (uint32_t j = 0; j < PAGE_SIZE; ++j) {
+            md_array_free(slots.pages[i]->tasks[j].m_link.dependents, md_heap_allocator);
+        }
+        md_free(md_heap_allocator, slots.pages[i], sizeof(SlotPage<T>));
+        slots.pages[i] = NULL;
+    }
+    slots.num_pages = 0;
+    if (slots.free_ring) {
+        md_free(md_heap_allocator, slots.free_ring, slots.free_cap * sizeof(uint32_t));
+    }
+    slots.free_ring = NULL;
+    slots.free_cap = slots.free_head = slots.free_count = 0;
+    md_array_free(slots.retired, md_heap_allocator);
+    md_array_free(slots.queued, md_heap_allocator);
+    md_mutex_destroy(&slots.mutex);
+}
+
 namespace main {
-    static MainTask task_data[MAX_TASKS];
+    static SlotPool<MainTask> slots;
+    static md_array(uint32_t) submit;  // Only accessed from the main thread
+
+    // Slots of the tasks which are ready to execute, in the order they became ready, the first ready_head of which have been executed.
+    // Tasks which did not fit in the budget of a frame stay at the front, ahead of the tasks which become ready later.
+    static md_array(uint32_t) ready;
+    static int64_t ready_head;
+
+    static double avg_task_time;    // Moving average of the execution time of main tasks, in seconds
+    static double last_frame_time;  // Time spent executing main tasks in the last call of execute_queued_tasks
 }
 
 namespace pool {
-    static PoolTask task_data[MAX_TASKS];
+    static SlotPool<PoolTask> slots;
+    static md_array(uint32_t) submit;
+}
+
+static void free_pool_slot(uint32_t slot_idx) { slot_pool_retire(pool::slots, slot_idx); }
+static void free_main_slot(uint32_t slot_idx) { slot_pool_retire(main::slots, slot_idx); }
+
+static inline PoolTask* get_pool_task(ID id) {
+    if (id != INVALID_ID && get_kind(id) == TASK_KIND_POOL) {
+        PoolTask* task = slot_task(pool::slots, get_slot_idx(id));
+        if (task && task->m_id == id) return task;
+    }
+    return NULL;
 }
 
-static inline enki::ICompletable* get_task(ID id) {
-    if (id != INVALID_ID) {
-        uint32_t slot_idx = get_slot_idx(id);
-        PoolTask* ptask = &pool::task_data[slot_idx];
-        MainTask* mtask = &main::task_data[slot_idx];
-        if (ptask->m_id == id)       return ptask;
-        else if (mtask->m_id == id)  return mtask;
+static inline MainTask* get_main_task(ID id) {
+    if (id != INVALID_ID && get_kind(id) == TASK_KIND_MAIN) {
+        MainTask* task = slot_task(main::slots, get_slot_idx(id));
+        if (task && task->m_id == id) return task;
     }
     return NULL;
 }
 
+static inline TaskLink* get_task_link(ID id) {
+    if (PoolTask* task = get_pool_task(id)) return &task->m_link;
+    if (MainTask* task = get_main_task(id)) return &task->m_link;
+    return NULL;
+}
+
 static enki::TaskScheduler ts{};
 
-void initialize(uint32_t num_threads = 0) {
-    ts.Initialize(num_threads);
-    for (uint32_t i = 0; i < MAX_TASKS; i++) {
-        pool::free_slots.push(i);
-        main::free_slots.push(i);
+// Hands the pool task to the scheduler. An empty range is never executed by the scheduler, so it completes right away.
+static void submit_pool_task(PoolTask* task) {
+    if (task->m_SetSize == 0) {
+        complete_task(&task->m_link);
+        free_pool_slot(get_slot_idx(task->m_id));
+        return;
+    }
+    if (task->m_priority == PRIORITY_INTERACTIVE) {
+        task->m_counted_pending = true;
+        interactive_pending += 1;
+        interactive_last = task->m_id;
+    }
+    ts.AddTaskSetToPipe(task);
+}
+
+// Drops one of the dependencies the task waits for and launches it once none remain.
+// Tasks which are launched by the completion of a dependency are submitted directly, the others are queued for execute_queued_tasks.
+// Main tasks are always queued, so that all of them pass through the budgeted queue of execute_queued_tasks.
+static void release_task(ID id, bool submit) {
+    if (get_kind(id) == TASK_KIND_POOL) {
+        PoolTask* task = slot_task(pool::slots, get_slot_idx(id));
+        if (task->m_link.num_waiting.fetch_sub(1) == 1) {
+            if (submit) {
+                submit_pool_task(task);
+            } else {
+                slot_pool_push_queued(pool::slots, get_slot_idx(id));
+            }
+        }
+    } else {
+        MainTask* task = slot_task(main::slots, get_slot_idx(id));
+        if (task->m_link.num_waiting.fetch_sub(1) == 1) {
+            slot_pool_push_queued(main::slots, get_slot_idx(id));
+        }
+    }
+}
+
+// Called by the task once it has completed (before its slot is freed), launches the dependents which do not wait for other tasks
+static void complete_task(TaskLink* link) {
+    md_mutex_lock(&dependency_mutex);
+    link->completed = true;
+    md_array(ID) dependents = link->dependents;
+    link->dependents = 0;
+    md_mutex_unlock(&dependency_mutex);
+
+    for (int64_t i = 0; i < md_array_size(dependents); ++i) {
+        release_task(dependents[i], true);
+    }
+    md_array_free(dependents, md_heap_allocator);
+}
+
+// Registers the task as a dependent of the dependencies which have not completed yet, invalid and completed dependencies are ignored.
+// Must be called with dependency_mutex held, the task is launched by release_task once the registration is complete.
+static void add_dependencies(ID id, TaskLink* link, const ID* ids, uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+        TaskLink* dep = get_task_link(ids[i]);
+        if (dep && !dep->completed) {
+            md_array_push(dep->dependents, id, md_heap_allocator);
+            link->num_waiting += 1;
+        }
     }
 }
 
-void shutdown() { ts.WaitforAllAndShutdown(); }
+// First core of the range which the threads are pinned to, -1 if they are not pinned
+static int32_t pin_first_core = -1;
 
-void execute_queued_tasks() {
-    while (!pool::queued_slots.was_empty()) {
-        uint32_t idx = pool::queued_slots.pop();
-        ts.AddTaskSetToPipe(&pool::task_data[idx]);
+// Core of each thread of the scheduler (indexed by thread number) while the threads are pinned
+static md_array(uint32_t) pin_cores = 0;
+
+// Set once threads have been pinned, from then on threads which are not pinned are reset to the affinity of the process
+// (the calling thread keeps its pinned affinity across restarts of the scheduler, and workers inherit it from the thread which creates them)
+static bool affinity_changed = false;
+
+#if MD_PLATFORM_WINDOWS
+static DWORD_PTR process_affinity = 0;
+#elif !MD_PLATFORM_OSX
+static cpu_set_t process_affinity;
+#endif
+
+static void save_process_affinity() {
+#if MD_PLATFORM_WINDOWS
+    DWORD_PTR system_affinity = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_affinity, &system_affinity)) {
+        process_affinity = 0;
     }
-    while (!main::queued_slots.was_empty()) {
-        uint32_t idx = main::queued_slots.pop();
-        ts.AddPinnedTask(&main::task_data[idx]);
+#elif !MD_PLATFORM_OSX
+    if (sched_getaffinity(0, sizeof(process_affinity), &process_affinity) != 0) {
+        CPU_ZERO(&process_affinity);
     }
-    ts.RunPinnedTasks();
+#endif
 }
 
-ID main_enqueue(str_t label, Task func, void* user_data, ID dependency) {
+// If the process may run on the core (affinity masks and cpusets given by taskset, cgroups or a job scheduler restrict this)
+static bool core_allowed(uint32_t core) {
+#if MD_PLATFORM_WINDOWS
+    // The thread affinity mask of a process only covers the 64 cores of its processor group
+    if (core >= 64) return false;
+    return process_affinity == 0 || (process_affinity & ((DWORD_PTR)1 << core));
+#elif !MD_PLATFORM_OSX
+    if (core >= CPU_SETSIZE) return false;
+    return CPU_COUNT(&process_affinity) == 0 || CPU_ISSET(core, &process_affinity);
+#else
+    return core < (uint32_t)md_os_num_processors();
+#endif
+}
+
+// Upper bound of the core indices to consider, the indices of allowed cores are not necessarily below the number of cores (e.g. within a cpuset)
+static uint32_t core_limit() {
+    const uint32_t num_cores = (uint32_t)md_os_num_processors();
+#if MD_PLATFORM_WINDOWS
+    return process_affinity ? 64 : MIN(num_cores, 64U);
+#elif !MD_PLATFORM_OSX
+    return CPU_COUNT(&process_affinity) > 0 ? CPU_SETSIZE : MIN(num_cores, (uint32_t)CPU_SETSIZE);
+#else
+    return num_cores;
+#endif
+}
+
+static void restore_affinity(uint32_t threadnum) {
+#if MD_PLATFORM_WINDOWS
+    if (process_affinity && !SetThreadAffinityMask(GetCurrentThread(), process_affinity)) {
+        MD_LOG_ERROR("Task system: Failed to restore the affinity of thread %u", threadnum);
+    }
+#elif !MD_PLATFORM_OSX
+    if (CPU_COUNT(&process_affinity) > 0 && pthread_setaffinity_np(pthread_self(), sizeof(process_affinity), &process_affinity) != 0) {
+        MD_LOG_ERROR("Task system: Failed to restore the affinity of thread %u", threadnum);
+    }
+#else
+    (void)threadnum;
+#endif
+}
+
+// Threads are pinned to consecutive cores (of the cores the process may run on), which on most systems are also on the same NUMA node.
+// On macOS threads cannot be pinned, affinity is only a hint there.
+static void pin_thread(uint32_t threadnum) {
+    if (pin_first_core < 0) {
+        if (affinity_changed) {
+            restore_affinity(threadnum);
+        }
+        return;
+    }
+    if (threadnum >= md_array_size(pin_cores)) {
+        MD_LOG_ERROR("Task system: No core was assigned to thread %u, it is not pinned", threadnum);
+        return;
+    }
+    const uint32_t core = pin_cores[threadnum];
+#if MD_PLATFORM_WINDOWS
+    if (!SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core)) {
+        MD_LOG_ERROR("Task system: Failed to pin thread %u to core %u", threadnum, core);
+    }
+#elif !MD_PLATFORM_OSX
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        MD_LOG_ERROR("Task system: Failed to pin thread %u to core %u", threadnum, core);
+    }
+#else
+    (void)core;
+#endif
+}
+
+static void start_scheduler(uint32_t num_threads, int32_t first_core) {
+    num_threads = MAX(1U, num_threads);
+
+    // The threads are assigned the cores from first_core on which the process may run, cores outside of its affinity are skipped
+    md_array_shrink(pin_cores, 0);
+    if (first_core >= 0) {
+        const uint32_t limit = core_limit();
+        for (uint32_t core = (uint32_t)first_core; core < limit && (uint32_t)md_array_size(pin_cores) < num_threads; ++core) {
+            if (core_allowed(core)) {
+                md_array_push(pin_cores, core, md_heap_allocator);
+            }
+        }
+        if ((uint32_t)md_array_size(pin_cores) < num_threads) {
+            MD_LOG_ERROR("Task system: Only %u of the cores from core %i on are available to the process, which is not enough to pin %u threads, the threads are not pinned",
+                (uint32_t)md_array_size(pin_cores), first_core, num_threads);
+            md_array_shrink(pin_cores, 0);
+            first_core = -1;
+        }
+    }
+    pin_first_core = first_core;
+    if (first_core >= 0) {
+        affinity_changed = true;
+    }
+
+    enki::TaskSchedulerConfig config;
+    config.numTaskThreadsToCreate = num_threads - 1;
+    config.profilerCallbacks.threadStart = pin_thread;
+    ts.Initialize(config);
+    pin_thread(0);  // The calling thread is thread 0 of the scheduler
+
+    scratch::num_arenas = num_threads;
+    scratch::arenas = (md_allocator_i**)md_alloc(md_heap_allocator, num_threads * sizeof(md_allocator_i*));
+    MEMSET(scratch::arenas, 0, num_threads * sizeof(md_allocator_i*));
+
+    MD_LOG_INFO("Task system: %u threads%s", num_threads, first_core >= 0 ? " (pinned)" : "");
+}
+
+static void free_scratch_arenas() {
+    for (uint32_t i = 0; i < scratch::num_arenas; ++i) {
+        if (scratch::arenas[i]) md_arena_allocator_destroy(scratch::arenas[i]);
+    }
+    if (scratch::arenas) {
+        md_free(md_heap_allocator, scratch::arenas, scratch::num_arenas * sizeof(md_allocator_i*));
+    }
+    scratch::arenas = NULL;
+    scratch::num_arenas = 0;
+}
+
+static void free_trace_rings() {
+    for (uint32_t i = 0; i < profiler::num_rings; ++i) {
+        md_free(md_heap_allocator, profiler::rings[i], sizeof(TraceRing));
+    }
+    if (profiler::rings) {
+        md_free(md_heap_allocator, profiler::rings, profiler::num_rings * sizeof(TraceRing*));
+    }
+    profiler::rings = NULL;
+    profiler::num_rings = 0;
+}
+
+void initialize(uint32_t num_threads, int32_t first_core) {
+    save_process_affinity();
+    md_mutex_init(&dependency_mutex);
+    start_scheduler(num_threads, first_core);
+    slot_pool_init(pool::slots);
+    slot_pool_init(main::slots);
+}
+
+void set_num_threads(uint32_t num_threads, int32_t first_core) {
+    if (num_threads == ts.GetNumTaskThreads() && first_core == pin_first_core) return;
+
+    ts.WaitforAllAndShutdown();
+
+    // The rings of the profiler are per thread
+    const bool profiling = profiler::enabled;
+    profiler::enabled = false;
+    free_trace_rings();
+    free_scratch_arenas();
+
+    start_scheduler(num_threads, first_core);
+    if (profiling) {
+        profiler_set_enabled(true);
+    }
+}
+
+int32_t pinned_first_core() {
+    return pin_first_core;
+}
+
+void shutdown() {
+    ts.WaitforAllAndShutdown();
+    md_array_free(pin_cores, md_heap_allocator);
+    profiler::enabled = false;
+    free_trace_rings();
+    free_scratch_arenas();
+    slot_pool_free_all(pool::slots);
+    slot_pool_free_all(main::slots);
+    md_mutex_destroy(&dependency_mutex);
+    md_array_free(pool::submit, md_heap_allocator);
+    md_array_free(main::submit, md_heap_allocator);
+    md_array_free(main::ready, md_heap_allocator);
+    main::ready_head = 0;
+}
+
+// Moves the main tasks which have become ready (queued directly or by the completion of their dependencies) to the back of the ready list
+static void take_ready_main_tasks() {
+    slot_pool_take_queued(main::slots, &main::submit);
+    if (md_array_size(main::submit) > 0) {
+        md_array_push_array(main::ready, main::submit, md_array_size(main::submit), md_heap_allocator);
+    }
+}
+
+void execute_queued_tasks(double time_budget_ms) {
+    slot_pool_take_queued(pool::slots, &pool::submit);
+    for (int64_t i = 0; i < md_array_size(pool::submit); ++i) {
+        submit_pool_task(slot_task(pool::slots, pool::submit[i]));
+    }
+
     using namespace main;
-    uint32_t idx = free_slots.pop();
+    take_ready_main_tasks();
+
+    // Main tasks are submitted one at a time until the budget is spent, at least one is executed per call so the queue always progresses.
+    // Main tasks which are launched by the completion of a task within the same call are executed in it as well.
+    const md_timestamp_t t0 = md_time_current();
+    double elapsed = 0.0;
+    while (ready_head < md_array_size(ready)) {
+        if (time_budget_ms > 0.0 && elapsed > 0.0 && elapsed * 1000.0 >= time_budget_ms) break;
+        MainTask* task = slot_task(slots, ready[ready_head++]);
+        const md_timestamp_t t = md_time_current();
+        ts.AddPinnedTask(task);
+        ts.RunPinnedTasks();
+        const md_timestamp_t t1 = md_time_current();
+        avg_task_time = avg_task_time == 0.0 ? md_time_as_seconds(t1 - t) : avg_task_time * 0.9 + md_time_as_seconds(t1 - t) * 0.1;
+        elapsed = md_time_as_seconds(t1 - t0);
+        take_ready_main_tasks();
+    }
+    last_frame_time = elapsed;
+
+    // Compact the deferred tasks to the front
+    const int64_t num_deferred = md_array_size(ready) - ready_head;
+    if (ready_head > 0) {
+        if (num_deferred > 0) {
+            memmove(ready, ready + ready_head, num_deferred * sizeof(uint32_t));
+        }
+        md_array_shrink(ready, num_deferred);
+        ready_head = 0;
+    }
+}
+
+main_queue_stats_t main_queue_stats() {
+    main_queue_stats_t stats = {};
+    stats.num_ready     = (uint32_t)(md_array_size(main::ready) - main::ready_head);
+    stats.avg_task_ms   = main::avg_task_time * 1000.0;
+    stats.estimated_ms  = stats.num_ready * stats.avg_task_ms;
+    stats.last_frame_ms = main::last_frame_time * 1000.0;
+    return stats;
+}
 
-    ID id = generate_id(idx);
-    MainTask* Task = &task_data[idx];
-    enki::ICompletable* dep_task = get_task(dependency);
-    PLACEMENT_NEW(Task) MainTask(func, user_data, label, id, dep_task);
+ID main_enqueue(str_t label, Task func, void* user_data, ID dependency) {
+    return main_enqueue(label, func, user_data, &dependency, dependency != INVALID_ID ? 1 : 0);
+}
 
-    if (!dep_task) {
-        queued_slots.push(idx);
+ID main_enqueue(str_t label, Task func, void* user_data, const ID* dependencies, uint32_t num_dependencies) {
+    using namespace main;
+    uint32_t idx;
+    uint64_t generation;
+    if (!slot_pool_alloc(slots, &idx, &generation)) {
+        MD_LOG_ERROR("Task system: Exhausted all %u main task slots, task '%.*s' was not enqueued", MAX_PAGES * PAGE_SIZE, (int)label.len, label.ptr);
+        return INVALID_ID;
     }
-    
+
+    // The task is constructed under the lock as well, as a registration for an ID which previously used the slot may inspect it concurrently
+    ID id = make_id(TASK_KIND_MAIN, idx, generation);
+    md_mutex_lock(&dependency_mutex);
+    MainTask* Task = slot_task(slots, idx);
+    PLACEMENT_NEW(Task) MainTask(func, user_data, label, id);
+    add_dependencies(id, &Task->m_link, dependencies, num_dependencies);
+    md_mutex_unlock(&dependency_mutex);
+    release_task(id, false);
+
     return id;
 }
 
 uint32_t pool_num_threads() { return ts.GetNumTaskThreads(); }
 
+void pool_parallel_for(uint32_t range_beg, uint32_t range_end, uint32_t grain_size, RangeTask func, void* user_data) {
+    ASSERT(func);
+    if (range_end <= range_beg) return;
+
+    grain_size = MAX(1U, grain_size);
+    if (range_end - range_beg <= grain_size || ts.GetNumTaskThreads() <= 1) {
+        func(range_beg, range_end, user_data);
+        return;
+    }
+
+    ImmediateTask task(range_beg, range_end, grain_size, func, user_data);
+    ts.AddTaskSetToPipe(&task);
+    ts.WaitforTask(&task, enki::TASK_PRIORITY_HIGH);
+}
+
 ID* pool_running_tasks(md_allocator_i* alloc) {
     ASSERT(alloc);
     ID* arr = 0;
-    for (uint32_t i = 0; i < MAX_TASKS; ++i) {
-        if (pool::task_data[i].Running()) {
-            md_array_push(arr, pool::task_data[i].m_id, alloc);
+    const uint32_t num_slots = pool::slots.num_pages.load(std::memory_order_acquire) * PAGE_SIZE;
+    for (uint32_t i = 0; i < num_slots; ++i) {
+        PoolTask* task = slot_task(pool::slots, i);
+        if (task->Running()) {
+            md_array_push(arr, task->m_id, alloc);
         }
     }
     return arr;
 }
 
 void pool_interrupt_running_tasks() {
-    for (uint32_t i = 0; i < MAX_TASKS; ++i) {
-        if (pool::task_data[i].Running()) {
-            pool::task_data[i].m_interrupt = true;
+    const uint32_t num_slots = pool::slots.num_pages.load(std::memory_order_acquire) * PAGE_SIZE;
+    for (uint32_t i = 0; i < num_slots; ++i) {
+        PoolTask* task = slot_task(pool::slots, i);
+        if (task->Running()) {
+            task->m_interrupt = true;
         }
     }
 }
 
-ID pool_enqueue(str_t label, Task func, void* user_data, ID dependency) {
-    using namespace pool;
-
-    uint32_t slot_idx = free_slots.pop();
+ID pool_enqueue(str_t label, Task func, void* user_data, ID dependency, Priority priority) {
+    return pool_enqueue(label, func, user_data, &dependency, dependency != INVALID_ID ? 1 : 0, priority);
+}
 
-    ID id = generate_id(slot_idx);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    enki::ICompletable* dep_task = get_task(dependency);
-    PLACEMENT_NEW(Task) PoolTask(func, user_data, label, id, dep_task);
+ID pool_enqueue(str_t label, Task func, void* user_data, const ID* dependencies, uint32_t num_dependencies, Priority priority) {
+    using namespace pool;
 
-    if (!dep_task) {
-        queued_slots.push(slot_idx);
+    uint32_t slot_idx;
+    uint64_t generation;
+    if (!slot_pool_alloc(slots, &slot_idx, &generation)) {
+        MD_LOG_ERROR("Task system: Exhausted all %u pool task slots, task '%.*s' was not enqueued", MAX_PAGES * PAGE_SIZE, (int)label.len, label.ptr);
+        return INVALID_ID;
     }
 
+    ID id = make_id(TASK_KIND_POOL, slot_idx, generation);
+    md_mutex_lock(&dependency_mutex);
+    PoolTask* Task = slot_task(slots, slot_idx);
+    PLACEMENT_NEW(Task) PoolTask(func, user_data, label, id, priority);
+    add_dependencies(id, &Task->m_link, dependencies, num_dependencies);
+    md_mutex_unlock(&dependency_mutex);
+    release_task(id, false);
+
     return id;
 }
 
-ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask range_func, void* user_data, ID dependency) {
-    using namespace pool;
-
-    uint32_t slot_idx = free_slots.pop();
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask range_func, void* user_data, ID dependency, Priority priority, uint32_t partition_size) {
+    return pool_enqueue(label, range_beg, range_end, range_func, user_data, &dependency, dependency != INVALID_ID ? 1 : 0, priority, partition_size);
+}
 
-    ID id = generate_id(slot_idx);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    enki::ICompletable* dep_task = get_task(dependency);
-    PLACEMENT_NEW(Task) PoolTask(range_beg, range_end, range_func, user_data, label, id, dep_task);
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask range_func, void* user_data, const ID* dependencies, uint32_t num_dependencies, Priority priority, uint32_t partition_size) {
+    using namespace pool;
 
-    if (!dep_task) {
-        queued_slots.push(slot_idx);
+    uint32_t slot_idx;
+    uint64_t generation;
+    if (!slot_pool_alloc(slots, &slot_idx, &generation)) {
+        MD_LOG_ERROR("Task system: Exhausted all %u pool task slots, task '%.*s' was not enqueued", MAX_PAGES * PAGE_SIZE, (int)label.len, label.ptr);
+        return INVALID_ID;
     }
 
+    ID id = make_id(TASK_KIND_POOL, slot_idx, generation);
+    md_mutex_lock(&dependency_mutex);
+    PoolTask* Task = slot_task(slots, slot_idx);
+    PLACEMENT_NEW(Task) PoolTask(range_beg, range_end, range_func, user_data, label, id, priority, partition_size);
+    add_dependencies(id, &Task->m_link, dependencies, num_dependencies);
+    md_mutex_unlock(&dependency_mutex);
+    release_task(id, false);
+
     return id;
 }
 
+ID join(const ID* ids, uint32_t count) {
+    // An empty task, which is launched when all of ids have completed and completes immediately.
+    // It is interactive as it holds up its dependents and does no work of its own.
+    return pool_enqueue(STR("##Join"), (Task)0, 0, ids, count, PRIORITY_INTERACTIVE);
+}
+
+// Called by background tasks between their partitions: while interactive tasks are pending, the worker takes part in their execution
+// (restricted to interactive and immediate tasks) rather than continuing with the background work.
+// The partition boundary is a point where the background task holds no locks, so this cannot block on the background task itself.
+// This continues until no interactive task is pending, not only until the most recently submitted one has completed.
+static void yield_to_interactive() {
+    while (interactive_pending.load(std::memory_order_relaxed) > 0) {
+        PoolTask* task = get_pool_task(interactive_last.load(std::memory_order_relaxed));
+        if (task && task->Running()) {
+            ts.WaitforTask(task, enki::TASK_PRIORITY_MED);
+        } else {
+            // Runs at most one interactive or immediate task if there is one in the pipes, the remaining pending tasks may be executing on other threads
+            ts.WaitforTask(nullptr, enki::TASK_PRIORITY_MED);
+            std::this_thread::yield();
+        }
+    }
+}
+
 bool task_is_running(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    return Task->m_id == id ? Task->Running() : false;
+    PoolTask* Task = get_pool_task(id);
+    return Task ? Task->Running() : false;
 }
 
 str_t task_label(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    return Task->m_id == id ? Task->m_label : str_t{};
+    PoolTask* Task = get_pool_task(id);
+    return Task ? Task->m_label : str_t{};
 }
 
 float task_fraction_complete(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    return Task->m_id == id ? (float)Task->m_set_completed / (float)Task->m_SetSize : 0.f;
+    PoolTask* Task = get_pool_task(id);
+    return Task ? MIN(1.0f, (float)Task->m_progress / (float)Task->m_SetSize) : 0.f;
+}
+
+ID current_task() {
+    return current.task ? current.task->m_id : INVALID_ID;
+}
+
+bool current_task_interrupted() {
+    return current.task ? (bool)current.task->m_interrupt : false;
+}
+
+void current_task_progress(uint32_t count) {
+    if (current.task) {
+        count = MIN(count, current.chunk_size - current.reported);
+        current.reported += count;
+        current.task->m_progress += count;
+    }
+}
+
+md_allocator_i* current_task_scratch() {
+    const uint32_t thread = ts.GetThreadNum();
+    if (scratch::depth == 0 || thread >= scratch::num_arenas) return md_heap_allocator;
+    md_allocator_i*& arena = scratch::arenas[thread];
+    if (!arena) {
+        arena = md_arena_allocator_create(md_heap_allocator, SCRATCH_PAGE_SIZE);
+    }
+    return arena;
 }
 
 void task_wait_for(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    if (Task->m_id == id && Task->Running()) {
+    PoolTask* Task = get_pool_task(id);
+    if (Task && Task->Running()) {
         ts.WaitforTask(Task);
     }
 }
 
 void task_interrupt(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    if (Task->m_id == id) {
+    PoolTask* Task = get_pool_task(id);
+    if (Task) {
         Task->m_interrupt = true;
     }
 }
 
 void task_interrupt_and_wait_for(ID id) {
-    uint32_t slot_idx = get_slot_idx(id);
-    PoolTask* Task = &pool::task_data[slot_idx];
-    if (Task->m_id == id && Task->Running()) {
+    PoolTask* Task = get_pool_task(id);
+    if (Task && Task->Running()) {
         Task->m_interrupt = true;
         ts.WaitforTask(Task);
     }
 }
 
+void profiler_set_enabled(bool enable) {
+    if (enable && !profiler::rings) {
+        const uint32_t num_threads = ts.GetNumTaskThreads();
+        TraceRing** rings = (TraceRing**)md_alloc(md_heap_allocator, num_threads * sizeof(TraceRing*));
+        for (uint32_t i = 0; i < num_threads; ++i) {
+            rings[i] = (TraceRing*)md_alloc(md_heap_allocator, sizeof(TraceRing));
+            MEMSET(rings[i], 0, sizeof(TraceRing));
+        }
+        profiler::rings = rings;
+        profiler::num_rings = num_threads;
+    }
+    profiler::enabled.store(enable, std::memory_order_release);
+}
+
+bool profiler_enabled() {
+    return trace_enabled();
+}
+
+void profiler_clear() {
+    // The rings are only written by their threads, so events are discarded by their time rather than by resetting the rings
+    profiler::clear_time = (uint64_t)md_time_current();
+}
+
+void profiler_push_section(const char* label) {
+    using namespace profiler;
+    if (!trace_enabled()) return;
+    if (num_sections < MAX_TRACE_SECTIONS) {
+        sections[num_sections] = {(uint64_t)md_time_current(), label};
+    }
+    num_sections += 1;
+}
+
+void profiler_pop_section() {
+    using namespace profiler;
+    if (num_sections == 0) return;  // Recording was enabled within the section
+    num_sections -= 1;
+    if (num_sections < MAX_TRACE_SECTIONS && trace_enabled()) {
+        const uint32_t thread = ts.GetThreadNum();
+        trace_record(thread, sections[num_sections].beg, (uint64_t)md_time_current(), INVALID_ID, str_from_cstr(sections[num_sections].label));
+    }
+}
+
+trace_event_t* profiler_events(md_allocator_i* alloc) {
+    ASSERT(alloc);
+    trace_event_t* events = 0;
+    for (uint32_t i = 0; i < profiler::num_rings; ++i) {
+        const TraceRing* ring = profiler::rings[i];
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        const uint64_t beg = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        const int64_t offset = md_array_size(events);
+        for (uint64_t j = beg; j < head; ++j) {
+            md_array_push(events, ring->events[j % TRACE_RING_SIZE], alloc);
+        }
+        // Events which the writer may have overwritten during the copy: slots up to and including the one of the event it is writing now
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const uint64_t new_head = ring->head.load(std::memory_order_relaxed);
+        const uint64_t valid_beg = new_head >= TRACE_RING_SIZE ? new_head - TRACE_RING_SIZE + 1 : 0;
+        int64_t num_valid = 0;
+        for (uint64_t j = beg; j < head; ++j) {
+            const trace_event_t& event = events[offset + (int64_t)(j - beg)];
+            if (j >= valid_beg && event.beg >= profiler::clear_time) {
+                events[offset + num_valid++] = event;
+            }
+        }
+        md_array_shrink(events, offset + num_valid);
+    }
+    return events;
+}
+
+static void write_json_string(FILE* file, const char* str) {
+    fputc('"', file);
+    for (const char* c = str; *c; ++c) {
+        if (*c == '"' || *c == '\\') fputc('\\', file);
+        if ((unsigned char)*c >= 0x20) fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+bool profiler_write_chrome_trace(str_t path) {
+    trace_event_t* events = profiler_events(md_heap_allocator);
+    defer { md_array_free(events, md_heap_allocator); };
+
+    char file_path[2048];
+    snprintf(file_path, sizeof(file_path), "%.*s", (int)path.len, path.ptr);
+    FILE* file = fopen(file_path, "w");
+    if (!file) {
+        MD_LOG_ERROR("Could not open file '%s' for writing", file_path);
+        return false;
+    }
+
+    // Timestamps are in microseconds relative to the first event
+    uint64_t t0 = UINT64_MAX;
+    for (int64_t i = 0; i < md_array_size(events); ++i) {
+        t0 = MIN(t0, events[i].beg);
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (uint32_t i = 0; i < profiler::num_rings; ++i) {
+        fprintf(file, "%s  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s %u\"}}", i > 0 ? ",\n" : "", i, i == 0 ? "Main" : "Worker", i);
+    }
+    for (int64_t i = 0; i < md_array_size(events); ++i) {
+        const trace_event_t& e = events[i];
+        const double ts_us  = md_time_as_seconds((md_timestamp_t)(e.beg - t0)) * 1.0e6;
+        const double dur_us = md_time_as_seconds((md_timestamp_t)(e.end - e.beg)) * 1.0e6;
+        fprintf(file, ",\n  {\"name\": ");
+        write_json_string(file, e.label);
+        fprintf(file, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"id\": %llu}}", e.thread, ts_us, dur_us, (unsigned long long)e.id);
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
+
 };  // namespace task_system
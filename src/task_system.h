@@ -9,6 +9,7 @@ struct md_allocator_i;
 
 namespace task_system {
 
+// IDs are unique over the lifetime of the task system, the ID of a completed task never refers to a later task
 typedef uint64_t ID;
 constexpr ID INVALID_ID = 0;
 
@@ -18,32 +19,97 @@ constexpr ID INVALID_ID = 0;
 using Task = void (*)(void* user_data);
 using RangeTask = void (*)(uint32_t range_beg, uint32_t range_end, void* user_data);
 
+// Priority lanes of the thread-pool.
+// Interactive: short tasks which the responsiveness of the UI depends on (prefetching of frames for playback, densities of the current selection).
+// Normal: the default.
+// Background: long running tasks (evaluation over all frames), which yield to pending interactive tasks between their partitions.
+enum Priority : uint32_t {
+    PRIORITY_INTERACTIVE = 0,
+    PRIORITY_NORMAL,
+    PRIORITY_BACKGROUND,
+};
+
 /*
 typedef void (*Task) (void* user_data);
 typedef void (*RangeTask)(uint32_t range_beg, uint32_t range_end, void *user_data);
 */
 
-void initialize(uint32_t num_threads);
+// num_threads is the total number of threads of the pool, which includes the calling (main) thread.
+// If first_core is non-negative, thread i is pinned to the i'th core from first_core on which the process may run (cores outside of its affinity mask are skipped),
+// e.g. to give each session a fixed slice of a shared machine. If there are not enough such cores, the threads are not pinned and this is logged.
+void initialize(uint32_t num_threads, int32_t first_core = -1);
 void shutdown();
 
+// Recreates the thread-pool with another number of threads or pinning, this blocks until all running tasks have completed.
+// Tasks which are queued and not yet executing are kept.
+void set_num_threads(uint32_t num_threads, int32_t first_core = -1);
+
+// First core of the pinned threads, -1 if the threads are not pinned
+int32_t pinned_first_core();
+
 // Call once per frame at some approriate time, if there are items in the main queue, the main thread will be stalled.
 // Pool tasks will not stall the main thread.
-void execute_queued_tasks();
+// Main tasks are executed in the order they became ready until time_budget_ms has been spent, the remaining ones are deferred to the following calls
+// (ahead of tasks which become ready later). At least one task is executed per call. A budget of 0 executes all ready tasks.
+void execute_queued_tasks(double time_budget_ms = 0);
+
+// Main tasks which are ready and waiting for execute_queued_tasks, e.g. to throttle the submission of work which completes on the main thread
+struct main_queue_stats_t {
+    uint32_t num_ready;
+    double   avg_task_ms;    // Moving average of the execution time of main tasks
+    double   estimated_ms;   // Estimated time to execute the ready tasks (num_ready * avg_task_ms)
+    double   last_frame_ms;  // Time spent executing main tasks in the last call of execute_queued_tasks
+};
+
+main_queue_stats_t main_queue_stats();
 
 // Execute the task immediately.
 // If the task is queued for the main thread, it will stall the thread and wait for completion.
 // If the task us queued for the thread-pool, it will continue execution immediately.
 void execute_task(ID);
 
+// Enqueueing never blocks, the number of task slots grows with the number of tasks in flight (up to 65536 of each kind, beyond that INVALID_ID is returned).
 // This is to generate tasks for the main thread ("render" thread)
 ID main_enqueue(str_t label, Task task, void* user_data = 0, ID dependency = 0);
 
 // This is to generate tasks for the thread-pool (async operations)
-ID pool_enqueue(str_t label, Task task, void* user_data = 0, ID dependency = 0);
-ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask task, void* user_data = 0, ID dependency = 0);
+// The priority applies from when the task is launched, i.e. once its dependencies have completed.
+ID pool_enqueue(str_t label, Task task, void* user_data = 0, ID dependency = 0, Priority priority = PRIORITY_NORMAL);
+// partition_size limits the number of items passed to each invocation of a range task (0 leaves it to the scheduler), the interrupt is checked between invocations.
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask task, void* user_data = 0, ID dependency = 0, Priority priority = PRIORITY_NORMAL, uint32_t partition_size = 0);
+
+// Task graphs: these launch the task (a continuation) once all of the dependencies have completed, without any polling from the main thread.
+// Dependencies which are invalid or have already completed are ignored, if none remain the task is queued directly.
+// Any task may be given as a dependency, including tasks which are executing or about to complete, and there is no limit on the number of dependencies.
+ID main_enqueue(str_t label, Task task, void* user_data, const ID* dependencies, uint32_t num_dependencies);
+ID pool_enqueue(str_t label, Task task, void* user_data, const ID* dependencies, uint32_t num_dependencies, Priority priority = PRIORITY_NORMAL);
+ID pool_enqueue(str_t label, uint32_t range_beg, uint32_t range_end, RangeTask task, void* user_data, const ID* dependencies, uint32_t num_dependencies, Priority priority = PRIORITY_NORMAL, uint32_t partition_size = 0);
+
+// Fan-in: returns the ID of a task which completes once all of ids have completed, e.g. to use as a single dependency of several continuations
+ID join(const ID* ids, uint32_t count);
 
 uint32_t pool_num_threads();
 
+// Executes the range [range_beg, range_end) on the thread-pool immediately (not deferred to execute_queued_tasks), split into chunks of at least grain_size,
+// and returns once all chunks have completed. The calling thread takes part in the execution.
+// Can be called from the main thread and from within pool tasks, while waiting the calling thread only picks up chunks of other immediate tasks,
+// so it is safe to call while holding locks which queued pool tasks may also take.
+void pool_parallel_for(uint32_t range_beg, uint32_t range_end, uint32_t grain_size, RangeTask task, void* user_data = 0);
+
+// These are called from within the body of a pool task and refer to the task which is executed by the calling thread.
+// Bodies which loop over many items (e.g. frames) should poll current_task_interrupted() per item and return early if set,
+// and report completed items through current_task_progress(), which task_fraction_complete reflects immediately rather than once the invocation returns.
+// Items which are skipped or cut short by an interrupt do not count as completed (only the items reported until then do).
+// Outside of pool task bodies, current_task() returns INVALID_ID and the others do nothing.
+ID   current_task();
+bool current_task_interrupted();
+void current_task_progress(uint32_t count = 1);
+
+// Scratch memory for the body of a task (pool, main or a chunk of pool_parallel_for): an arena of the calling thread, which is reset once the body returns
+// (after each invocation of a range task), so allocating from it does not contend with other threads on the heap and nothing needs to be freed.
+// Allocations must not outlive the invocation. Outside of task bodies this returns md_heap_allocator, so code which frees its allocations works in either case.
+md_allocator_i* current_task_scratch();
+
 // These do not really reflect the 'current' state since that is illdefined. But rather what the state was at the time of the function call.
 void pool_interrupt_running_tasks();
 ID*  pool_running_tasks(md_allocator_i* alloc);
@@ -58,6 +124,31 @@ void task_wait_for(ID);
 void task_interrupt(ID);
 void task_interrupt_and_wait_for(ID);
 
+// Profiler of the execution of tasks, for finding oversubscription and idle threads.
+// When enabled, every invocation of a task body (a partition of a range task, a main task, a chunk of pool_parallel_for) is recorded with the thread which executed it.
+// Each thread keeps the most recent 4096 events.
+struct trace_event_t {
+    uint64_t beg;       // In ticks of md_time_current
+    uint64_t end;
+    ID       id;        // INVALID_ID for chunks of pool_parallel_for and sections
+    uint32_t thread;    // 0 is the main thread
+    char     label[32];
+};
+
+void profiler_set_enabled(bool enable);
+bool profiler_enabled();
+void profiler_clear();
+
+// Sections of code (on any thread of the scheduler) which are recorded as events while the profiler is enabled, these nest
+void profiler_push_section(const char* label);
+void profiler_pop_section();
+
+// Returns the recorded events as an md_array, ordered by time per thread
+trace_event_t* profiler_events(md_allocator_i* alloc);
+
+// Writes the recorded events in the Chrome trace event format, which can be viewed in chrome://tracing or Perfetto
+bool profiler_write_chrome_trace(str_t path);
+
 /*
 ID task_create(str_t label, Task Task);
 ID task_create(str_t label, uint32_t range_size, RangeTask RangeTask);
@@ -0,0 +1,505 @@
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <traj_index.h>
+#include <mapped_file.h>
+
+#include <core/md_common.h>
+#include <core/md_platform.h>
+#include <core/md_allocator.h>
+#include <core/md_array.h>
+#include <core/md_log.h>
+#include <core/md_os.h>
+#include <md_trajectory.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define TRAJ_INDEX_MAGIC   0x58444956 // 'VIDX'
+#define TRAJ_INDEX_VERSION 1
+// Number of bytes at the head and the tail of the trajectory which are included in the checksum
+#define TRAJ_INDEX_CHECKSUM_BYTES KILOBYTES(64)
+// Max number of bytes at the head of the file which are searched for the first frame
+#define TRAJ_INDEX_MAX_HEAD_BYTES MEGABYTES(64)
+
+struct TrajIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t cell_stride;       // Stride of the per frame cell entries (which depends on sizeof(md_unit_cell_t))
+    uint32_t time_unit_size;    // sizeof(md_unit_t)
+    uint64_t traj_size;
+    int64_t  traj_mtime;
+    uint64_t checksum;
+    int64_t  num_frames;
+    int64_t  num_atoms;
+    int64_t  max_frame_data_size;
+    uint8_t  time_unit[32];
+    // int64_t offsets[num_frames + 1]
+    // double  times[num_frames]
+    // uint8_t cells[num_frames * cell_stride]
+};
+
+struct TrajIndexCell {
+    uint32_t valid;
+    uint32_t reserved;
+    md_unit_cell_t cell;
+};
+
+static_assert(sizeof(md_unit_t) <= sizeof(TrajIndexHeader::time_unit), "Time unit does not fit within the index header");
+
+struct IndexedTrajectory {
+    mapped_file_t index;
+    bool writable;              // If the cells can be recorded
+    const TrajIndexHeader* header;
+    const int64_t* offsets;
+    const double*  times;
+    TrajIndexCell* cells;
+
+    md_array(double) frame_times;
+    md_trajectory_loader_i* loader;
+    md_trajectory_i* stub;      // Only used for decoding
+    FILE*      file;
+    md_mutex_t file_mutex;
+    md_allocator_i* alloc;
+};
+
+static inline int64_t index_size(int64_t num_frames) {
+    return (int64_t)sizeof(TrajIndexHeader) + (num_frames + 1) * (int64_t)sizeof(int64_t) + num_frames * (int64_t)sizeof(double) + num_frames * (int64_t)sizeof(TrajIndexCell);
+}
+
+static bool read_at(FILE* file, int64_t offset, void* dst, int64_t size) {
+#if MD_PLATFORM_WINDOWS
+    if (_fseeki64(file, offset, SEEK_SET) != 0) return false;
+#else
+    if (fseeko(file, (off_t)offset, SEEK_SET) != 0) return false;
+#endif
+    return (int64_t)fread(dst, 1, (size_t)size, file) == size;
+}
+
+static uint64_t compute_checksum(FILE* file, uint64_t file_size) {
+    const int64_t size = (int64_t)MIN(file_size, (uint64_t)TRAJ_INDEX_CHECKSUM_BYTES);
+    uint8_t* buf = (uint8_t*)md_alloc(md_heap_allocator, size);
+    defer { md_free(md_heap_allocator, buf, size); };
+
+    uint64_t hash = hash_bytes(&file_size, sizeof(file_size));
+    if (read_at(file, 0, buf, size)) {
+        hash = hash_bytes(buf, size, hash);
+    }
+    if (read_at(file, (int64_t)file_size - size, buf, size)) {
+        hash = hash_bytes(buf, size, hash);
+    }
+    return hash;
+}
+
+static void index_path_local(char* buf, size_t cap, str_t filename) {
+    snprintf(buf, cap, "%.*s.vidx", (int)filename.len, filename.ptr);
+}
+
+static bool index_path_cache(char* buf, size_t cap, str_t filename, const char* suffix) {
+    char dir[1024];
+    if (!get_cache_dir(dir, sizeof(dir))) return false;
+    snprintf(buf, cap, "%s/%016llx%s", dir, (unsigned long long)hash_bytes(filename.ptr, filename.len), suffix);
+    return true;
+}
+
+static void setup_pointers(IndexedTrajectory* it) {
+    const TrajIndexHeader* header = (const TrajIndexHeader*)it->index.ptr;
+    it->header  = header;
+    it->offsets = (const int64_t*)(header + 1);
+    it->times   = (const double*)(it->offsets + header->num_frames + 1);
+    it->cells   = (TrajIndexCell*)(it->times + header->num_frames);
+}
+
+static bool get_header(struct md_trajectory_o* inst, md_trajectory_header_t* header) {
+    IndexedTrajectory* it = (IndexedTrajectory*)inst;
+    MEMSET(header, 0, sizeof(md_trajectory_header_t));
+    header->num_frames = it->header->num_frames;
+    header->num_atoms  = it->header->num_atoms;
+    header->max_frame_data_size = it->header->max_frame_data_size;
+    MEMCPY(&header->time_unit, it->header->time_unit, sizeof(md_unit_t));
+    header->frame_times = it->frame_times;
+    return true;
+}
+
+static int64_t fetch_frame_data(struct md_trajectory_o* inst, int64_t idx, void* data_ptr) {
+    IndexedTrajectory* it = (IndexedTrajectory*)inst;
+    if (idx < 0 || idx >= it->header->num_frames) return 0;
+
+    const int64_t size = it->offsets[idx + 1] - it->offsets[idx];
+    if (data_ptr) {
+        md_mutex_lock(&it->file_mutex);
+        const bool result = read_at(it->file, it->offsets[idx], data_ptr, size);
+        md_mutex_unlock(&it->file_mutex);
+        if (!result) {
+            MD_LOG_ERROR("Indexed trajectory: failed to read frame %i", (int)idx);
+            return 0;
+        }
+    }
+    return size;
+}
+
+static bool decode_frame_data(struct md_trajectory_o* inst, const void* data_ptr, int64_t data_size, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    IndexedTrajectory* it = (IndexedTrajectory*)inst;
+    return md_trajectory_decode_frame_data(it->stub, data_ptr, data_size, header, x, y, z);
+}
+
+static bool load_frame(struct md_trajectory_o* inst, int64_t idx, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    IndexedTrajectory* it = (IndexedTrajectory*)inst;
+    if (idx < 0 || idx >= it->header->num_frames) return false;
+
+    // Header only queries can be answered from the index if the cell of the frame has been recorded
+    if (header && !x && !y && !z && it->cells[idx].valid) {
+        MEMSET(header, 0, sizeof(md_trajectory_frame_header_t));
+        header->num_atoms = it->header->num_atoms;
+        header->index     = idx;
+        header->timestamp = it->times[idx];
+        header->unit_cell = it->cells[idx].cell;
+        return true;
+    }
+
+    const int64_t size = fetch_frame_data(inst, idx, 0);
+    void* buf = md_alloc(md_heap_allocator, size);
+    defer { md_free(md_heap_allocator, buf, size); };
+    return fetch_frame_data(inst, idx, buf) == size && decode_frame_data(inst, buf, size, header, x, y, z);
+}
+
+// Copies everything up to the end of the first frame into the stub file
+static bool write_stub(const char* path, FILE* src, int64_t size) {
+    FILE* dst = fopen(path, "wb");
+    if (!dst) return false;
+
+    bool result = true;
+    const int64_t chunk = MEGABYTES(1);
+    void* buf = md_alloc(md_heap_allocator, chunk);
+    for (int64_t off = 0; off < size && result; off += chunk) {
+        const int64_t len = MIN(chunk, size - off);
+        result = read_at(src, off, buf, len) && (int64_t)fwrite(buf, 1, (size_t)len, dst) == len;
+    }
+    md_free(md_heap_allocator, buf, chunk);
+    fclose(dst);
+    return result;
+}
+
+static bool validate_index(const mapped_file_t* index, uint64_t traj_size, int64_t traj_mtime) {
+    if (index->size < (int64_t)sizeof(TrajIndexHeader)) return false;
+    const TrajIndexHeader* header = (const TrajIndexHeader*)index->ptr;
+    return header->magic == TRAJ_INDEX_MAGIC &&
+        header->version == TRAJ_INDEX_VERSION &&
+        header->cell_stride == sizeof(TrajIndexCell) &&
+        header->time_unit_size == sizeof(md_unit_t) &&
+        header->traj_size == traj_size &&
+        header->traj_mtime == traj_mtime &&
+        header->num_frames > 0 &&
+        index->size == index_size(header->num_frames);
+}
+
+// Maps a valid index of the trajectory, which is searched for next to the trajectory first and then in the cache directory.
+// On success the trajectory file, which is used to verify the checksum, is left open in out_file.
+static bool open_index(str_t filename, mapped_file_t* out_index, bool* out_writable, FILE** out_file) {
+    char traj_path[2048];
+    snprintf(traj_path, sizeof(traj_path), "%.*s", (int)filename.len, filename.ptr);
+
+    uint64_t traj_size;
+    int64_t  traj_mtime;
+    if (!file_stat(traj_path, &traj_size, &traj_mtime)) return false;
+
+    mapped_file_t index = {};
+    bool writable = false;
+    char path[2048];
+    index_path_local(path, sizeof(path), filename);
+    for (int i = 0; i < 2; ++i) {
+        if (i == 1 && !index_path_cache(path, sizeof(path), filename, ".vidx")) break;
+        writable = mapped_file_open(&index, path, 0, MAPPED_FILE_WRITE);
+        if (!writable && !mapped_file_open(&index, path, 0, 0)) continue;
+        if (validate_index(&index, traj_size, traj_mtime)) break;
+        mapped_file_close(&index);
+    }
+    if (!index.ptr) return false;
+
+    FILE* file = fopen(traj_path, "rb");
+    if (!file) {
+        mapped_file_close(&index);
+        return false;
+    }
+
+    const TrajIndexHeader* header = (const TrajIndexHeader*)index.ptr;
+    if (compute_checksum(file, traj_size) != header->checksum) {
+        MD_LOG_INFO("Trajectory index for '%s' does not match the content, it will be rebuilt", traj_path);
+        fclose(file);
+        mapped_file_close(&index);
+        return false;
+    }
+
+    *out_index = index;
+    *out_writable = writable;
+    *out_file = file;
+    return true;
+}
+
+bool traj_index_read_header(str_t filename, md_trajectory_header_t* header, md_array(double)* frame_times, md_allocator_i* alloc) {
+    ASSERT(header);
+    ASSERT(frame_times);
+    ASSERT(alloc);
+
+    mapped_file_t index;
+    bool writable;
+    FILE* file;
+    if (!open_index(filename, &index, &writable, &file)) return false;
+    fclose(file);
+
+    const TrajIndexHeader* src = (const TrajIndexHeader*)index.ptr;
+    const double* times = (const double*)((const int64_t*)(src + 1) + src->num_frames + 1);
+    md_array_resize(*frame_times, src->num_frames, alloc);
+    MEMCPY(*frame_times, times, src->num_frames * sizeof(double));
+
+    MEMSET(header, 0, sizeof(md_trajectory_header_t));
+    header->num_frames = src->num_frames;
+    header->num_atoms  = src->num_atoms;
+    header->max_frame_data_size = src->max_frame_data_size;
+    MEMCPY(&header->time_unit, src->time_unit, sizeof(md_unit_t));
+    header->frame_times = *frame_times;
+
+    mapped_file_close(&index);
+    return true;
+}
+
+md_trajectory_i* traj_index_open(str_t filename, md_trajectory_loader_i* loader, md_allocator_i* alloc) {
+    ASSERT(loader);
+    ASSERT(alloc);
+    char traj_path[2048];
+    snprintf(traj_path, sizeof(traj_path), "%.*s", (int)filename.len, filename.ptr);
+
+    mapped_file_t index;
+    bool writable;
+    FILE* file;
+    if (!open_index(filename, &index, &writable, &file)) return NULL;
+
+    const TrajIndexHeader* header = (const TrajIndexHeader*)index.ptr;
+
+    // The stub holds the first frame and is (re)created if missing
+    const int64_t* offsets = (const int64_t*)(header + 1);
+    const int64_t stub_size = offsets[1];
+    str_t ext = extract_ext(filename);
+    char stub_path[2048];
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".stub.%.*s", (int)ext.len, ext.ptr);
+    uint64_t cur_stub_size = 0;
+    if (!index_path_cache(stub_path, sizeof(stub_path), filename, suffix) ||
+        ((!file_stat(stub_path, &cur_stub_size, NULL) || cur_stub_size != (uint64_t)stub_size) && !write_stub(stub_path, file, stub_size))) {
+        MD_LOG_ERROR("Failed to create stub for indexed trajectory '%s'", traj_path);
+        fclose(file);
+        mapped_file_close(&index);
+        return NULL;
+    }
+
+    md_trajectory_i* stub = loader->create(str_from_cstr(stub_path), alloc);
+    if (!stub || md_trajectory_num_atoms(stub) != header->num_atoms) {
+        MD_LOG_ERROR("Failed to open stub for indexed trajectory '%s'", traj_path);
+        if (stub) loader->destroy(stub);
+        fclose(file);
+        mapped_file_close(&index);
+        return NULL;
+    }
+
+    IndexedTrajectory* it = (IndexedTrajectory*)md_alloc(alloc, sizeof(IndexedTrajectory));
+    MEMSET(it, 0, sizeof(IndexedTrajectory));
+    it->index    = index;
+    it->writable = writable;
+    it->loader   = loader;
+    it->stub     = stub;
+    it->file     = file;
+    it->alloc    = alloc;
+    md_mutex_init(&it->file_mutex);
+    setup_pointers(it);
+
+    md_array_resize(it->frame_times, header->num_frames, alloc);
+    MEMCPY(it->frame_times, it->times, header->num_frames * sizeof(double));
+
+    md_trajectory_i* traj = (md_trajectory_i*)md_alloc(alloc, sizeof(md_trajectory_i));
+    MEMSET(traj, 0, sizeof(md_trajectory_i));
+    traj->inst = (md_trajectory_o*)it;
+    traj->get_header = get_header;
+    traj->load_frame = load_frame;
+    traj->fetch_frame_data = fetch_frame_data;
+    traj->decode_frame_data = decode_frame_data;
+
+    MD_LOG_INFO("Opened trajectory '%s' using index (%i frames)", traj_path, (int)header->num_frames);
+    return traj;
+}
+
+void traj_index_close(md_trajectory_i* traj) {
+    ASSERT(traj);
+    IndexedTrajectory* it = (IndexedTrajectory*)traj->inst;
+    md_allocator_i* alloc = it->alloc;
+    it->loader->destroy(it->stub);
+    md_array_free(it->frame_times, alloc);
+    fclose(it->file);
+    md_mutex_destroy(&it->file_mutex);
+    mapped_file_close(&it->index);
+    md_free(alloc, it, sizeof(IndexedTrajectory));
+    md_free(alloc, traj, sizeof(md_trajectory_i));
+}
+
+// Locates the first frame within the head of the file, the remaining offsets follow from the frame sizes
+static int64_t find_first_offset(FILE* file, uint64_t file_size, const uint8_t* frame, int64_t frame_size) {
+    const int64_t head_size = (int64_t)MIN(file_size, (uint64_t)(TRAJ_INDEX_MAX_HEAD_BYTES + frame_size));
+    uint8_t* head = (uint8_t*)md_alloc(md_heap_allocator, head_size);
+    defer { md_free(md_heap_allocator, head, head_size); };
+    if (!read_at(file, 0, head, head_size)) return -1;
+
+    for (int64_t i = 0; i + frame_size <= head_size; ++i) {
+        if (head[i] == frame[0] && memcmp(head + i, frame, (size_t)frame_size) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool verify_frame(md_trajectory_i* traj, FILE* file, int64_t idx, int64_t offset, int64_t size) {
+    uint8_t* a = (uint8_t*)md_alloc(md_heap_allocator, size);
+    uint8_t* b = (uint8_t*)md_alloc(md_heap_allocator, size);
+    defer {
+        md_free(md_heap_allocator, a, size);
+        md_free(md_heap_allocator, b, size);
+    };
+    return md_trajectory_fetch_frame_data(traj, idx, a) == size && read_at(file, offset, b, size) && memcmp(a, b, (size_t)size) == 0;
+}
+
+bool traj_index_write(str_t filename, md_trajectory_i* traj) {
+    ASSERT(traj);
+
+    md_trajectory_header_t traj_header;
+    if (!md_trajectory_get_header(traj, &traj_header)) return false;
+    const int64_t num_frames = (int64_t)traj_header.num_frames;
+    if (num_frames < 2) return false; // Nothing to gain
+
+    char traj_path[2048];
+    snprintf(traj_path, sizeof(traj_path), "%.*s", (int)filename.len, filename.ptr);
+
+    uint64_t traj_size;
+    int64_t  traj_mtime;
+    if (!file_stat(traj_path, &traj_size, &traj_mtime)) return false;
+
+    FILE* file = fopen(traj_path, "rb");
+    if (!file) return false;
+    defer { fclose(file); };
+
+    // Offsets are derived from the frame sizes, which only holds if the frames are stored contiguously and unmodified.
+    // This is verified for the first, middle and last frame, otherwise no index is written.
+    md_allocator_i* alloc = md_heap_allocator;
+    int64_t* offsets = (int64_t*)md_alloc(alloc, (num_frames + 1) * sizeof(int64_t));
+    defer { md_free(alloc, offsets, (num_frames + 1) * sizeof(int64_t)); };
+
+    {
+        const int64_t size = md_trajectory_fetch_frame_data(traj, 0, 0);
+        if (size <= 0) return false;
+        uint8_t* frame = (uint8_t*)md_alloc(alloc, size);
+        defer { md_free(alloc, frame, size); };
+        if (md_trajectory_fetch_frame_data(traj, 0, frame) != size) return false;
+        offsets[0] = find_first_offset(file, traj_size, frame, size);
+        if (offsets[0] < 0) return false;
+    }
+
+    for (int64_t i = 0; i < num_frames; ++i) {
+        const int64_t size = md_trajectory_fetch_frame_data(traj, i, 0);
+        if (size <= 0) return false;
+        offsets[i + 1] = offsets[i] + size;
+    }
+
+    if (offsets[num_frames] > (int64_t)traj_size) return false;
+    const int64_t samples[] = {0, num_frames / 2, num_frames - 1};
+    for (int64_t idx : samples) {
+        if (!verify_frame(traj, file, idx, offsets[idx], offsets[idx + 1] - offsets[idx])) {
+            MD_LOG_DEBUG("Trajectory frames are not stored contiguously, no index will be written for '%s'", traj_path);
+            return false;
+        }
+    }
+
+    TrajIndexHeader header = {};
+    header.magic = TRAJ_INDEX_MAGIC;
+    header.version = TRAJ_INDEX_VERSION;
+    header.cell_stride = sizeof(TrajIndexCell);
+    header.time_unit_size = sizeof(md_unit_t);
+    header.traj_size = traj_size;
+    header.traj_mtime = traj_mtime;
+    header.checksum = compute_checksum(file, traj_size);
+    header.num_frames = num_frames;
+    header.num_atoms = (int64_t)traj_header.num_atoms;
+    header.max_frame_data_size = (int64_t)traj_header.max_frame_data_size;
+    MEMCPY(header.time_unit, &traj_header.time_unit, sizeof(md_unit_t));
+
+    mapped_file_t index = {};
+    char path[2048];
+    index_path_local(path, sizeof(path), filename);
+    if (!mapped_file_open(&index, path, index_size(num_frames), MAPPED_FILE_WRITE | MAPPED_FILE_CREATE)) {
+        if (!index_path_cache(path, sizeof(path), filename, ".vidx") || !mapped_file_open(&index, path, index_size(num_frames), MAPPED_FILE_WRITE | MAPPED_FILE_CREATE)) {
+            MD_LOG_DEBUG("Could not create trajectory index for '%s'", traj_path);
+            return false;
+        }
+    }
+
+    // The header is written last, so a partially written index is never valid
+    TrajIndexHeader* dst = (TrajIndexHeader*)index.ptr;
+    dst->magic = 0;
+    int64_t* dst_offsets = (int64_t*)(dst + 1);
+    double*  dst_times   = (double*)(dst_offsets + num_frames + 1);
+    TrajIndexCell* dst_cells = (TrajIndexCell*)(dst_times + num_frames);
+    MEMCPY(dst_offsets, offsets, (num_frames + 1) * sizeof(int64_t));
+    for (int64_t i = 0; i < num_frames; ++i) {
+        dst_times[i] = traj_header.frame_times ? traj_header.frame_times[i] : (double)i;
+    }
+    MEMSET(dst_cells, 0, num_frames * sizeof(TrajIndexCell));
+    MEMCPY(dst, &header, sizeof(header));
+    mapped_file_close(&index);
+
+    MD_LOG_DEBUG("Wrote trajectory index '%s'", path);
+    return true;
+}
+
+bool traj_index_peek_first_frame(str_t filename, md_trajectory_loader_i* loader, int64_t num_atoms, md_trajectory_frame_header_t* header, float* x, float* y, float* z) {
+    ASSERT(loader);
+    char traj_path[2048];
+    snprintf(traj_path, sizeof(traj_path), "%.*s", (int)filename.len, filename.ptr);
+
+    uint64_t traj_size;
+    if (!file_stat(traj_path, &traj_size, NULL)) return false;
+
+    str_t ext = extract_ext(filename);
+    char head_path[2048];
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".head.%.*s", (int)ext.len, ext.ptr);
+    if (!index_path_cache(head_path, sizeof(head_path), filename, suffix)) return false;
+
+    FILE* file = fopen(traj_path, "rb");
+    if (!file) return false;
+    defer { fclose(file); };
+
+    // The size of a frame depends on the format (compressed, binary or text), so the head is grown until it holds the first frame
+    bool result = false;
+    for (int64_t bytes_per_atom = 16; bytes_per_atom <= 128 && !result; bytes_per_atom *= 2) {
+        const int64_t head_size = num_atoms * bytes_per_atom + KILOBYTES(64);
+        if ((uint64_t)head_size >= traj_size) break;
+        if (!write_stub(head_path, file, head_size)) break;
+
+        md_trajectory_i* head = loader->create(str_from_cstr(head_path), md_heap_allocator);
+        if (head) {
+            result = md_trajectory_num_atoms(head) == num_atoms && md_trajectory_num_frames(head) > 0 && md_trajectory_load_frame(head, 0, header, x, y, z);
+            loader->destroy(head);
+        }
+    }
+    remove(head_path);
+    return result;
+}
+
+void traj_index_record_cell(md_trajectory_i* traj, int64_t frame_idx, const md_unit_cell_t* cell) {
+    ASSERT(traj);
+    ASSERT(cell);
+    IndexedTrajectory* it = (IndexedTrajectory*)traj->inst;
+    if (!it->writable || frame_idx < 0 || frame_idx >= it->header->num_frames) return;
+    TrajIndexCell* entry = &it->cells[frame_idx];
+    if (!entry->valid) {
+        entry->cell = *cell;
+        entry->valid = 1;
+    }
+}
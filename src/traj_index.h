@@ -0,0 +1,39 @@
+#pragma once
+
+#include <core/md_str.h>
+#include <core/md_array.h>
+
+#include <stdint.h>
+
+struct md_allocator_i;
+struct md_trajectory_i;
+struct md_trajectory_loader_i;
+struct md_unit_cell_t;
+struct md_trajectory_header_t;
+struct md_trajectory_frame_header_t;
+
+// Sidecar index for trajectory files, which allows a trajectory to be opened without scanning the whole file.
+// The index holds the frame offsets, frame times, the unit cell of each frame (recorded as frames are decoded) and a checksum of the content.
+// It is written next to the trajectory as '<file>.vidx', or into the cache directory if that is not possible,
+// and it is validated against the size, modification time and checksum of the trajectory when it is opened.
+//
+// A trajectory opened through its index decodes frames using a stub trajectory, which only contains the first frame
+// (and whatever precedes it in the file), while the raw frame data is read directly from the original file using the offsets.
+
+// Returns NULL if there is no valid index for the trajectory
+md_trajectory_i* traj_index_open(str_t filename, md_trajectory_loader_i* loader, md_allocator_i* alloc);
+void traj_index_close(md_trajectory_i* traj);
+
+// Reads the header of a trajectory from its index without opening the trajectory, which is cheap compared to opening it.
+// The frame times are copied into frame_times (which header->frame_times refers to). Returns false if there is no valid index.
+bool traj_index_read_header(str_t filename, md_trajectory_header_t* header, md_array(double)* frame_times, md_allocator_i* alloc);
+
+// Builds and writes the index for a trajectory which was opened (scanned) by its loader
+bool traj_index_write(str_t filename, md_trajectory_i* traj);
+
+// Loads the first frame of a trajectory without scanning the whole file, by opening a copy of the head of the file which is large enough to hold it.
+// Meant for showing the first frame while the trajectory is being opened. Returns false if the file is small enough to be opened directly or if the frame could not be read.
+bool traj_index_peek_first_frame(str_t filename, md_trajectory_loader_i* loader, int64_t num_atoms, md_trajectory_frame_header_t* header, float* x, float* y, float* z);
+
+// Records the unit cell of a decoded frame, which later allows the frame header to be queried without loading the frame
+void traj_index_record_cell(md_trajectory_i* traj, int64_t frame_idx, const md_unit_cell_t* cell);